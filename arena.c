@@ -0,0 +1,97 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int arena_add_block(Arena *arena, size_t min_size) {
+  size_t size = ARENA_BLOCK_SIZE;
+  if (min_size > size) {
+    size = min_size;
+  }
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  if (!block) {
+    fprintf(stderr, "couldn't allocate arena block of %zu bytes\n", size);
+    return -1;
+  }
+  block->prev = arena->current;
+  block->size = size;
+  block->used = 0;
+  arena->current = block;
+  arena->num_blocks++;
+  return 0;
+}
+
+int arena_init(Arena *arena) {
+  arena->current = NULL;
+  arena->num_allocs = 0;
+  arena->num_blocks = 0;
+  arena->bytes = 0;
+  return arena_add_block(arena, 0);
+}
+
+void arena_quit(Arena *arena) {
+  ArenaBlock *block = arena->current;
+  while (block) {
+    ArenaBlock *prev = block->prev;
+    free(block);
+    block = prev;
+  }
+  arena->current = NULL;
+  arena->num_blocks = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  // everything is aligned for pointers and 64 bit ints
+  size = (size + 7) & ~(size_t)7;
+  ArenaBlock *block = arena->current;
+  if (!block || block->used + size > block->size) {
+    if (arena_add_block(arena, size) < 0) {
+      return NULL;
+    }
+    block = arena->current;
+  }
+  void *result = block->data + block->used;
+  block->used += size;
+  arena->num_allocs++;
+  arena->bytes += size;
+  return result;
+}
+
+void *arena_realloc(Arena *arena, void *old, size_t oldsize, size_t newsize) {
+  // the last allocation can simply grow in place
+  ArenaBlock *block = arena->current;
+  size_t oldaligned = (oldsize + 7) & ~(size_t)7;
+  size_t newaligned = (newsize + 7) & ~(size_t)7;
+  if (old && block && (char *)old + oldaligned == block->data + block->used &&
+      block->used - oldaligned + newaligned <= block->size) {
+    block->used = block->used - oldaligned + newaligned;
+    arena->bytes += newaligned - oldaligned;
+    return old;
+  }
+  void *result = arena_alloc(arena, newsize);
+  if (result && old) {
+    memcpy(result, old, oldsize < newsize ? oldsize : newsize);
+  }
+  return result;
+}
+
+ArenaMark arena_mark(Arena *arena) {
+  ArenaMark mark = {.block = arena->current,
+                    .used = arena->current ? arena->current->used : 0};
+  return mark;
+}
+
+// the blocks added since the mark are freed, the
+// statistics keep counting everything ever allocated
+void arena_reset(Arena *arena, ArenaMark mark) {
+  while (arena->current && arena->current != mark.block) {
+    ArenaBlock *prev = arena->current->prev;
+    free(arena->current);
+    arena->current = prev;
+    arena->num_blocks--;
+  }
+  if (arena->current) {
+    arena->current->used = mark.used;
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef MY_ARENA_H
+#define MY_ARENA_H
+
+//////// arena ////////////////////
+// bump pointer allocator for everything that lives
+// as long as the parser (ast nodes, types, node lists).
+// nothing is freed on its own, all blocks are
+// released together in arena_quit or everything
+// allocated after a mark is dropped by arena_reset
+typedef struct ArenaBlock {
+  struct ArenaBlock *prev;
+  size_t size;
+  size_t used;
+  char data[];
+} ArenaBlock;
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+typedef struct Arena {
+  ArenaBlock *current;
+  size_t num_allocs;
+  size_t num_blocks;
+  size_t bytes;
+} Arena;
+
+typedef struct ArenaMark {
+  ArenaBlock *block;
+  size_t used;
+} ArenaMark;
+
+int       arena_init(Arena *arena);
+void      arena_quit(Arena *arena);
+void     *arena_alloc(Arena *arena, size_t size);
+void     *arena_realloc(Arena *arena, void *old, size_t oldsize, size_t newsize);
+ArenaMark arena_mark(Arena *arena);
+void      arena_reset(Arena *arena, ArenaMark mark);
+
+#endif
@@ -21,6 +21,8 @@ typedef struct InvalidAstError {
 
 typedef struct Error {
   ErrorKind kind;
+  // index into the parse diagnostics or -1
+  int32_t diagnostic;
   union {
     UnexpectedTokenError unexpectedToken;
     InvalidAstError invalid;
@@ -44,10 +46,11 @@ typedef struct AstBreak {
 typedef struct AstDecl {
   Token kind;
   Token name;
-  int num_pointers;
+  int16_t num_pointers;
+  // from _Alignas or the aligned attribute, 0 if none
+  int16_t align;
 
   int size;
-  int assembly_base_offset;
   struct AstNode *expr;
 } AstDecl;
 
@@ -79,8 +82,16 @@ typedef struct AstVar {
   struct AstNode *declaration;
   Token name;
   struct AstNode *member_access;
+  // displacement and width of the accessed member
+  // within the variable, width is 0 until resolved
+  int offset;
+  int width;
 } AstVar;
 
+// number of list entries that are stored
+// right behind the node that owns the list
+#define ASTNODELIST_INLINE 4
+
 typedef struct AstNodeList {
   struct AstNode **nodes;
   int len;
@@ -93,11 +104,37 @@ typedef struct AstFuncCall {
   AstNodeList params;
 } AstFuncCall;
 
+typedef struct StructMember {
+  SymbolId name;
+  // -1 if a member before it has no known size
+  int offset;
+  int size;
+  int align;
+  struct AstNode *decl;
+  struct Type *type;
+} StructMember;
+
+// built once after the struct sizes are resolved,
+// members are looked up by name with open addressing
+typedef struct StructLayout {
+  StructMember *members;
+  int num_members;
+  // index + 1 into members or 0
+  uint32_t *slots;
+  uint32_t mask;
+} StructLayout;
+
 typedef struct AstNodeStruct {
   Token name;
   AstNodeList members;
-  bool members_all_defined;
   int size;
+  // size with the members in declaration order
+  int declared_size;
+  StructLayout *layout;
+  // asked for on the struct or one of its members,
+  // 0 if everything has its usual alignment
+  int align;
+  bool members_all_defined;
 } AstNodeStruct;
 
 typedef struct AstFuncPrototype {
@@ -124,15 +161,22 @@ typedef enum TypeKind {
   FOREACH_TYPE_KIND(GENERATE_ENUM)
 } TypeKind;
 
+// interned by the parser, equal types are the
+// same pointer and are never modified after creation
 typedef struct Type {
   TypeKind kind;
   struct AstNode *definition;
   int num_pointers;
   const char *error;
+  // next interned type with the same hash
+  struct Type *next;
 } Type;
 
 typedef struct AstNode {
   AstNodeKind kind;
+  // index + 1 of the root in the flat expression
+  // array or 0 if this expression wasn't flattened
+  uint32_t flat;
   Type *type;
   union {
     Token literal;
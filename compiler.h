@@ -18,6 +18,8 @@
   MACRO(TOK_KEYWORD_INT)                                                       \
   MACRO(TOK_KEYWORD_CHAR)                                                      \
   MACRO(TOK_KEYWORD_RETURN)                                                    \
+  MACRO(TOK_KEYWORD_ALIGNAS)                                                   \
+  MACRO(TOK_KEYWORD_ATTRIBUTE)                                                 \
   MACRO(TOK_IDENTIFIER)                                                        \
   MACRO(TOK_TYPE_IDENTIFIER)                                                   \
   MACRO(TOK_NORMAL_IDENTIFIER)                                                 \
@@ -28,6 +30,7 @@
   MACRO(TOK_PLUS)                                                              \
   MACRO(TOK_MUL)                                                               \
   MACRO(TOK_DIV)                                                               \
+  MACRO(TOK_MOD)                                                               \
   MACRO(TOK_DOT)                                                               \
   MACRO(TOK_ASSIGN)                                                            \
   MACRO(TOK_SINGLE_AMPERSAND)                                                  \
@@ -43,6 +46,22 @@
   MACRO(TOK_UNKNOWN)                                                           \
   MACRO(TOK_EOF)
 
+// binary operators with their precedence, higher binds
+// tighter, and associativity. any other token ends an
+// expression
+#define FOREACH_BINARY_OP(MACRO)                                               \
+  MACRO(TOK_ASSIGN, 1, ASSOC_RIGHT)                                            \
+  MACRO(TOK_LOGICAL_EQUAL, 2, ASSOC_LEFT)                                      \
+  MACRO(TOK_LOGICAL_LESS, 2, ASSOC_LEFT)                                       \
+  MACRO(TOK_LOGICAL_LESS_EQUAL, 2, ASSOC_LEFT)                                 \
+  MACRO(TOK_LOGICAL_GREATER, 2, ASSOC_LEFT)                                    \
+  MACRO(TOK_LOGICAL_GREATER_EQUAL, 2, ASSOC_LEFT)                              \
+  MACRO(TOK_PLUS, 5, ASSOC_LEFT)                                               \
+  MACRO(TOK_MINUS, 5, ASSOC_LEFT)                                              \
+  MACRO(TOK_MUL, 10, ASSOC_LEFT)                                               \
+  MACRO(TOK_DIV, 10, ASSOC_LEFT)                                               \
+  MACRO(TOK_MOD, 10, ASSOC_LEFT)
+
 #define FOREACH_EXPR_KIND(MACRO)                                               \
   MACRO(EXPR_CONST)                                                            \
   MACRO(EXPR_UNOP)                                                             \
@@ -93,12 +112,18 @@ typedef enum { FOREACH_TOKENKIND(GENERATE_ENUM) } TokenKind;
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "str.h"
+#include "arena.h"
 #include "lex.h"
 #include "ast.h"
+#include "flat.h"
+#include "walk.h"
 #include "table.h"
 #include "dep.h"
+#include "ir.h"
+#include "peephole.h"
 
 
 typedef struct FileManager {
@@ -117,15 +142,28 @@ String filemanager_get_filename(FileManager *manager, int file_id);
 
 
 
+// every symbol id maps to its current declaration.
+// a declaration saves the one it shadows on an undo
+// stack, leaving a block pops back to the mark of
+// its entry and restores the shadowed declarations
+typedef struct ScopeBinding {
+  SymbolId key;
+  void *shadowed;
+} ScopeBinding;
+
 typedef struct Scope {
-  struct Scope *parent;
-  PtrBucket vars;
+  SymbolMap current;
+  ScopeBinding *undo;
+  int len;
+  int cap;
 } Scope;
 
 int   scope_init(Scope *scope);
 int   scope_quit(Scope *scope);
-void *scope_get(Scope *scope, uint64_t key);
-int   scope_put(Scope *scope, uint64_t key, void *data);
+int   scope_enter(Scope *scope);
+void  scope_leave(Scope *scope, int mark);
+void *scope_get(Scope *scope, SymbolId key);
+int   scope_put(Scope *scope, SymbolId key, void *data);
 
 
 typedef enum {
@@ -149,39 +187,124 @@ typedef enum {
 } AssemblyRegisterType;
 
 typedef struct AssemblyVarInfo {
-  uint64_t name;
+  SymbolId name;
   unsigned size;
   bool isOnStack;
   bool isValid;
   union {
     AssemblyRegisterType registerType;
+    // the variable starts at -stackOffset(%rbp)
     int stackOffset;
   };
+  // index of the binding this one shadows or -1
+  int shadowed;
 } AssemblyVarInfo;
 
+// maps the symbol id of a variable to its location.
+// bindings are kept on a stack: a checkpoint is its length
+// and restoring one just truncates it. bindings above the
+// length are stale and get skipped (and repaired) lazily,
+// so lookup, add and checkpoint/restore are all O(1)
 typedef struct AssemblyVarTable {
   AssemblyVarInfo *data;
   int cap;
   int len;
+  // highest length so far, entries from len
+  // up to here are stale bindings
+  int written;
+
+  // symbol id -> index of its newest binding or -1
+  int *top;
+  unsigned topcap;
 
+  // stack offsets start at 0 again
+  // for the variables of every function
+  int frame_start;
 } AssemblyVarTable;
 
 int vartable_init(AssemblyVarTable *table);
 int vartable_quit(AssemblyVarTable *table);
 int vartable_checkpoint_get(AssemblyVarTable *table);
 int vartable_checkpoint_set(AssemblyVarTable *table, int checkpoint);
+int vartable_frame_begin(AssemblyVarTable *table);
 int vartable_add(AssemblyVarTable *table, AssemblyVarInfo info);
-AssemblyVarInfo vartable_get(AssemblyVarTable *table, uint64_t name);
+AssemblyVarInfo vartable_get(AssemblyVarTable *table, SymbolId name);
 AssemblyVarInfo vartable_last_on_stack(AssemblyVarTable *table);
+int vartable_stack_size(AssemblyVarTable *table);
+int vartable_add_stack_var(AssemblyVarTable *table, SymbolId name,
+                           unsigned size, unsigned align);
+
+// pending operators of the expression parser, parens
+// and prefix operators wait here for their operands
+typedef enum { EXPR_OP_BINARY, EXPR_OP_UNARY, EXPR_OP_PAREN } ExprOpKind;
+
+typedef struct ExprOp {
+  Token op;
+  ExprOpKind kind;
+} ExprOp;
+
+// shared by nested expressions (function arguments),
+// every expression only touches what is above its base
+typedef struct ExprStack {
+  ExprOp *ops;
+  uint32_t num_ops;
+  uint32_t ops_cap;
+
+  AstNode **operands;
+  uint32_t num_operands;
+  uint32_t operands_cap;
+} ExprStack;
+
+typedef struct ParseDiagnostic {
+  // unexpected token or invalid ast without a node,
+  // NULL once it became the reason for another error
+  AstNode *error;
+  // the innermost invalid ast wrapping it
+  AstNode *because;
+} ParseDiagnostic;
 
 typedef struct Parser {
   Lexer lexer;
   StringInterner pool;
 
+  // owns every ast node, type and node
+  // list, they are all released at once
+  Arena arena;
+
   AstNode *root;
 
-  PtrBucket struct_definitions;
-  PtrBucket function_definitions;
+  ExprStack expr_stack;
+
+  // post-order copy of the expressions
+  // that code generation walks
+  FlatAst flat;
+
+  // every distinct type exists once
+  PtrBucket types;
+  size_t num_types;
+  // taken by the workers that resolve
+  // function bodies in parallel
+  pthread_mutex_t types_lock;
+  // function bodies are type checked on this
+  // many threads, 1 resolves everything in order
+  int num_threads;
+
+  // indexed by the symbol id of the name
+  SymbolMap struct_definitions;
+  // members are placed by descending alignment
+  // instead of in declaration order
+  bool reorder_structs;
+  // functions are lowered to the ir and emitted from
+  // there, otherwise straight from the ast like -fast does
+  bool use_ir;
+  // the assembly goes through the peephole optimizer,
+  // hits counts its rewrites of the last output
+  bool peephole;
+  uint64_t peephole_hits[NUM_PEEP_RULES];
+  // largest alignment that was asked for explicitly,
+  // frames are only realigned if it is above 16
+  int max_align;
+  SymbolMap function_definitions;
 
   // needed to order to calculate
   // struct sizes out of order
@@ -196,7 +319,11 @@ typedef struct Parser {
   // simple assembly code generation
   AssemblyVarTable assembly_variables;
 
-  bool hasErrors;
+  // parse errors in the order they were found
+  ParseDiagnostic *diagnostics;
+  uint32_t num_diagnostics;
+  uint32_t diagnostics_cap;
+  int num_errors;
 
 } Parser;
 
@@ -205,8 +332,19 @@ void parser_parse(Parser *parser, String content, int fileid,
                   FileManager *manager);
 void parser_analyze(Parser *parser);
 void parser_print(Parser *parser);
+void parser_struct_report(Parser *parser, FILE *file);
 void parser_dump_assembly(Parser *parser, FILE *file);
+void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
+                                  int indent, AstNode *currentfunc);
+void dump_assembly_header(FILE *file, int indent);
+void parser_dump_assembly_ir(Parser *parser, FILE *file);
+void parser_dump_ir(Parser *parser, FILE *file);
+int  parser_compile_fast(Parser *parser, String content, int fileid,
+                         FileManager *manager, FILE *file);
 void parser_quit(Parser *parser);
+void parser_flatten(Parser *parser, AstNode *node);
+int parser_resolve_types_parallel(Parser *parser, AstNode *root,
+                                  int num_threads);
 
 String parser_token_content(Parser *parser, Token tok);
 String parser_token_filename(Parser *parser, Token tok);
@@ -214,7 +352,39 @@ int parser_analyze_types(Parser *parser);
 
 int size_of_type(Parser *parser, Token kind);
 int offset_align(int offset, int multiple);
+// qsort comparison of uint64_t keys
+int compare_u64(const void *a, const void *b);
+// cached on the variable after the first lookup
 int var_member_offset(Parser *parser, AstNode *node, int *last_member_size);
+StructLayout *struct_layout_of(Parser *parser, AstNode *def);
+StructMember *struct_layout_find(StructLayout *layout, SymbolId name);
+
+int  decl_stack_size(Parser *parser, AstNode *decl);
+int  decl_stack_align(Parser *parser, AstNode *decl);
+bool decl_is_struct(Parser *parser, AstNode *decl);
+int  function_frame_align(Parser *parser, AstNode *func);
+
+// names of the 8, 4 and 1 byte registers
+extern const char *ir_reg_names[][3];
+void strength_mul(FILE *file, int indent, AssemblyRegisterType reg,
+                  int32_t c);
+void strength_div(FILE *file, int indent, int32_t d, bool mod);
+
+int  ir_lower_function(Parser *parser, AstNode *func, IrFunc *fn);
+void ir_func_print(Parser *parser, IrFunc *fn, FILE *file);
+void ir_emit_function(Parser *parser, IrFunc *fn, FILE *file);
+bool ir_is_terminator(IrOp op);
+bool ir_block_terminated(IrBlock *block);
+bool ir_is_const(IrFunc *fn, int value);
+bool ir_parse_int(String literal, int64_t *value);
+int  ir_add_value(Parser *parser, IrFunc *fn, IrType type);
+int  ir_add_block(Parser *parser, IrFunc *fn);
+int  ir_insert(Parser *parser, IrBlock *block, int index, IrInst inst);
+int  ir_finish(Parser *parser, IrFunc *fn);
+int  ir_promote_locals(Parser *parser, IrFunc *fn);
+int  ir_fold_constants(Parser *parser, IrFunc *fn);
+int  ir_hoist_invariants(Parser *parser, IrFunc *fn);
+int  ir_allocate_registers(Parser *parser, IrFunc *fn);
 
 // Regular text
 #define BLK "\e[0;30m"
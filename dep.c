@@ -6,6 +6,7 @@
 #include <memory.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 
 int arr_ituple_init(IntTupleArray *tuples){
@@ -43,132 +44,315 @@ int arr_ituple_add(IntTupleArray *graph, IntTuple entry){
 }
 
 
+static void depgraph_free_prepared(DepGraph *graph) {
+  free(graph->index_of);
+  free(graph->ids);
+  free(graph->dependents_start);
+  free(graph->dependents);
+  free(graph->pending);
+  free(graph->defined);
+  free(graph->queue);
+  free(graph->cycles);
+  free(graph->cycles_start);
+  free(graph->cycle_of);
+  graph->cycle_of = NULL;
+  graph->index_of = NULL;
+  graph->ids = NULL;
+  graph->dependents_start = NULL;
+  graph->dependents = NULL;
+  graph->pending = NULL;
+  graph->defined = NULL;
+  graph->queue = NULL;
+  graph->cycles = NULL;
+  graph->cycles_start = NULL;
+  graph->num_ids = 0;
+  graph->num_nodes = 0;
+  graph->queue_head = 0;
+  graph->queue_tail = 0;
+  graph->num_cycles = 0;
+}
+
 int depgraph_init(DepGraph *graph){
-  graph->resolved_i = 0;
+  graph->index_of = NULL;
+  graph->ids = NULL;
+  graph->dependents_start = NULL;
+  graph->dependents = NULL;
+  graph->pending = NULL;
+  graph->defined = NULL;
+  graph->queue = NULL;
+  graph->cycles = NULL;
+  graph->cycles_start = NULL;
+  graph->cycle_of = NULL;
+  depgraph_free_prepared(graph);
   return arr_ituple_init(&graph->dependencies);
 }
 
 int depgraph_quit(DepGraph *graph){
+  depgraph_free_prepared(graph);
   return arr_ituple_quit(&graph->dependencies);
 }
 
 int depgraph_add(DepGraph *graph, IntTuple tuple){
-  graph->resolved_i++;
   return arr_ituple_add(&graph->dependencies, tuple);
 }
 
-int depgraph_quasi_resolve(DepGraph *graph, int resolvedItem){
-  // everything that depends on the resolved item
-  // moves to the quasi resolved section
-  int num_resolved = 0;
-  for (int i = 0; i < graph->resolved_i; i++) {
-    IntTuple tuple = graph->dependencies.data[i];
-    while(tuple.second == resolvedItem && i < graph->resolved_i ){
-      IntTuple tmp = graph->dependencies.data[graph->resolved_i-1];
-      graph->dependencies.data[graph->resolved_i - 1] = tuple;
-      graph->dependencies.data[i] = tmp;
-      graph->resolved_i--;
-      tuple = tmp;
-      num_resolved++;
-    }
+static uint32_t depgraph_node(DepGraph *graph, uint64_t id) {
+  if (graph->index_of[id] == UINT32_MAX) {
+    graph->index_of[id] = graph->num_nodes;
+    graph->ids[graph->num_nodes] = id;
+    graph->defined[graph->num_nodes] = false;
+    graph->num_nodes++;
   }
-  return num_resolved;
+  return graph->index_of[id];
 }
 
-void depgraph_remove_pending_duplicates(DepGraph *graph, IntTuple tuple){
-  for (int i = graph->resolved_i; i < graph->dependencies.len; i++) {
-    IntTuple t = graph->dependencies.data[i];
-    while (t.first == tuple.first && i < graph->dependencies.len) {
-      t = graph->dependencies.data[graph->dependencies.len - 1];
-      graph->dependencies.data[i] = t;
-      graph->dependencies.len--;
+int depgraph_prepare(DepGraph *graph) {
+  depgraph_free_prepared(graph);
+
+  IntTupleArray *edges = &graph->dependencies;
+  uint64_t max_id = 0;
+  for (int i = 0; i < edges->len; i++) {
+    if (edges->data[i].first > max_id) {
+      max_id = edges->data[i].first;
+    }
+    if (edges->data[i].second > max_id) {
+      max_id = edges->data[i].second;
     }
   }
-}
 
-IntTuple depgraph_pop_quasi_resolved(DepGraph *graph){
-  IntTuple err = {DEPGRAPH_EMPTY, DEPGRAPH_EMPTY};
-  if(graph->dependencies.len <= 0){
-    return err;
+  // at most two nodes per tuple
+  size_t max_nodes = (size_t)edges->len * 2 + 1;
+  graph->num_ids = max_id + 1;
+  graph->index_of = malloc(sizeof(*graph->index_of) * graph->num_ids);
+  graph->ids = malloc(sizeof(*graph->ids) * max_nodes);
+  graph->defined = malloc(sizeof(*graph->defined) * max_nodes);
+  if (!graph->index_of || !graph->ids || !graph->defined) {
+    fprintf(stderr, "couldn't allocate dependency graph for %d tuples\n",
+            edges->len);
+    depgraph_free_prepared(graph);
+    return -1;
   }
-  IntTuple tuple = graph->dependencies.data[graph->dependencies.len - 1];
-  graph->dependencies.len--;
-  return tuple;
-}
+  memset(graph->index_of, 0xff, sizeof(*graph->index_of) * graph->num_ids);
 
-int depgraph_item_is_fully_resolved(DepGraph *graph, IntTuple res) {
-  bool is_fully_resolved = true;
-  for (int i = 0; i < graph->resolved_i; i++) {
-    if (graph->dependencies.data[i].first == res.first) {
-      depgraph_remove_pending_duplicates(graph, res);
-      is_fully_resolved = false;
-      break;
+  for (int i = 0; i < edges->len; i++) {
+    uint32_t first = depgraph_node(graph, edges->data[i].first);
+    graph->defined[first] = true;
+    if (edges->data[i].second != 0) {
+      depgraph_node(graph, edges->data[i].second);
     }
   }
-  return is_fully_resolved;
-}
 
-IntTuple depgraph_pop_fully_resolved(DepGraph *graph) {
-  // now we get one of the quasi resolved
-  // elements and ensure that it
-  // really doesn't depend on anything else
-  IntTuple res;
-  int is_resolved = false;
-  do {
-    res = depgraph_pop_quasi_resolved(graph);
-    is_resolved = depgraph_item_is_fully_resolved(graph, res);
-    depgraph_remove_pending_duplicates(graph, res);
-  } while (graph->resolved_i <= graph->dependencies.len && !is_resolved);
-  return res;
+  uint32_t n = graph->num_nodes;
+  graph->dependents_start = calloc(n + 1, sizeof(*graph->dependents_start));
+  graph->dependents = malloc(sizeof(*graph->dependents) * (edges->len + 1));
+  graph->pending = calloc(n + 1, sizeof(*graph->pending));
+  graph->queue = malloc(sizeof(*graph->queue) * (n + 1));
+  if (!graph->dependents_start || !graph->dependents || !graph->pending ||
+      !graph->queue) {
+    fprintf(stderr, "couldn't allocate dependency graph for %u nodes\n", n);
+    depgraph_free_prepared(graph);
+    return -1;
+  }
+
+  // count, prefix sum, fill
+  for (int i = 0; i < edges->len; i++) {
+    if (edges->data[i].second == 0) {
+      continue;
+    }
+    graph->dependents_start[graph->index_of[edges->data[i].second] + 1]++;
+    graph->pending[graph->index_of[edges->data[i].first]]++;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    graph->dependents_start[i + 1] += graph->dependents_start[i];
+  }
+  uint32_t *fill = graph->queue;
+  memcpy(fill, graph->dependents_start, sizeof(*fill) * n);
+  for (int i = 0; i < edges->len; i++) {
+    if (edges->data[i].second == 0) {
+      continue;
+    }
+    uint32_t second = graph->index_of[edges->data[i].second];
+    graph->dependents[fill[second]++] = graph->index_of[edges->data[i].first];
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    if (graph->pending[i] == 0 && graph->defined[i]) {
+      graph->queue[graph->queue_tail++] = i;
+    }
+  }
+  return 0;
 }
 
 uint64_t depgraph_resolve(DepGraph *graph) {
-  if (graph->resolved_i <= 0) {
-    if (graph->dependencies.len <= 0) {
-      fprintf(stderr, "already resolved dependency graph\n");
-      return DEPGRAPH_EMPTY;
+  if (graph->queue_head >= graph->queue_tail) {
+    return DEPGRAPH_EMPTY;
+  }
+  uint32_t node = graph->queue[graph->queue_head++];
+  for (uint32_t i = graph->dependents_start[node];
+       i < graph->dependents_start[node + 1]; i++) {
+    uint32_t dependent = graph->dependents[i];
+    graph->pending[dependent]--;
+    if (graph->pending[dependent] == 0 && graph->defined[dependent]) {
+      graph->queue[graph->queue_tail++] = dependent;
     }
-    // there are still some
-    // resolved dependencies pending
-    // so get the last one
-    IntTuple tuple = depgraph_pop_quasi_resolved(graph);
-    depgraph_remove_pending_duplicates(graph, tuple);
+  }
+  return graph->ids[node];
+}
 
-    // now we can return
-    // the pending dependency
-    return tuple.first;
+bool depgraph_is_resolved(DepGraph *graph, uint64_t id) {
+  if (id >= graph->num_ids || graph->index_of[id] == UINT32_MAX) {
+    return false;
   }
+  uint32_t node = graph->index_of[id];
+  return graph->defined[node] && graph->pending[node] == 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// tarjan's algorithm with an explicit stack over the nodes
+// that still wait for dependencies. a component is a cycle
+// if it has more than one member or depends on itself
+int depgraph_find_cycles(DepGraph *graph) {
+  uint32_t n = graph->num_nodes;
+  free(graph->cycles);
+  free(graph->cycles_start);
+  free(graph->cycle_of);
+  graph->num_cycles = 0;
+  graph->cycles = malloc(sizeof(*graph->cycles) * (n + 1));
+  graph->cycles_start = malloc(sizeof(*graph->cycles_start) * (n + 1));
+  graph->cycle_of = malloc(sizeof(*graph->cycle_of) * (n + 1));
+  uint32_t *order = malloc(sizeof(*order) * (n + 1));
+  uint32_t *low = malloc(sizeof(*low) * (n + 1));
+  uint32_t *members = malloc(sizeof(*members) * (n + 1));
+  uint32_t *calls = malloc(sizeof(*calls) * (n + 1));
+  uint32_t *edge = malloc(sizeof(*edge) * (n + 1));
+  bool *on_stack = calloc(n + 1, sizeof(*on_stack));
+  if (!graph->cycles || !graph->cycles_start || !graph->cycle_of || !order || !low || !members ||
+      !calls || !edge || !on_stack) {
+    fprintf(stderr, "couldn't allocate cycle search for %u nodes\n", n);
+    free(order);
+    free(low);
+    free(members);
+    free(calls);
+    free(edge);
+    free(on_stack);
+    return -1;
+  }
+  memset(order, 0xff, sizeof(*order) * n);
+  memset(graph->cycle_of, 0xff, sizeof(*graph->cycle_of) * n);
 
-  /* if (graph->resolved_i != 0 graph->dependencies.len == graph->resolved_i) { */
-  /*   // error circular dependency */
-  /*   return DEPGRAH_CIRCULAR_DEP; */
-  /* } */
+  uint32_t counter = 0;
+  uint32_t num_members = 0;
+  uint32_t num_cycle_ids = 0;
+  graph->cycles_start[0] = 0;
+
+  for (uint32_t root = 0; root < n; root++) {
+    if (graph->pending[root] == 0 || order[root] != UINT32_MAX) {
+      continue;
+    }
+    uint32_t num_calls = 0;
+    calls[num_calls++] = root;
+    order[root] = low[root] = counter++;
+    edge[root] = graph->dependents_start[root];
+    members[num_members++] = root;
+    on_stack[root] = true;
 
-  IntTuple res = depgraph_pop_fully_resolved(graph);
-  int num_resolved = depgraph_quasi_resolve(graph, res.first);
+    while (num_calls > 0) {
+      uint32_t node = calls[num_calls - 1];
+      if (edge[node] < graph->dependents_start[node + 1]) {
+        uint32_t next = graph->dependents[edge[node]++];
+        if (graph->pending[next] == 0) {
+          continue;
+        }
+        if (order[next] == UINT32_MAX) {
+          order[next] = low[next] = counter++;
+          edge[next] = graph->dependents_start[next];
+          members[num_members++] = next;
+          on_stack[next] = true;
+          calls[num_calls++] = next;
+        } else if (on_stack[next] && order[next] < low[node]) {
+          low[node] = order[next];
+        }
+        continue;
+      }
 
-  return res.first;
+      num_calls--;
+      if (num_calls > 0) {
+        uint32_t parent = calls[num_calls - 1];
+        if (low[node] < low[parent]) {
+          low[parent] = low[node];
+        }
+      }
+      if (low[node] != order[node]) {
+        continue;
+      }
+
+      // node is the root of a component
+      uint32_t start = num_members;
+      do {
+        start--;
+        on_stack[members[start]] = false;
+      } while (members[start] != node);
+
+      bool is_cycle = num_members - start > 1;
+      for (uint32_t i = graph->dependents_start[node];
+           !is_cycle && i < graph->dependents_start[node + 1]; i++) {
+        is_cycle = graph->dependents[i] == node;
+      }
+      if (is_cycle) {
+        // members in the order they were added
+        qsort(members + start, num_members - start, sizeof(*members),
+              compare_u32);
+        for (uint32_t i = start; i < num_members; i++) {
+          graph->cycles[num_cycle_ids++] = graph->ids[members[i]];
+          graph->cycle_of[members[i]] = graph->num_cycles;
+        }
+        graph->cycles_start[++graph->num_cycles] = num_cycle_ids;
+      }
+      num_members = start;
+    }
+  }
+
+  free(order);
+  free(low);
+  free(members);
+  free(calls);
+  free(edge);
+  free(on_stack);
+  return graph->num_cycles;
+}
+
+int depgraph_cycle_of(DepGraph *graph, uint64_t id) {
+  if (!graph->cycle_of || id >= graph->num_ids ||
+      graph->index_of[id] == UINT32_MAX) {
+    return -1;
+  }
+  uint32_t cycle = graph->cycle_of[graph->index_of[id]];
+  return cycle == UINT32_MAX ? -1 : (int)cycle;
 }
 
 void depgraph_print(DepGraph *graph) {
   printf("depgraph\n");
   printf("----- unresolved ------\n");
-  for (int i = 0; i < graph->resolved_i; i++) {
+  for (int i = 0; i < graph->dependencies.len; i++) {
     IntTuple tuple = graph->dependencies.data[i];
-    printf("(%ld %ld)\n", tuple.first, tuple.second);
+    if (graph->pending && !depgraph_is_resolved(graph, tuple.first)) {
+      printf("(%ld %ld)\n", tuple.first, tuple.second);
+    }
   }
   printf("---- resolved -----------\n");
-  for (int i = graph->resolved_i; i < graph->dependencies.len; i++) {
+  for (int i = 0; i < graph->dependencies.len; i++) {
     IntTuple tuple = graph->dependencies.data[i];
-    printf("(%ld %ld)\n", tuple.first, tuple.second);
+    if (!graph->pending || depgraph_is_resolved(graph, tuple.first)) {
+      printf("(%ld %ld)\n", tuple.first, tuple.second);
+    }
   }
 }
 
-void depgraph_prepare(DepGraph *graph) {
-  depgraph_quasi_resolve(graph, 0);
-}
-
-
 void depgraph_test() {
 
   DepGraph graph;
@@ -181,6 +365,11 @@ void depgraph_test() {
   IntTuple e = {.first = 'c', .second = 0};
   IntTuple f = {.first = 'e', .second = 0};
   IntTuple g = {.first = 'd', .second = 0};
+  // x -> y -> z -> x is a cycle, w only depends on it
+  IntTuple h = {.first = 'x', .second = 'y'};
+  IntTuple i = {.first = 'y', .second = 'z'};
+  IntTuple j = {.first = 'z', .second = 'x'};
+  IntTuple k = {.first = 'w', .second = 'x'};
 
   depgraph_add(&graph, a);
   depgraph_add(&graph, b);
@@ -193,18 +382,68 @@ void depgraph_test() {
   depgraph_add(&graph, e);
   depgraph_add(&graph, f);
   depgraph_add(&graph, g);
+  depgraph_add(&graph, h);
+  depgraph_add(&graph, i);
+  depgraph_add(&graph, j);
+  depgraph_add(&graph, k);
 
   depgraph_print(&graph);
   depgraph_prepare(&graph);
 
-  int dep = 0;
-  do {
-    depgraph_print(&graph);
-    /* depgraph_print(&graph); */
+  uint64_t dep = depgraph_resolve(&graph);
+  while (dep != DEPGRAPH_EMPTY) {
+    printf("resolved dep %c \n", (char)dep);
     dep = depgraph_resolve(&graph);
-    printf("resolved dep %c \n", dep);
-  } while (dep >= 0);
+  }
 
   depgraph_print(&graph);
+
+  int num_cycles = depgraph_find_cycles(&graph);
+  for (int cycle = 0; cycle < num_cycles; cycle++) {
+    printf("cycle:");
+    for (uint32_t m = graph.cycles_start[cycle];
+         m < graph.cycles_start[cycle + 1]; m++) {
+      printf(" %c", (char)graph.cycles[m]);
+    }
+    printf("\n");
+  }
+  depgraph_quit(&graph);
+}
+
+static double depgraph_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+// a chain where every node depends on the one added after
+// it (the worst order for resolving) and a cycle at the end
+void depgraph_bench(int num_nodes) {
+  DepGraph graph;
+  depgraph_init(&graph);
+
+  double start = depgraph_now();
+  for (int i = 1; i < num_nodes; i++) {
+    IntTuple tuple = {.first = i, .second = i + 1};
+    depgraph_add(&graph, tuple);
+  }
+  IntTuple last = {.first = num_nodes, .second = 0};
+  depgraph_add(&graph, last);
+  for (int i = 0; i < 3; i++) {
+    IntTuple tuple = {.first = num_nodes + 1 + i,
+                      .second = num_nodes + 1 + (i + 1) % 3};
+    depgraph_add(&graph, tuple);
+  }
+
+  depgraph_prepare(&graph);
+  int num_resolved = 0;
+  while (depgraph_resolve(&graph) != DEPGRAPH_EMPTY) {
+    num_resolved++;
+  }
+  int num_cycles = depgraph_find_cycles(&graph);
+  double end = depgraph_now();
+
+  printf("depgraph bench: %d nodes, %d resolved, %d cycles in %.1f ms\n",
+         num_nodes + 3, num_resolved, num_cycles, end - start);
   depgraph_quit(&graph);
 }
@@ -18,12 +18,46 @@ typedef struct IntTupleArray {
 
 #define DEPGRAPH_EMPTY (UINT64_MAX)
 
+// the added tuples are turned into a compressed sparse row
+// graph by depgraph_prepare: the dependents of node i are
+// dependents[dependents_start[i] .. dependents_start[i+1]].
+// ids are dense (symbol ids), so they index index_of directly.
+// resolving is kahn's algorithm, everything is O(V+E)
 typedef struct DepGraph {
   IntTupleArray dependencies;
-  int resolved_i;
+
+  // id -> node index or UINT32_MAX
+  uint32_t *index_of;
+  uint64_t num_ids;
+  // node index -> id
+  uint64_t *ids;
+  uint32_t num_nodes;
+
+  uint32_t *dependents_start;
+  uint32_t *dependents;
+
+  // dependencies that are not resolved yet
+  uint32_t *pending;
+  // only nodes that were added as first item get resolved,
+  // the others are missing (e.g. undefined structs)
+  bool *defined;
+
+  // nodes without pending dependencies
+  uint32_t *queue;
+  uint32_t queue_head;
+  uint32_t queue_tail;
+
+  // after depgraph_find_cycles the members of
+  // cycle i are cycles[cycles_start[i] .. cycles_start[i+1]]
+  uint64_t *cycles;
+  uint32_t *cycles_start;
+  uint32_t num_cycles;
+  // node index -> its cycle or UINT32_MAX
+  uint32_t *cycle_of;
 } DepGraph;
 
 void depgraph_test();
+void depgraph_bench(int num_nodes);
 int  depgraph_init(DepGraph *graph);
 int  depgraph_quit(DepGraph *graph);
 void depgraph_print(DepGraph *graph);
@@ -34,10 +68,21 @@ void depgraph_print(DepGraph *graph);
 int depgraph_add(DepGraph *graph, IntTuple tuple);
 
 // needs to be called before resolving
-void depgraph_prepare(DepGraph *graph);
+int depgraph_prepare(DepGraph *graph);
 
 // returns an id that can be resolved now
-// -1 if there is nothing to be resolved anymore
+// DEPGRAPH_EMPTY if there is nothing to be resolved anymore
 uint64_t depgraph_resolve(DepGraph *graph);
 
+// whether the id was returned by depgraph_resolve
+bool depgraph_is_resolved(DepGraph *graph, uint64_t id);
+
+// groups the ids that can't be resolved because they are
+// part of a cycle (strongly connected components of the
+// unresolved nodes), returns the number of cycles
+int depgraph_find_cycles(DepGraph *graph);
+
+// the cycle the id is part of or -1
+int depgraph_cycle_of(DepGraph *graph, uint64_t id);
+
 #endif
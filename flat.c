@@ -0,0 +1,285 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int flatast_init(FlatAst *flat) {
+  flat->len = 0;
+  flat->cap = 256;
+  flat->kinds = malloc(sizeof(*flat->kinds) * flat->cap);
+  flat->nodes = malloc(sizeof(*flat->nodes) * flat->cap);
+  if (!flat->kinds || !flat->nodes) {
+    fprintf(stderr, "couldn't initialize flat ast with capacity %u\n",
+            flat->cap);
+    free(flat->kinds);
+    free(flat->nodes);
+    return -1;
+  }
+  return 0;
+}
+
+void flatast_quit(FlatAst *flat) {
+  free(flat->kinds);
+  free(flat->nodes);
+  flat->kinds = NULL;
+  flat->nodes = NULL;
+  flat->len = 0;
+  flat->cap = 0;
+}
+
+int64_t flatast_push(FlatAst *flat, FlatKind kind, FlatNode node) {
+  if (flat->len >= flat->cap) {
+    uint32_t newcap = flat->cap * 2;
+    uint8_t *kinds = realloc(flat->kinds, sizeof(*kinds) * newcap);
+    if (!kinds) {
+      fprintf(stderr, "couldn't grow flat ast kinds\n");
+      return -1;
+    }
+    flat->kinds = kinds;
+    FlatNode *nodes = realloc(flat->nodes, sizeof(*nodes) * newcap);
+    if (!nodes) {
+      fprintf(stderr, "couldn't grow flat ast nodes\n");
+      return -1;
+    }
+    flat->nodes = nodes;
+    flat->cap = newcap;
+  }
+  flat->kinds[flat->len] = kind;
+  flat->nodes[flat->len] = node;
+  return flat->len++;
+}
+
+typedef struct FlattenWalk {
+  Parser *parser;
+  // where the current expression starts
+  uint32_t start;
+  // the current expression contains something that
+  // only the pointer based code generation knows about
+  bool failed;
+} FlattenWalk;
+
+// frame values, statements are 0
+#define FLATTEN_ROOT 1
+#define FLATTEN_INNER 2
+
+static void flatten_push(FlattenWalk *flatten, FlatKind kind, FlatNode node) {
+  if (flatast_push(&flatten->parser->flat, kind, node) < 0) {
+    flatten->failed = true;
+  }
+}
+
+// the root is the last node of a finished expression
+static void flatten_finish(FlattenWalk *flatten, AstNode *node) {
+  FlatAst *flat = &flatten->parser->flat;
+  if (flatten->failed) {
+    flat->len = flatten->start;
+    node->flat = 0;
+    return;
+  }
+  node->flat = flat->len;
+}
+
+// the widths a member load or store can have, bigger members
+// wouldn't fit FlatNode.width and stay with the ast emitter
+static bool flatten_member_width(int size) {
+  return size == 1 || size == 4 || size == 8;
+}
+
+// appends the leaves of an expression in pre order and the
+// operators in post order, returns whether to visit the children
+static bool flatten_expr_pre(AstWalk *walk, AstWalkFrame *frame) {
+  FlattenWalk *flatten = walk->data;
+  Parser *parser = flatten->parser;
+  FlatAst *flat = &parser->flat;
+  AstNode *node = frame->node;
+  AstWalkFrame *parent = astwalk_parent(walk);
+  FlatNode f = {.value = SYMBOL_NONE, .offset = 0, .first = flat->len,
+                .width = 0, .flags = 0};
+
+  if (flatten->failed) {
+    return false;
+  }
+
+  switch (node->kind) {
+  case AST_LITERAL:
+    if (node->literal.kind != TOK_LITERAL_INT) {
+      flatten->failed = true;
+      return false;
+    }
+    f.value = node->literal.symbol;
+    flatten_push(flatten, FLAT_CONST, f);
+    return false;
+
+  case AST_VAR: {
+    // the target of an assignment is part of its store
+    if (frame->value == FLATTEN_INNER &&
+        parent->node->binop.op.kind == TOK_ASSIGN &&
+        node == parent->node->binop.left) {
+      return false;
+    }
+    f.value = node->var.name.symbol;
+    if (node->var.member_access) {
+      int member_size = 0;
+      f.offset = var_member_offset(parser, node, &member_size);
+      if (!flatten_member_width(member_size)) {
+        flatten->failed = true;
+        return false;
+      }
+      f.width = member_size;
+    }
+    flatten_push(flatten, FLAT_LOAD, f);
+    return false;
+  }
+
+  case AST_BINOP: {
+    FlatKind kind;
+    switch (node->binop.op.kind) {
+    case TOK_PLUS: kind = FLAT_ADD; break;
+    case TOK_MINUS: kind = FLAT_SUB; break;
+    case TOK_MUL: kind = FLAT_MUL; break;
+    case TOK_DIV: kind = FLAT_DIV; break;
+    case TOK_MOD: kind = FLAT_MOD; break;
+    case TOK_LOGICAL_LESS: kind = FLAT_LESS; break;
+    case TOK_LOGICAL_LESS_EQUAL: kind = FLAT_LESS_EQUAL; break;
+    case TOK_LOGICAL_GREATER: kind = FLAT_GREATER; break;
+    case TOK_LOGICAL_GREATER_EQUAL: kind = FLAT_GREATER_EQUAL; break;
+    case TOK_LOGICAL_EQUAL: kind = FLAT_EQUAL; break;
+    case TOK_ASSIGN: kind = FLAT_STORE; break;
+    default:
+      flatten->failed = true;
+      return false;
+    }
+    frame->scratch[0] = f.first;
+    frame->scratch[1] = kind;
+
+    if (kind == FLAT_STORE) {
+      // the variable only names the target,
+      // the store itself carries its location
+      AstNode *var = node->binop.left;
+      if (var->kind != AST_VAR) {
+        flatten->failed = true;
+        return false;
+      }
+      f.value = var->var.name.symbol;
+      if (var->var.member_access) {
+        int member_size = 0;
+        f.offset = var_member_offset(parser, var, &member_size);
+        if (!flatten_member_width(member_size)) {
+          flatten->failed = true;
+          return false;
+        }
+        f.width = member_size;
+      }
+      flatten_push(flatten, FLAT_LVALUE, f);
+    }
+    return true;
+  }
+
+  case AST_UNOP:
+    if (node->unop.op.kind != TOK_MINUS) {
+      flatten->failed = true;
+      return false;
+    }
+    frame->scratch[0] = f.first;
+    frame->scratch[1] = FLAT_NEG;
+    return true;
+
+  default:
+    // the other unary operators and
+    // function calls are not lowered yet
+    flatten->failed = true;
+    return false;
+  }
+}
+
+static void flatten_expr_post(AstWalk *walk, AstWalkFrame *frame) {
+  FlattenWalk *flatten = walk->data;
+  FlatAst *flat = &flatten->parser->flat;
+
+  if (flatten->failed) {
+    return;
+  }
+
+  uint32_t first = frame->scratch[0];
+  FlatKind kind = frame->scratch[1];
+  FlatNode f = {.value = SYMBOL_NONE, .offset = 0, .first = first,
+                .width = 0, .flags = 0};
+  if (kind == FLAT_STORE) {
+    f.value = flat->nodes[first].value;
+    f.offset = flat->nodes[first].offset;
+    f.width = flat->nodes[first].width;
+  }
+  flatten_push(flatten, kind, f);
+}
+
+static bool flatten_pre(AstWalk *walk, AstWalkFrame *frame) {
+  FlattenWalk *flatten = walk->data;
+  AstNode *node = frame->node;
+
+  if (frame->value != 0) {
+    frame->value = FLATTEN_INNER;
+    return flatten_expr_pre(walk, frame);
+  }
+
+  // only the statements that code generation
+  // starts expressions at are visited
+  switch (node->kind) {
+  case AST_PROGRAM:
+  case AST_FUNC_DEF:
+  case AST_BLOCK:
+  case AST_RETURN:
+  case AST_DECL:
+  case AST_IF_ELSE:
+  case AST_FORLOOP:
+    return true;
+  case AST_LITERAL:
+  case AST_VAR:
+  case AST_BINOP:
+  case AST_UNOP:
+  case AST_FUNC_CALL: {
+    frame->value = FLATTEN_ROOT;
+    flatten->start = flatten->parser->flat.len;
+    flatten->failed = false;
+    if (!flatten_expr_pre(walk, frame)) {
+      flatten_finish(flatten, node);
+      return false;
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+static void flatten_in(AstWalk *walk, AstWalkFrame *frame, int child) {
+  (void)child;
+  FlattenWalk *flatten = walk->data;
+  FlatAst *flat = &flatten->parser->flat;
+  AstNode *node = frame->node;
+
+  // the finished left operand is kept on the stack
+  if (frame->value != 0 && node->kind == AST_BINOP &&
+      node->binop.op.kind != TOK_ASSIGN && !flatten->failed) {
+    flat->nodes[flat->len - 1].flags |= FLAT_PUSH;
+  }
+}
+
+static void flatten_post(AstWalk *walk, AstWalkFrame *frame) {
+  if (frame->value == 0) {
+    return;
+  }
+  flatten_expr_post(walk, frame);
+  if (frame->value == FLATTEN_ROOT) {
+    flatten_finish(walk->data, frame->node);
+  }
+}
+
+// walks the statements and flattens every
+// expression that code generation starts at
+void parser_flatten(Parser *parser, AstNode *node) {
+  FlattenWalk flatten = {.parser = parser, .start = 0, .failed = false};
+  AstWalk walk;
+  astwalk_init(&walk, flatten_pre, flatten_in, flatten_post, &flatten);
+  astwalk_run(&walk, node, 0);
+  astwalk_quit(&walk);
+}
@@ -0,0 +1,56 @@
+#ifndef MY_FLAT_H
+#define MY_FLAT_H
+
+//////// flat expressions ////////
+// expression trees are copied into one array in post-order
+// after analysis, so codegen walks an expression front to back
+// as a stack machine instead of chasing child pointers.
+// kinds live in their own byte array, children are only
+// implied by the order and every node knows where its subtree starts
+#define FOREACH_FLAT_KIND(MACRO)                                               \
+  MACRO(FLAT_CONST)                                                            \
+  MACRO(FLAT_LOAD)                                                             \
+  MACRO(FLAT_LVALUE)                                                           \
+  MACRO(FLAT_STORE)                                                            \
+  MACRO(FLAT_ADD)                                                              \
+  MACRO(FLAT_SUB)                                                              \
+  MACRO(FLAT_MUL)                                                              \
+  MACRO(FLAT_DIV)                                                              \
+  MACRO(FLAT_MOD)                                                              \
+  MACRO(FLAT_NEG)                                                              \
+  MACRO(FLAT_LESS)                                                             \
+  MACRO(FLAT_LESS_EQUAL)                                                       \
+  MACRO(FLAT_GREATER)                                                          \
+  MACRO(FLAT_GREATER_EQUAL)                                                    \
+  MACRO(FLAT_EQUAL)
+
+typedef enum FlatKind { FOREACH_FLAT_KIND(GENERATE_ENUM) } FlatKind;
+
+// the result of this node is the left operand
+// of a binary operation and has to be saved
+#define FLAT_PUSH 1
+
+typedef struct FlatNode {
+  // literal or variable symbol
+  SymbolId value;
+  // member displacement of a variable
+  int32_t offset;
+  // index of the first node of the subtree
+  uint32_t first;
+  // member width of a variable, 0 for the whole variable
+  uint8_t width;
+  uint8_t flags;
+} FlatNode;
+
+typedef struct FlatAst {
+  uint8_t *kinds;
+  FlatNode *nodes;
+  uint32_t len;
+  uint32_t cap;
+} FlatAst;
+
+int      flatast_init(FlatAst *flat);
+void     flatast_quit(FlatAst *flat);
+int64_t  flatast_push(FlatAst *flat, FlatKind kind, FlatNode node);
+
+#endif
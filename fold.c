@@ -0,0 +1,163 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+//////// constant folding ///////
+// a value whose only definition computes it from constants is
+// a constant itself. that covers constant subexpressions and
+// promoted locals that are assigned once, their uses see the
+// number too. ints wrap around like the machine does and
+// divisions that trap at runtime are kept. definitions of
+// constants are dropped, their uses take them as immediates
+
+// the number an instruction computes if all its operands are
+// known, false if it can only be computed at runtime
+static bool fold_inst(IrFunc *fn, IrInst *inst, int32_t *result) {
+  int32_t a = 0;
+  int32_t b = 0;
+  if (inst->a != IR_NONE) {
+    if (!ir_is_const(fn, inst->a)) {
+      return false;
+    }
+    a = (int32_t)fn->consts[inst->a];
+  }
+  if (inst->b != IR_NONE) {
+    if (!ir_is_const(fn, inst->b)) {
+      return false;
+    }
+    b = (int32_t)fn->consts[inst->b];
+  }
+
+  switch ((IrOp)inst->op) {
+  case IR_CONST:
+    *result = (int32_t)(uint32_t)inst->imm;
+    return true;
+  case IR_COPY:
+    // 8 byte locals keep their copies
+    if (fn->types[inst->dst] != IR_I32) {
+      return false;
+    }
+    *result = inst->width == 1 ? (int8_t)a : a;
+    return true;
+  case IR_ADD:
+    *result = (int32_t)((uint32_t)a + (uint32_t)b);
+    return true;
+  case IR_SUB:
+    *result = (int32_t)((uint32_t)a - (uint32_t)b);
+    return true;
+  case IR_MUL:
+    *result = (int32_t)((uint32_t)a * (uint32_t)b);
+    return true;
+  case IR_DIV:
+  case IR_MOD:
+    // idivl traps on both
+    if (b == 0 || (a == INT32_MIN && b == -1)) {
+      return false;
+    }
+    *result = inst->op == IR_DIV ? a / b : a % b;
+    return true;
+  case IR_NEG:
+    *result = (int32_t)(0u - (uint32_t)a);
+    return true;
+  case IR_LESS:
+    *result = a < b;
+    return true;
+  case IR_LESS_EQUAL:
+    *result = a <= b;
+    return true;
+  case IR_GREATER:
+    *result = a > b;
+    return true;
+  case IR_GREATER_EQUAL:
+    *result = a >= b;
+    return true;
+  case IR_EQUAL:
+    *result = a == b;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// fills is_const and consts, removes the instructions that
+// define constants and turns branches on constants into
+// jumps. blocks that can't be reached anymore are dropped
+int ir_fold_constants(Parser *parser, IrFunc *fn) {
+  Arena *arena = &parser->arena;
+  int num_values = fn->num_values;
+  int *num_defs = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  fn->is_const = arena_alloc(arena, sizeof(bool) * (num_values + 1));
+  fn->consts = arena_alloc(arena, sizeof(int64_t) * (num_values + 1));
+  if (!num_defs || !fn->is_const || !fn->consts) {
+    fprintf(stderr, "couldn't allocate constant folding\n");
+    return -1;
+  }
+  memset(num_defs, 0, sizeof(int) * num_values);
+  memset(fn->is_const, 0, sizeof(bool) * num_values);
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      if (block->insts[i].dst != IR_NONE) {
+        num_defs[block->insts[i].dst]++;
+      }
+    }
+  }
+
+  // a loop can assign a local after its uses in the
+  // layout, so this runs until nothing changes. a read
+  // before the only assignment reads an uninitialized
+  // local which may as well hold the constant
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 0; b < fn->num_blocks; b++) {
+      IrBlock *block = &fn->blocks[b];
+      for (int i = 0; i < block->len; i++) {
+        IrInst *inst = &block->insts[i];
+        int32_t result;
+        if (inst->dst == IR_NONE || num_defs[inst->dst] != 1 ||
+            fn->is_const[inst->dst] || !fold_inst(fn, inst, &result)) {
+          continue;
+        }
+        fn->is_const[inst->dst] = true;
+        fn->consts[inst->dst] = result;
+        changed = true;
+      }
+    }
+  }
+
+  bool jumped = false;
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    int len = 0;
+    for (int i = 0; i < block->len; i++) {
+      IrInst inst = block->insts[i];
+      if (inst.dst != IR_NONE && fn->is_const[inst.dst]) {
+        continue;
+      }
+      // locals assigned more than once stay values, but a
+      // definition from constants only can't be emitted with
+      // two immediates
+      int32_t result;
+      if (inst.dst != IR_NONE && inst.op != IR_CONST &&
+          fold_inst(fn, &inst, &result)) {
+        inst.op = IR_CONST;
+        inst.type = IR_I32;
+        inst.width = 0;
+        inst.a = IR_NONE;
+        inst.b = IR_NONE;
+        inst.imm = result;
+      }
+      if (inst.op == IR_BRANCH && ir_is_const(fn, inst.a)) {
+        block->succ[0] = block->succ[fn->consts[inst.a] ? 0 : 1];
+        block->succ[1] = IR_NONE;
+        inst.op = IR_JUMP;
+        inst.a = IR_NONE;
+        jumped = true;
+      }
+      block->insts[len++] = inst;
+    }
+    block->len = len;
+  }
+  return jumped ? ir_finish(parser, fn) : 0;
+}
@@ -1,35 +1,288 @@
 #include "compiler.h"
 #include <assert.h>
 
-void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
-                                  int indent, AstNode *currentfunc,
-                                  int *stack_offset) {
+// size of a declared variable on the stack
+int decl_stack_size(Parser *parser, AstNode *decl) {
+  assert(decl->kind == AST_DECL);
+  if (decl->decl.num_pointers > 0) {
+    return 8;
+  }
+  return size_of_type(parser, decl->decl.kind);
+}
 
-  if(parser->hasErrors){
-    fprintf(file, "encountered error previously\n");
-    return;
+// struct variables have no initializer to store
+bool decl_is_struct(Parser *parser, AstNode *decl) {
+  return decl->decl.num_pointers == 0 &&
+         symbolmap_get(&parser->struct_definitions,
+                       decl->decl.kind.symbol) != NULL;
+}
+
+int stack_align_of_size(int size) {
+  if (size >= 8) {
+    return 8;
   }
+  if (size >= 4) {
+    return 4;
+  }
+  return 1;
+}
 
-  static const char *ast_names[] = {FOREACH_AST_KIND(GENERATE_STRING)};
-  if (node == NULL) {
-    return;
+// the declared alignment or the one of its struct
+// if any of them is more than the size asks for
+int decl_stack_align(Parser *parser, AstNode *decl) {
+  int align = stack_align_of_size(decl_stack_size(parser, decl));
+  if (decl->decl.align > align) {
+    align = decl->decl.align;
+  }
+  if (decl->decl.num_pointers == 0 && parser->max_align > 0) {
+    AstNode *def =
+        symbolmap_get(&parser->struct_definitions, decl->decl.kind.symbol);
+    if (def && def->structure.align > align) {
+      align = def->structure.align;
+    }
   }
+  return align;
+}
 
-  switch (node->kind) {
-  case AST_PROGRAM: {
+typedef struct FrameAlign {
+  Parser *parser;
+  int align;
+} FrameAlign;
+
+static bool frame_align_pre(AstWalk *walk, AstWalkFrame *frame) {
+  FrameAlign *frame_align = walk->data;
+  AstNode *node = frame->node;
+  if (node->kind == AST_DECL) {
+    int align = decl_stack_align(frame_align->parser, node);
+    if (align > frame_align->align) {
+      frame_align->align = align;
+    }
+  }
+  return node->kind != AST_STRUCT && node->kind != AST_ERROR;
+}
 
-    fprintf(file, "%*s.text \n", indent, "");
-    fprintf(file, "%*s.globl main \n", indent, "");
+// alignment the locals of a function need
+int function_frame_align(Parser *parser, AstNode *func) {
+  FrameAlign frame_align = {.parser = parser, .align = 16};
+  AstWalk walk;
+  astwalk_init(&walk, frame_align_pre, NULL, NULL, &frame_align);
+  astwalk_run(&walk, func, 0);
+  astwalk_quit(&walk);
+  return frame_align.align;
+}
 
-    /* vartable_checkpoint_get(&parser->assembly_variables); */
+// whether the result of a flat node fills all of %rax. ints
+// are compared as signed 32 bit numbers, 8 byte values whole
+static bool flat_is_wide(Parser *parser, uint32_t i) {
+  FlatAst *flat = &parser->flat;
+  if (flat->kinds[i] == FLAT_STORE) {
+    // the result is the stored value
+    return flat_is_wide(parser, i - 1);
+  }
+  if (flat->kinds[i] != FLAT_LOAD) {
+    return false;
+  }
+  FlatNode *f = &flat->nodes[i];
+  if (f->width) {
+    return f->width == 8;
+  }
+  AssemblyVarInfo info = vartable_get(&parser->assembly_variables, f->value);
+  return info.isValid && info.size == 8;
+}
 
-    for (int i = 0; i < node->program.items.len; i++) {
-      int normal_stack_offset = 0;
-      parser_dump_assembly_program(parser, node->program.items.nodes[i], file,
-                                   indent, NULL, &normal_stack_offset);
+// the same for an operand of the ast walk
+static bool gen_is_wide(Parser *parser, AstNode *node) {
+  if (node->kind == AST_BINOP && node->binop.op.kind == TOK_ASSIGN) {
+    return gen_is_wide(parser, node->binop.left);
+  }
+  if (node->kind != AST_VAR) {
+    return false;
+  }
+  AssemblyVarInfo info =
+      vartable_get(&parser->assembly_variables, node->var.name.symbol);
+  int member_size = info.size;
+  if (info.isValid && node->var.member_access) {
+    var_member_offset(parser, node, &member_size);
+  }
+  return info.isValid && member_size == 8;
+}
+
+// the number of an int literal that fits an int
+static bool gen_literal_value(Parser *parser, SymbolId symbol,
+                              int32_t *value) {
+  int64_t result;
+  String literal = str_interner_symbol(&parser->pool, symbol);
+  if (!ir_parse_int(literal, &result)) {
+    return false;
+  }
+  *value = (int32_t)result;
+  return true;
+}
+
+// streams a flattened expression: every node finds the
+// result of its last operand in %rax and left operands
+// that were pushed on the stack
+void flat_dump_assembly(Parser *parser, uint32_t root, FILE *file,
+                        int indent) {
+  FlatAst *flat = &parser->flat;
+  for (uint32_t i = flat->nodes[root].first; i <= root; i++) {
+    FlatNode *f = &flat->nodes[i];
+
+    switch ((FlatKind)flat->kinds[i]) {
+    case FLAT_CONST: {
+      String literal = str_interner_symbol(&parser->pool, f->value);
+      fprintf(file, "%*smovl $%.*s, %%eax\n", indent, "", literal.len,
+              literal.data);
+      break;
     }
-    break;
+    case FLAT_LOAD: {
+      AssemblyVarInfo info = vartable_get(&parser->assembly_variables, f->value);
+      if (!info.isValid) {
+        fprintf(stderr, "no stack location for variable\n");
+        break;
+      }
+      int member_size = f->width ? f->width : info.size;
+      int var_offset = info.stackOffset - f->offset;
+      if (member_size == 4) {
+        fprintf(file, "%*smovl -%d(%%rbp), %%eax\n", indent, "", var_offset);
+      } else if (member_size == 8) {
+        fprintf(file, "%*smovq -%d(%%rbp), %%rax\n", indent, "", var_offset);
+      } else if (member_size == 1) {
+        fprintf(file, "%*smovsbl -%d(%%rbp), %%edx\n", indent, "", var_offset);
+        fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+      }
+      break;
+    }
+    case FLAT_LVALUE:
+      break;
+    case FLAT_STORE: {
+      AssemblyVarInfo info = vartable_get(&parser->assembly_variables, f->value);
+      if (!info.isValid) {
+        fprintf(stderr, "no stack location for assigned variable\n");
+        break;
+      }
+      int member_size = f->width ? f->width : info.size;
+      int var_offset = info.stackOffset - f->offset;
+      if (member_size == 4) {
+        fprintf(file, "%*smovl %%eax, -%d(%%rbp)\n", indent, "", var_offset);
+      } else if (member_size == 8) {
+        fprintf(file, "%*smovq %%rax, -%d(%%rbp) \n", indent, "", var_offset);
+      } else if (member_size == 1) {
+        fprintf(file, "%*smovb %%al, -%d(%%rbp)\n", indent, "", var_offset);
+      } else {
+        fprintf(stderr, "assign size %d not supported yet\n", member_size);
+      }
+      break;
+    }
+    case FLAT_ADD:
+    case FLAT_SUB:
+    case FLAT_MUL:
+    case FLAT_DIV:
+    case FLAT_MOD: {
+      // a constant right operand is known here, the peephole
+      // pass drops its load
+      FlatKind kind = flat->kinds[i];
+      bool divides = kind == FLAT_DIV || kind == FLAT_MOD;
+      int32_t c;
+      if ((kind == FLAT_MUL || divides) && flat->kinds[i - 1] == FLAT_CONST &&
+          gen_literal_value(parser, flat->nodes[i - 1].value, &c)) {
+        fprintf(file, "%*spopq %%rax\n", indent, "");
+        if (kind == FLAT_MUL) {
+          strength_mul(file, indent, RAX, c);
+        } else {
+          strength_div(file, indent, c, kind == FLAT_MOD);
+        }
+        break;
+      }
+      if (divides) {
+        fprintf(file, "%*smovl %%eax, %%ecx\n", indent, "");
+        fprintf(file, "%*spopq %%rax\n", indent, "");
+        fprintf(file, "%*scltd\n", indent, "");
+        fprintf(file, "%*sidivl %%ecx \n", indent, "");
+        if (kind == FLAT_MOD) {
+          fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+        }
+        break;
+      }
+      fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
+      fprintf(file, "%*spopq %%rax\n", indent, "");
+      if (kind == FLAT_ADD)
+        fprintf(file, "%*saddl %%edx, %%eax\n", indent, "");
+      else if (kind == FLAT_SUB)
+        fprintf(file, "%*ssubl %%edx, %%eax\n", indent, "");
+      else
+        fprintf(file, "%*simul %%edx, %%eax\n", indent, "");
+      break;
+    }
+    case FLAT_NEG:
+      fprintf(file, "%*snegl %%eax\n", indent, "");
+      break;
+    case FLAT_LESS:
+    case FLAT_LESS_EQUAL:
+    case FLAT_GREATER:
+    case FLAT_GREATER_EQUAL:
+    case FLAT_EQUAL: {
+      static const char *setcc[] = {
+          [FLAT_LESS] = "setl",          [FLAT_LESS_EQUAL] = "setle",
+          [FLAT_GREATER] = "setg",       [FLAT_GREATER_EQUAL] = "setge",
+          [FLAT_EQUAL] = "sete",
+      };
+      fprintf(file, "%*smovq %%rax, %%rdx\n", indent, "");
+      fprintf(file, "%*spopq %%rax\n", indent, "");
+      if (flat_is_wide(parser, i - 1) ||
+          flat_is_wide(parser, flat->nodes[i - 1].first - 1)) {
+        fprintf(file, "%*scmpq %%rdx, %%rax\n", indent, "");
+      } else {
+        fprintf(file, "%*scmpl %%edx, %%eax\n", indent, "");
+      }
+      fprintf(file, "%*s%s %%al\n", indent, "", setcc[flat->kinds[i]]);
+      fprintf(file, "%*smovzbl %%al, %%eax\n", indent, "");
+      break;
+    }
+    }
+
+    if (f->flags & FLAT_PUSH) {
+      fprintf(file, "%*spushq %%rax\n", indent, "");
+    }
+  }
+}
+
+void dump_assembly_header(FILE *file, int indent) {
+  fprintf(file, "%*s.text \n", indent, "");
+  fprintf(file, "%*s.globl main \n", indent, "");
+}
+
+typedef struct GenWalk {
+  Parser *parser;
+  FILE *file;
+  AstNode *currentfunc;
+} GenWalk;
+
+bool gen_pre(AstWalk *walk, AstWalkFrame *frame) {
+  GenWalk *gen = walk->data;
+  Parser *parser = gen->parser;
+  FILE *file = gen->file;
+  AstNode *node = frame->node;
+  AstWalkFrame *parent = astwalk_parent(walk);
+
+  static const char *ast_names[] = {FOREACH_AST_KIND(GENERATE_STRING)};
+
+  // the statements of a function body are indented
+  if (parent && parent->node->kind == AST_FUNC_DEF &&
+      node == parent->node->func.block) {
+    frame->value = parent->value + 2;
   }
+  int indent = frame->value;
+
+  if (node->flat) {
+    flat_dump_assembly(parser, node->flat - 1, file, indent);
+    return false;
+  }
+
+  switch (node->kind) {
+  case AST_PROGRAM:
+    dump_assembly_header(file, indent);
+    return true;
   case AST_FUNC_DEF: {
     AstFuncPrototype *proto = &node->func.prototype->funcproto;
     String name = parser_token_content(parser, proto->name);
@@ -40,44 +293,33 @@ void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
     fprintf(file, "%*spushq %%rbp\n", indent + 2, "");
     fprintf(file, "%*smovq %%rsp, %%rbp\n", indent + 2, "");
 
-    int normal_stack_offset = 0;
-
-    for(int i=0; i<proto->params.len; i++){
-      AstNode *decl = proto->params.nodes[i];
-
-      parser_dump_assembly_program(parser, decl, file, indent, node,
-    &normal_stack_offset);
-
-    /*   // TODO: not supporting structs yet */
-    /*   int var_offset = decl->decl.assembly_base_offset; */
-    /*   int size = decl->decl.size; */
-    /*   var_offset += size; */
+    // %rbp is only 16 byte aligned, locals that need more
+    // get a realigned frame that keeps the old %rbp at 0(%rbp)
+    frame->scratch[1] = 16;
+    if (parser->max_align > 16) {
+      frame->scratch[1] = function_frame_align(parser, node);
     }
-
-    for (int i = 0; i < node->func.block->block.len; i++) {
-      parser_dump_assembly_program(parser, node->func.block->block.nodes[i],
-                                   file, indent + 2, node,
-                                   &normal_stack_offset);
+    if (frame->scratch[1] > 16) {
+      fprintf(file, "%*sleaq -8(%%rbp), %%rsp\n", indent + 2, "");
+      fprintf(file, "%*sandq $-%d, %%rsp\n", indent + 2, "",
+              frame->scratch[1]);
+      fprintf(file, "%*smovq %%rbp, (%%rsp)\n", indent + 2, "");
+      fprintf(file, "%*smovq %%rsp, %%rbp\n", indent + 2, "");
     }
-    /* // function exit */
-    fprintf(file, "%*s%.*sexit:\n", indent + 2, "", name.len, name.data);
-    fprintf(file, "%*smovq %%rbp, %%rsp\n", indent + 2, "");
-    fprintf(file, "%*spopq %%rbp\n", indent + 2, "");
-    fprintf(file, "%*sret\n", indent + 2, "");
-    break;
+
+    frame->scratch[0] = vartable_frame_begin(&parser->assembly_variables);
+    gen->currentfunc = node;
+    return true;
   }
+  case AST_FUNC_PROTO:
+    // only the parameters of a definition get stack slots
+    return parent && parent->node->kind == AST_FUNC_DEF;
   case AST_RETURN: {
-    if (currentfunc == NULL) {
+    if (gen->currentfunc == NULL) {
       fprintf(stderr, "return should be placed inside a function\n");
-      return;
+      return false;
     }
-    parser_dump_assembly_program(parser, node->ret.expr, file, indent,
-                                 currentfunc, stack_offset);
-    AstFuncPrototype *proto = &currentfunc->func.prototype->funcproto;
-
-    String name = parser_token_content(parser, proto->name);
-    fprintf(file, "%*sjmp %.*sexit\n", indent, "", name.len, name.data);
-    break;
+    return true;
   }
   case AST_LITERAL: {
 
@@ -85,15 +327,186 @@ void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
     if (node->literal.kind == TOK_LITERAL_INT) {
       fprintf(file, "%*smovl $%.*s, %%eax\n", indent, "", literal.len,
               literal.data);
-      break;
+      return false;
     }
 
     fprintf(stderr, "literals not yet fully supported\n");
+    return false;
+  }
+  case AST_BINOP: {
+    switch (node->binop.op.kind) {
+    case TOK_LOGICAL_GREATER:
+    case TOK_LOGICAL_EQUAL:
+    case TOK_LOGICAL_GREATER_EQUAL:
+    case TOK_LOGICAL_LESS_EQUAL:
+    case TOK_LOGICAL_LESS:
+    case TOK_MINUS:
+    case TOK_PLUS:
+    case TOK_MUL:
+    case TOK_DIV:
+    case TOK_MOD:
+      return true;
+    case TOK_ASSIGN:
+      if (node->binop.left->kind != AST_VAR) {
+        fprintf(stderr, "can't assign to expression only to variable\n");
+        return false;
+      }
+      return true;
+    default:
+      return false;
+    }
+  }
+  case AST_VAR: {
+    // the target of an assignment is stored to afterwards
+    if (parent && parent->node->kind == AST_BINOP &&
+        parent->node->binop.op.kind == TOK_ASSIGN &&
+        node == parent->node->binop.left) {
+      return false;
+    }
+
+    AssemblyVarInfo info =
+        vartable_get(&parser->assembly_variables, node->var.name.symbol);
+    if (!info.isValid) {
+      fprintf(stderr, "no stack location for variable\n");
+      return false;
+    }
 
+    int member_size = info.size;
+    int member_offset = 0;
+    if (node->var.member_access) {
+      member_offset = var_member_offset(parser, node, &member_size);
+    }
+    int var_offset = info.stackOffset - member_offset;
+
+    if (member_size == 4) {
+      fprintf(file, "%*smovl -%d(%%rbp), %%eax\n", indent, "", var_offset);
+    } else if (member_size == 8) {
+      fprintf(file, "%*smovq -%d(%%rbp), %%rax\n", indent, "", var_offset);
+    } else if (member_size == 1) {
+      fprintf(file, "%*smovsbl -%d(%%rbp), %%edx\n", indent, "", var_offset);
+      fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+    }
+    return false;
+  }
+  case AST_DECL: {
+    int size = decl_stack_size(parser, node);
+    int align = decl_stack_align(parser, node);
+    frame->scratch[0] = size;
+    frame->scratch[1] = align;
+
+    // the slot can be up to align - 1 further
+    // down than the size alone would put it
+    int reserve = align > 8 ? size + align : size;
+    fprintf(file, "%*spushq %%rax\n", indent, "");
+    fprintf(file, "%*ssubq $%d, %%rsp\n", indent, "", reserve);
+
+    // the initializer still sees the
+    // variables that the new one shadows
+    return true;
+  }
+  case AST_BLOCK:
+    frame->scratch[0] = vartable_checkpoint_get(&parser->assembly_variables);
+    return true;
+  case AST_IF_ELSE: {
+    static int if_id = 0;
+    frame->scratch[0] = if_id;
+    if_id++;
+    return true;
+  }
+  case AST_FORLOOP: {
+    static int loop_id = 0;
+    frame->scratch[0] = loop_id;
+    loop_id++;
+    frame->scratch[1] = vartable_checkpoint_get(&parser->assembly_variables);
+    return true;
+  }
+  case AST_ERROR:
+    fprintf(file, "sorry %s not supported yet\n", ast_names[node->kind]);
+    return false;
+  case AST_UNOP:
+    if (node->unop.op.kind != TOK_MINUS) {
+      fprintf(stderr, "unary operators other than - not supported yet\n");
+      return false;
+    }
+    return true;
+  case AST_STRUCT:
+  case AST_FUNC_CALL:
+  case AST_BREAK:
+  case AST_MEMBER_ACCESS:
+    return false;
+  }
+  return false;
+}
+
+void gen_in(AstWalk *walk, AstWalkFrame *frame, int child) {
+  GenWalk *gen = walk->data;
+  FILE *file = gen->file;
+  AstNode *node = frame->node;
+  int indent = frame->value;
+  int id = frame->scratch[0];
+
+  switch (node->kind) {
+  case AST_BINOP:
+    // the left operand waits on the stack
+    if (node->binop.op.kind != TOK_ASSIGN) {
+      fprintf(file, "%*spushq %%rax\n", indent, "");
+    }
+    break;
+  case AST_IF_ELSE:
+    if (child == 1) {
+      fprintf(file, "%*scmpl $0, %%eax\n", indent, "");
+      fprintf(file, "%*sje ifFalse%d\n", indent, "", id);
+      fprintf(file, "%*sifTrue%d:\n", indent, "", id);
+    } else if (child == 2) {
+      fprintf(file, "%*sjmp fi%d\n", indent, "", id);
+      fprintf(file, "%*sifFalse%d:\n", indent, "", id);
+    }
+    break;
+  case AST_FORLOOP:
+    if (child == 1) {
+      fprintf(file, "%*sforloop%d:\n", indent, "", id);
+    } else if (child == 2) {
+      fprintf(file, "%*scmpl $0, %%eax\n", indent, "");
+      fprintf(file, "%*sje forexit%d\n", indent, "", id);
+    }
+    break;
+  default:
     break;
   }
-  case AST_BINOP: {
+}
+
+void gen_post(AstWalk *walk, AstWalkFrame *frame) {
+  GenWalk *gen = walk->data;
+  Parser *parser = gen->parser;
+  FILE *file = gen->file;
+  AstNode *node = frame->node;
+  int indent = frame->value;
+
+  switch (node->kind) {
+  case AST_FUNC_DEF: {
+    AstFuncPrototype *proto = &node->func.prototype->funcproto;
+    String name = parser_token_content(parser, proto->name);
+
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[0]);
+    /* // function exit */
+    fprintf(file, "%*s%.*sexit:\n", indent + 2, "", name.len, name.data);
+    if (frame->scratch[1] > 16) {
+      fprintf(file, "%*smovq (%%rbp), %%rbp\n", indent + 2, "");
+    }
+    fprintf(file, "%*smovq %%rbp, %%rsp\n", indent + 2, "");
+    fprintf(file, "%*spopq %%rbp\n", indent + 2, "");
+    fprintf(file, "%*sret\n", indent + 2, "");
+    gen->currentfunc = NULL;
+    break;
+  }
+  case AST_RETURN: {
+    AstFuncPrototype *proto = &gen->currentfunc->func.prototype->funcproto;
 
+    String name = parser_token_content(parser, proto->name);
+    fprintf(file, "%*sjmp %.*sexit\n", indent, "", name.len, name.data);
+    break;
+  }
+  case AST_BINOP:
     switch (node->binop.op.kind) {
 
     case TOK_LOGICAL_GREATER:
@@ -101,14 +514,14 @@ void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
     case TOK_LOGICAL_GREATER_EQUAL:
     case TOK_LOGICAL_LESS_EQUAL:
     case TOK_LOGICAL_LESS: {
-      parser_dump_assembly_program(parser, node->binop.left, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*spushq %%rax\n", indent, "");
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
       fprintf(file, "%*smovq %%rax, %%rdx\n", indent, "");
       fprintf(file, "%*spopq %%rax\n", indent, "");
-      fprintf(file, "%*scmpq %%rdx, %%rax\n", indent, "");
+      if (gen_is_wide(parser, node->binop.left) ||
+          gen_is_wide(parser, node->binop.right)) {
+        fprintf(file, "%*scmpq %%rdx, %%rax\n", indent, "");
+      } else {
+        fprintf(file, "%*scmpl %%edx, %%eax\n", indent, "");
+      }
 
       if (node->binop.op.kind == TOK_LOGICAL_LESS)
         fprintf(file, "%*ssetl %%al\n", indent, "");
@@ -126,149 +539,86 @@ void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
     }
 
     case TOK_MINUS:
-      parser_dump_assembly_program(parser, node->binop.left, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*spushq %%rax\n", indent, "");
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
       fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
       fprintf(file, "%*spopq %%rax\n", indent, "");
       fprintf(file, "%*ssubl %%edx, %%eax\n", indent, "");
       break;
     case TOK_PLUS:
-      parser_dump_assembly_program(parser, node->binop.left, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*spushq %%rax\n", indent, "");
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
       fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
       fprintf(file, "%*spopq %%rax\n", indent, "");
       fprintf(file, "%*saddl %%edx, %%eax\n", indent, "");
       break;
     case TOK_MUL:
-      parser_dump_assembly_program(parser, node->binop.left, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*spushq %%rax\n", indent, "");
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
-      fprintf(file, "%*spopq %%rax\n", indent, "");
-      fprintf(file, "%*simul %%edx, %%eax\n", indent, "");
-      break;
     case TOK_DIV:
-      parser_dump_assembly_program(parser, node->binop.left, file, indent,
-                                   currentfunc, stack_offset);
-      fprintf(file, "%*spushq %%rax\n", indent, "");
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
+    case TOK_MOD: {
+      TokenKind op = node->binop.op.kind;
+      AstNode *right = node->binop.right;
+      int32_t c;
+      if (right->kind == AST_LITERAL &&
+          right->literal.kind == TOK_LITERAL_INT &&
+          gen_literal_value(parser, right->literal.symbol, &c)) {
+        fprintf(file, "%*spopq %%rax\n", indent, "");
+        if (op == TOK_MUL) {
+          strength_mul(file, indent, RAX, c);
+        } else {
+          strength_div(file, indent, c, op == TOK_MOD);
+        }
+        break;
+      }
+      if (op == TOK_MUL) {
+        fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
+        fprintf(file, "%*spopq %%rax\n", indent, "");
+        fprintf(file, "%*simul %%edx, %%eax\n", indent, "");
+        break;
+      }
       fprintf(file, "%*smovl %%eax, %%ecx\n", indent, "");
       fprintf(file, "%*spopq %%rax\n", indent, "");
       fprintf(file, "%*scltd\n", indent, "");
       fprintf(file, "%*sidivl %%ecx \n", indent, "");
+      if (op == TOK_MOD) {
+        fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+      }
       break;
+    }
 
-    case TOK_ASSIGN:
-      if (node->binop.left->kind != AST_VAR) {
-        fprintf(stderr, "can't assign to expression only to variable\n");
+    case TOK_ASSIGN: {
+      AssemblyVarInfo info = vartable_get(&parser->assembly_variables,
+                                          node->binop.left->var.name.symbol);
+      if (!info.isValid) {
+        fprintf(stderr, "no stack location for assigned variable\n");
         return;
       }
-      parser_dump_assembly_program(parser, node->binop.right, file, indent,
-                                   currentfunc, stack_offset);
-
-      int var_offset =
-          node->binop.left->var.declaration->decl.assembly_base_offset;
-      int member_size = 0;
-      int member_offset =
-          var_member_offset(parser, node->binop.left, &member_size);
-
-      /* AstNode *structdef = ptr_bucket_get(&parser->struct_definitions,
-       * str_slice_to_uint64(node->binop.left->var.declaration->decl.kind.string));
-       */
-      /* assert(structdef != NULL); */
-      /* assert(structdef->kind == AST_STRUCT); */
-
-      int size = size_of_type(parser, node->binop.left->var.declaration->decl
-                                          .kind); // structdef->structure.size;
-
-      /* printf("assign: size %d  var_offset %d  member_offset %d\n", size, */
-      /*        var_offset, member_offset); */
-
-      var_offset += (size - (member_offset));
-      if (var_offset % member_size != 0) {
-        var_offset = offset_align(var_offset - member_size, member_size);
+
+      int member_size = info.size;
+      int member_offset = 0;
+      if (node->binop.left->var.member_access) {
+        member_offset =
+            var_member_offset(parser, node->binop.left, &member_size);
       }
+      int var_offset = info.stackOffset - member_offset;
 
       if (member_size == 4) {
         fprintf(file, "%*smovl %%eax, -%d(%%rbp)\n", indent, "", var_offset);
       } else if (member_size == 8) {
         fprintf(file, "%*smovq %%rax, -%d(%%rbp) \n", indent, "", var_offset);
       } else if (member_size == 1) {
-        /* fprintf(file, "%*smovsbl -%d(%%rbp), %%edx\n", indent, "",
-         * var_offset); */
         fprintf(file, "%*smovb %%al, -%d(%%rbp)\n", indent, "", var_offset);
       } else {
         fprintf(stderr, "assign size %d not supported yet\n", member_size);
       }
-
       break;
     }
-    break;
-  }
-  case AST_STRUCT:
-    break;
-  case AST_VAR: {
-    int member_size = 0;
-    int member_offset = var_member_offset(parser, node, &member_size);
-    int var_offset = node->var.declaration->decl.assembly_base_offset;
-
-    int size = 0;
-    if (node->var.declaration->type->kind == TYPE_STRUCT) {
-      AstNode *structdef = ptr_bucket_get(
-          &parser->struct_definitions,
-          str_slice_to_uint64(node->var.declaration->decl.kind.string));
-      assert(structdef != NULL);
-      assert(structdef->kind == AST_STRUCT);
-      size = structdef->structure.size;
-    } else {
-      size = size_of_type(parser, node->var.declaration->decl.kind);
-    }
-
-    /* int size = structdef->structure.size; */
-    /* printf("var offset %d member offset %d size %d \n", var_offset, */
-    /* member_offset, size); */
-
-    var_offset += (size - member_offset);
-    if (var_offset % member_size != 0) {
-      var_offset = offset_align(var_offset - member_size, member_size);
-    }
-
-    if (member_size == 4) {
-      fprintf(file, "%*smovl -%d(%%rbp), %%eax\n", indent, "", var_offset);
-    } else if (member_size == 8) {
-      fprintf(file, "%*smovq -%d(%%rbp), %%rax\n", indent, "", var_offset);
-    } else if (member_size == 1) {
-      fprintf(file, "%*smovsbl -%d(%%rbp), %%edx\n", indent, "", var_offset);
-      fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
     }
-
     break;
-  }
   case AST_DECL: {
-    int size = size_of_type(parser, node->decl.kind);
-    node->decl.assembly_base_offset = *stack_offset;
-
-    *stack_offset += size;
-
-    int var_offset = node->decl.assembly_base_offset + size;
-
-    fprintf(file, "%*spushq %%rax\n", indent, "");
-    fprintf(file, "%*ssubq $%d, %%rsp\n", indent, "", size);
+    int size = frame->scratch[0];
+    int var_offset =
+        vartable_add_stack_var(&parser->assembly_variables,
+                               node->decl.name.symbol, size,
+                               frame->scratch[1]);
 
     if (node->decl.expr) {
-      parser_dump_assembly_program(parser, node->decl.expr, file, indent,
-                                   currentfunc, stack_offset);
-
-      if (node->type->kind != AST_STRUCT) {
+      if (!decl_is_struct(parser, node)) {
         if (size == 4) {
           fprintf(file, "%*smovl %%eax, -%d(%%rbp)\n", indent, "", var_offset);
         } else if (size == 1) {
@@ -280,78 +630,38 @@ void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
         }
       }
     }
-
     break;
   }
-  case AST_FUNC_PROTO:
+  case AST_UNOP:
+    fprintf(file, "%*snegl %%eax\n", indent, "");
     break;
-  case AST_FUNC_CALL:
+  case AST_BLOCK:
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[0]);
     break;
-  case AST_BLOCK: {
-    int current_stack_offset = *stack_offset;
-    for (int i = 0; i < node->block.len; i++) {
-      parser_dump_assembly_program(parser, node->block.nodes[i], file, indent,
-                                   currentfunc, stack_offset);
-    }
-    *stack_offset = current_stack_offset;
+  case AST_IF_ELSE:
+    fprintf(file, "%*sfi%d:\n", indent, "", frame->scratch[0]);
+    break;
+  case AST_FORLOOP:
+    fprintf(file, "%*sjmp forloop%d\n", indent, "", frame->scratch[0]);
+    fprintf(file, "%*sforexit%d:\n", indent, "", frame->scratch[0]);
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[1]);
+    break;
+  default:
     break;
   }
-  case AST_IF_ELSE: {
-    static int if_id = 0;
-    int id = if_id;
-    if_id++;
-
-    parser_dump_assembly_program(parser, node->ifelse.condition, file, indent,
-                                 currentfunc, stack_offset);
-
-    fprintf(file, "%*scmpl $0, %%eax\n", indent, "");
-    fprintf(file, "%*sje ifFalse%d\n", indent, "", id);
-
-    fprintf(file, "%*sifTrue%d:\n", indent, "", id);
-
-    parser_dump_assembly_program(parser, node->ifelse.ifblock, file, indent,
-                                 currentfunc, stack_offset);
+}
 
-    fprintf(file, "%*sjmp fi%d\n", indent, "", id);
+void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
+                                  int indent, AstNode *currentfunc) {
 
-    fprintf(file, "%*sifFalse%d:\n", indent, "", id);
-    parser_dump_assembly_program(parser, node->ifelse.elseblock, file, indent,
-                                 currentfunc, stack_offset);
-    fprintf(file, "%*sfi%d:\n", indent, "", id);
-    break;
+  if(parser->num_errors){
+    fprintf(file, "encountered error previously\n");
+    return;
   }
-  case AST_BREAK:
-    break;
-  case AST_UNOP:
-    break;
-  case AST_FORLOOP: {
-    static int loop_id = 0;
-    int id = loop_id;
-    loop_id++;
 
-    int saved_stack = *stack_offset;
-
-    parser_dump_assembly_program(parser, node->forloop.init, file, indent,
-                                 currentfunc, stack_offset);
-    fprintf(file, "%*sforloop%d:\n", indent, "", id);
-    parser_dump_assembly_program(parser, node->forloop.condition, file, indent,
-                                 currentfunc, stack_offset);
-    fprintf(file, "%*scmpl $0, %%eax\n", indent, "");
-    fprintf(file, "%*sje forexit%d\n", indent, "", id);
-    parser_dump_assembly_program(parser, node->forloop.stmt, file, indent,
-                                 currentfunc, stack_offset);
-
-    parser_dump_assembly_program(parser, node->forloop.step, file, indent,
-                                 currentfunc, stack_offset);
-    fprintf(file, "%*sjmp forloop%d\n", indent, "", id);
-    fprintf(file, "%*sforexit%d:\n", indent, "", id);
-    *stack_offset = saved_stack;
-    break;
-  }
-  case AST_MEMBER_ACCESS:
-    break;
-  case AST_ERROR:
-    fprintf(file, "sorry %s not supported yet\n", ast_names[node->kind]);
-    break;
-  }
+  GenWalk gen = {.parser = parser, .file = file, .currentfunc = currentfunc};
+  AstWalk walk;
+  astwalk_init(&walk, gen_pre, gen_in, gen_post, &gen);
+  astwalk_run(&walk, node, indent);
+  astwalk_quit(&walk);
 }
@@ -0,0 +1,1171 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// grows an arena array so it can take one more item
+static void *ir_grow(Arena *arena, void *data, int *cap, int len,
+                     size_t size) {
+  if (len < *cap) {
+    return data;
+  }
+  int newcap = *cap ? *cap * 2 : 8;
+  void *newdata = arena_realloc(arena, data, size * *cap, size * newcap);
+  if (!newdata) {
+    fprintf(stderr, "couldn't grow ir array to %d items\n", newcap);
+    return NULL;
+  }
+  *cap = newcap;
+  return newdata;
+}
+
+bool ir_is_terminator(IrOp op) {
+  return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+bool ir_block_terminated(IrBlock *block) {
+  return block->len > 0 && ir_is_terminator(block->insts[block->len - 1].op);
+}
+
+bool ir_is_const(IrFunc *fn, int value) {
+  return value != IR_NONE && fn->is_const && fn->is_const[value];
+}
+
+typedef struct IrLower {
+  Parser *parser;
+  IrFunc *fn;
+  // result of the expression that was lowered last or IR_NONE
+  int last;
+  // something in the function is only known
+  // to the ast code generation
+  bool failed;
+  // operands of the flat expression being lowered
+  int *stack;
+  int stack_cap;
+} IrLower;
+
+int ir_add_value(Parser *parser, IrFunc *fn, IrType type) {
+  uint8_t *types = ir_grow(&parser->arena, fn->types, &fn->values_cap,
+                           fn->num_values, sizeof(*types));
+  if (!types) {
+    return IR_NONE;
+  }
+  fn->types = types;
+  fn->types[fn->num_values] = type;
+  return fn->num_values++;
+}
+
+static int ir_new_value(IrLower *lower, IrType type) {
+  int value = ir_add_value(lower->parser, lower->fn, type);
+  if (value == IR_NONE) {
+    lower->failed = true;
+  }
+  return value;
+}
+
+int ir_add_block(Parser *parser, IrFunc *fn) {
+  IrBlock *blocks = ir_grow(&parser->arena, fn->blocks, &fn->blocks_cap,
+                            fn->num_blocks, sizeof(*blocks));
+  if (!blocks) {
+    return IR_NONE;
+  }
+  fn->blocks = blocks;
+  IrBlock block = {.insts = NULL, .len = 0, .cap = 0,
+                   .succ = {IR_NONE, IR_NONE}, .order = -1};
+  fn->blocks[fn->num_blocks] = block;
+  return fn->num_blocks++;
+}
+
+static int ir_new_block(IrLower *lower) {
+  int block = ir_add_block(lower->parser, lower->fn);
+  if (block == IR_NONE) {
+    lower->failed = true;
+  }
+  return block;
+}
+
+// inserts inst in front of the instruction at index
+int ir_insert(Parser *parser, IrBlock *block, int index, IrInst inst) {
+  IrInst *insts = ir_grow(&parser->arena, block->insts, &block->cap,
+                          block->len, sizeof(*insts));
+  if (!insts) {
+    return -1;
+  }
+  block->insts = insts;
+  memmove(&insts[index + 1], &insts[index],
+          sizeof(*insts) * (block->len - index));
+  insts[index] = inst;
+  block->len++;
+  return 0;
+}
+
+static void ir_append(IrLower *lower, IrInst inst) {
+  IrFunc *fn = lower->fn;
+  if (lower->failed) {
+    return;
+  }
+  IrBlock *block = &fn->blocks[fn->current];
+  assert(!ir_block_terminated(block));
+  IrInst *insts = ir_grow(&lower->parser->arena, block->insts, &block->cap,
+                          block->len, sizeof(*insts));
+  if (!insts) {
+    lower->failed = true;
+    return;
+  }
+  block->insts = insts;
+  block->insts[block->len++] = inst;
+}
+
+static void ir_jump(IrLower *lower, int target) {
+  if (lower->failed) {
+    return;
+  }
+  IrInst inst = {.op = IR_JUMP, .type = IR_VOID, .dst = IR_NONE,
+                 .a = IR_NONE, .b = IR_NONE, .slot = IR_NONE};
+  ir_append(lower, inst);
+  lower->fn->blocks[lower->fn->current].succ[0] = target;
+}
+
+static void ir_branch(IrLower *lower, int cond, int iftrue, int iffalse) {
+  if (lower->failed) {
+    return;
+  }
+  IrInst inst = {.op = IR_BRANCH, .type = IR_VOID, .dst = IR_NONE,
+                 .a = cond, .b = IR_NONE, .slot = IR_NONE};
+  ir_append(lower, inst);
+  IrBlock *block = &lower->fn->blocks[lower->fn->current];
+  block->succ[0] = iftrue;
+  block->succ[1] = iffalse;
+}
+
+static void ir_ret(IrLower *lower, int value) {
+  IrInst inst = {.op = IR_RET, .type = IR_VOID, .dst = IR_NONE,
+                 .a = value, .b = IR_NONE, .slot = IR_NONE};
+  ir_append(lower, inst);
+}
+
+// code continues in block, falling through from the current one
+static void ir_start_block(IrLower *lower, int block) {
+  IrFunc *fn = lower->fn;
+  if (lower->failed) {
+    return;
+  }
+  if (!ir_block_terminated(&fn->blocks[fn->current])) {
+    ir_jump(lower, block);
+  }
+  fn->blocks[block].order = fn->num_started++;
+  fn->current = block;
+}
+
+// the slot of a variable, variables of sibling
+// scopes can share one
+static int ir_slot_of(IrLower *lower, AssemblyVarInfo info) {
+  IrFunc *fn = lower->fn;
+  Arena *arena = &lower->parser->arena;
+  int offset = info.stackOffset;
+  if (offset < 0) {
+    lower->failed = true;
+    return IR_NONE;
+  }
+  if (offset >= fn->slot_at_cap) {
+    int oldcap = fn->slot_at_cap;
+    int newcap = oldcap ? oldcap : 16;
+    while (newcap <= offset) {
+      newcap *= 2;
+    }
+    int *slot_at = arena_realloc(arena, fn->slot_at, sizeof(int) * oldcap,
+                                 sizeof(int) * newcap);
+    if (!slot_at) {
+      fprintf(stderr, "couldn't grow ir slot lookup to %d\n", newcap);
+      lower->failed = true;
+      return IR_NONE;
+    }
+    for (int i = oldcap; i < newcap; i++) {
+      slot_at[i] = IR_NONE;
+    }
+    fn->slot_at = slot_at;
+    fn->slot_at_cap = newcap;
+  }
+
+  for (int i = fn->slot_at[offset]; i != IR_NONE; i = fn->slots[i].next) {
+    if (fn->slots[i].size == (int)info.size) {
+      return i;
+    }
+  }
+  IrSlot *slots = ir_grow(arena, fn->slots, &fn->slots_cap, fn->num_slots,
+                          sizeof(*slots));
+  if (!slots) {
+    lower->failed = true;
+    return IR_NONE;
+  }
+  fn->slots = slots;
+  IrSlot slot = {.offset = offset, .size = info.size,
+                 .next = fn->slot_at[offset]};
+  fn->slots[fn->num_slots] = slot;
+  fn->slot_at[offset] = fn->num_slots;
+  if (offset > fn->locals_size) {
+    fn->locals_size = offset;
+  }
+  return fn->num_slots++;
+}
+
+// false for anything but decimal digits and for
+// numbers above INT32_MAX
+bool ir_parse_int(String literal, int64_t *value) {
+  int64_t result = 0;
+  for (unsigned i = 0; i < literal.len; i++) {
+    int digit = literal.data[i] - '0';
+    if (digit < 0 || digit > 9 || result > (INT32_MAX - digit) / 10) {
+      return false;
+    }
+    result = result * 10 + digit;
+  }
+  *value = result;
+  return literal.len > 0;
+}
+
+static IrOp ir_op_of_flat(FlatKind kind) {
+  switch (kind) {
+  case FLAT_ADD: return IR_ADD;
+  case FLAT_SUB: return IR_SUB;
+  case FLAT_MUL: return IR_MUL;
+  case FLAT_DIV: return IR_DIV;
+  case FLAT_MOD: return IR_MOD;
+  case FLAT_LESS: return IR_LESS;
+  case FLAT_LESS_EQUAL: return IR_LESS_EQUAL;
+  case FLAT_GREATER: return IR_GREATER;
+  case FLAT_GREATER_EQUAL: return IR_GREATER_EQUAL;
+  default: return IR_EQUAL;
+  }
+}
+
+// lowers a flattened expression, the operands of every
+// operator wait on a stack of values instead of %rax and
+// the machine stack. returns its value or IR_NONE
+static int ir_lower_flat(IrLower *lower, uint32_t root) {
+  Parser *parser = lower->parser;
+  FlatAst *flat = &parser->flat;
+  int len = 0;
+
+  for (uint32_t i = flat->nodes[root].first; i <= root && !lower->failed;
+       i++) {
+    FlatNode *f = &flat->nodes[i];
+    FlatKind kind = flat->kinds[i];
+    if (kind == FLAT_LVALUE) {
+      continue;
+    }
+    IrInst inst = {.op = IR_CONST, .type = IR_I32, .width = 0,
+                   .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE,
+                   .slot = IR_NONE, .imm = 0};
+
+    switch (kind) {
+    case FLAT_CONST: {
+      String literal = str_interner_symbol(&parser->pool, f->value);
+      if (!ir_parse_int(literal, &inst.imm)) {
+        lower->failed = true;
+        return IR_NONE;
+      }
+      inst.dst = ir_new_value(lower, IR_I32);
+      break;
+    }
+    case FLAT_LOAD:
+    case FLAT_STORE: {
+      AssemblyVarInfo info =
+          vartable_get(&parser->assembly_variables, f->value);
+      int width = f->width ? f->width : info.size;
+      if (!info.isValid || (width != 1 && width != 4 && width != 8)) {
+        lower->failed = true;
+        return IR_NONE;
+      }
+      inst.width = width;
+      inst.slot = ir_slot_of(lower, info);
+      inst.imm = f->offset;
+      if (kind == FLAT_LOAD) {
+        inst.op = IR_LOAD;
+        inst.type = width == 8 ? IR_I64 : IR_I32;
+        inst.dst = ir_new_value(lower, inst.type);
+      } else {
+        // the stored value is also the result
+        inst.op = IR_STORE;
+        inst.type = IR_VOID;
+        inst.a = lower->stack[--len];
+      }
+      break;
+    }
+    case FLAT_NEG:
+      inst.op = IR_NEG;
+      inst.a = lower->stack[--len];
+      inst.dst = ir_new_value(lower, IR_I32);
+      break;
+    default:
+      inst.op = ir_op_of_flat(kind);
+      inst.b = lower->stack[--len];
+      inst.a = lower->stack[--len];
+      inst.dst = ir_new_value(lower, IR_I32);
+      break;
+    }
+    ir_append(lower, inst);
+
+    int *stack = ir_grow(&parser->arena, lower->stack, &lower->stack_cap, len,
+                         sizeof(*stack));
+    if (!stack) {
+      lower->failed = true;
+      return IR_NONE;
+    }
+    lower->stack = stack;
+    lower->stack[len++] = inst.op == IR_STORE ? inst.a : inst.dst;
+  }
+
+  if (lower->failed) {
+    return IR_NONE;
+  }
+  assert(len == 1);
+  return lower->stack[0];
+}
+
+static bool ir_lower_pre(AstWalk *walk, AstWalkFrame *frame) {
+  IrLower *lower = walk->data;
+  Parser *parser = lower->parser;
+  AstNode *node = frame->node;
+  AstWalkFrame *parent = astwalk_parent(walk);
+
+  if (lower->failed) {
+    return false;
+  }
+  if (node->flat) {
+    lower->last = ir_lower_flat(lower, node->flat - 1);
+    return false;
+  }
+
+  switch (node->kind) {
+  case AST_FUNC_DEF:
+    if (parent) {
+      lower->failed = true;
+      return false;
+    }
+    frame->scratch[0] = vartable_frame_begin(&parser->assembly_variables);
+    return true;
+  case AST_FUNC_PROTO:
+    // only the parameters of a definition get stack slots
+    return parent && parent->node->kind == AST_FUNC_DEF;
+  case AST_RETURN:
+  case AST_DECL:
+    lower->last = IR_NONE;
+    return true;
+  case AST_BLOCK:
+    frame->scratch[0] = vartable_checkpoint_get(&parser->assembly_variables);
+    return true;
+  case AST_IF_ELSE:
+    // then, else and the join block
+    frame->scratch[0] = ir_new_block(lower);
+    ir_new_block(lower);
+    ir_new_block(lower);
+    return true;
+  case AST_FORLOOP:
+    // condition, body and exit block
+    frame->scratch[0] = ir_new_block(lower);
+    ir_new_block(lower);
+    ir_new_block(lower);
+    frame->scratch[1] = vartable_checkpoint_get(&parser->assembly_variables);
+    return true;
+  case AST_UNOP:
+  case AST_FUNC_CALL:
+    // not generated yet, but the code
+    // after them doesn't depend on that
+    lower->last = IR_NONE;
+    return false;
+  case AST_STRUCT:
+  case AST_BREAK:
+  case AST_MEMBER_ACCESS:
+    return false;
+  default:
+    // expressions that failed to flatten,
+    // errors and anything else new
+    lower->failed = true;
+    return false;
+  }
+}
+
+static void ir_lower_in(AstWalk *walk, AstWalkFrame *frame, int child) {
+  IrLower *lower = walk->data;
+  AstNode *node = frame->node;
+  int block = frame->scratch[0];
+
+  if (lower->failed) {
+    return;
+  }
+  switch (node->kind) {
+  case AST_IF_ELSE:
+    if (child == 1) {
+      if (lower->last == IR_NONE) {
+        lower->failed = true;
+        return;
+      }
+      ir_branch(lower, lower->last, block, block + 1);
+      ir_start_block(lower, block);
+    } else if (child == 2) {
+      ir_jump(lower, block + 2);
+      ir_start_block(lower, block + 1);
+    }
+    break;
+  case AST_FORLOOP:
+    if (child == 1) {
+      ir_start_block(lower, block);
+      lower->last = IR_NONE;
+    } else if (child == 2) {
+      if (lower->last == IR_NONE) {
+        lower->failed = true;
+        return;
+      }
+      ir_branch(lower, lower->last, block + 1, block + 2);
+      ir_start_block(lower, block + 1);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void ir_lower_post(AstWalk *walk, AstWalkFrame *frame) {
+  IrLower *lower = walk->data;
+  Parser *parser = lower->parser;
+  AstNode *node = frame->node;
+  int block = frame->scratch[0];
+
+  switch (node->kind) {
+  case AST_FUNC_DEF:
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[0]);
+    if (!lower->failed &&
+        !ir_block_terminated(&lower->fn->blocks[lower->fn->current])) {
+      ir_ret(lower, IR_NONE);
+    }
+    break;
+  case AST_BLOCK:
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[0]);
+    break;
+  case AST_FORLOOP:
+    vartable_checkpoint_set(&parser->assembly_variables, frame->scratch[1]);
+    ir_jump(lower, block);
+    ir_start_block(lower, block + 2);
+    break;
+  case AST_IF_ELSE:
+    ir_start_block(lower, block + 2);
+    break;
+  case AST_RETURN: {
+    if (node->ret.expr && lower->last == IR_NONE) {
+      lower->failed = true;
+      return;
+    }
+    ir_ret(lower, node->ret.expr ? lower->last : IR_NONE);
+    // whatever follows is unreachable
+    // and dropped with its block
+    int next = ir_new_block(lower);
+    if (!lower->failed) {
+      lower->fn->blocks[next].order = lower->fn->num_started++;
+      lower->fn->current = next;
+    }
+    break;
+  }
+  case AST_DECL: {
+    int size = decl_stack_size(parser, node);
+    int align = decl_stack_align(parser, node);
+    vartable_add_stack_var(&parser->assembly_variables,
+                           node->decl.name.symbol, size, align);
+    AssemblyVarInfo info =
+        vartable_get(&parser->assembly_variables, node->decl.name.symbol);
+    int slot = ir_slot_of(lower, info);
+    if (!node->decl.expr || decl_is_struct(parser, node) || lower->failed) {
+      break;
+    }
+    if (lower->last == IR_NONE || (size != 1 && size != 4 && size != 8)) {
+      lower->failed = true;
+      break;
+    }
+    IrInst inst = {.op = IR_STORE, .type = IR_VOID, .width = size,
+                   .dst = IR_NONE, .a = lower->last, .b = IR_NONE,
+                   .slot = slot, .imm = 0};
+    ir_append(lower, inst);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// drops the blocks that can't be reached and
+// numbers the others in the order they were started
+int ir_finish(Parser *parser, IrFunc *fn) {
+  Arena *arena = &parser->arena;
+  int *stack = arena_alloc(arena, sizeof(int) * (fn->num_blocks + 1));
+  int *index = arena_alloc(arena, sizeof(int) * (fn->num_blocks + 1));
+  int *by_order = arena_alloc(arena, sizeof(int) * (fn->num_started + 1));
+  IrBlock *blocks = arena_alloc(arena, sizeof(IrBlock) * (fn->num_blocks + 1));
+  if (!stack || !index || !by_order || !blocks) {
+    fprintf(stderr, "couldn't allocate ir block order\n");
+    return -1;
+  }
+
+  for (int i = 0; i < fn->num_blocks; i++) {
+    index[i] = IR_NONE;
+  }
+  int len = 0;
+  stack[len++] = 0;
+  index[0] = 0;
+  while (len > 0) {
+    IrBlock *block = &fn->blocks[stack[--len]];
+    for (int s = 0; s < 2; s++) {
+      int succ = block->succ[s];
+      if (succ != IR_NONE && index[succ] == IR_NONE) {
+        index[succ] = 0;
+        stack[len++] = succ;
+      }
+    }
+  }
+
+  for (int i = 0; i < fn->num_started; i++) {
+    by_order[i] = IR_NONE;
+  }
+  for (int i = 0; i < fn->num_blocks; i++) {
+    if (index[i] != IR_NONE) {
+      assert(fn->blocks[i].order >= 0);
+      by_order[fn->blocks[i].order] = i;
+    }
+  }
+  int num_blocks = 0;
+  for (int i = 0; i < fn->num_started; i++) {
+    if (by_order[i] != IR_NONE) {
+      index[by_order[i]] = num_blocks;
+      blocks[num_blocks] = fn->blocks[by_order[i]];
+      blocks[num_blocks].order = num_blocks;
+      num_blocks++;
+    }
+  }
+  for (int i = 0; i < num_blocks; i++) {
+    for (int s = 0; s < 2; s++) {
+      if (blocks[i].succ[s] != IR_NONE) {
+        blocks[i].succ[s] = index[blocks[i].succ[s]];
+      }
+    }
+  }
+  fn->blocks = blocks;
+  fn->num_blocks = num_blocks;
+  fn->blocks_cap = num_blocks + 1;
+  return 0;
+}
+
+// everything is allocated in the parser arena. returns -1
+// if the function uses something the ir can't express yet
+int ir_lower_function(Parser *parser, AstNode *func, IrFunc *fn) {
+  assert(func->kind == AST_FUNC_DEF);
+  memset(fn, 0, sizeof(*fn));
+  fn->node = func;
+  fn->frame_align = 16;
+  if (parser->max_align > 16) {
+    fn->frame_align = function_frame_align(parser, func);
+  }
+
+  IrLower lower = {.parser = parser, .fn = fn, .last = IR_NONE,
+                   .failed = false, .stack = NULL, .stack_cap = 0};
+  int entry = ir_new_block(&lower);
+  if (entry == IR_NONE) {
+    return -1;
+  }
+  fn->blocks[entry].order = fn->num_started++;
+  fn->current = entry;
+
+  AstWalk walk;
+  astwalk_init(&walk, ir_lower_pre, ir_lower_in, ir_lower_post, &lower);
+  astwalk_run(&walk, func, 0);
+  astwalk_quit(&walk);
+
+  if (lower.failed || ir_finish(parser, fn) < 0) {
+    return -1;
+  }
+  if (ir_promote_locals(parser, fn) < 0 ||
+      ir_fold_constants(parser, fn) < 0 ||
+      ir_hoist_invariants(parser, fn) < 0) {
+    return -1;
+  }
+  return ir_allocate_registers(parser, fn);
+}
+
+// 8, 4 and 1 byte names of the registers values live in
+// and of the scratch registers of the emitter
+const char *ir_reg_names[][3] = {
+    [RAX] = {"%rax", "%eax", "%al"},     [RCX] = {"%rcx", "%ecx", "%cl"},
+    [RDX] = {"%rdx", "%edx", "%dl"},     [RBX] = {"%rbx", "%ebx", "%bl"},
+    [R12] = {"%r12", "%r12d", "%r12b"}, [R13] = {"%r13", "%r13d", "%r13b"},
+    [R14] = {"%r14", "%r14d", "%r14b"},
+};
+
+static void ir_print_op(FILE *file, IrOp op) {
+  static const char *names[] = {FOREACH_IR_OP(GENERATE_STRING)};
+  // IR_ADD prints as add
+  for (const char *c = names[op] + 3; *c; c++) {
+    fputc(*c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c, file);
+  }
+}
+
+// constants print as their number
+static void ir_print_value(IrFunc *fn, FILE *file, int value) {
+  if (ir_is_const(fn, value)) {
+    fprintf(file, "%ld", (long)fn->consts[value]);
+  } else {
+    fprintf(file, "v%d", value);
+  }
+}
+
+void ir_func_print(Parser *parser, IrFunc *fn, FILE *file) {
+  static const char *type_names[] = {
+      [IR_VOID] = "void", [IR_I32] = "i32", [IR_I64] = "i64"};
+  AstFuncPrototype *proto = &fn->node->func.prototype->funcproto;
+  String name = parser_token_content(parser, proto->name);
+
+  fprintf(file, "function %.*s\n", name.len, name.data);
+  for (int i = 0; i < fn->num_slots; i++) {
+    fprintf(file, "  slot%d: %d bytes at -%d(%%rbp)\n", i, fn->slots[i].size,
+            fn->slots[i].offset);
+  }
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    fprintf(file, "bb%d:", b);
+    int num_preds = 0;
+    for (int p = 0; p < fn->num_blocks; p++) {
+      for (int s = 0; s < 2; s++) {
+        if (fn->blocks[p].succ[s] == b) {
+          fprintf(file, num_preds++ ? ", bb%d" : "  ; preds bb%d", p);
+        }
+      }
+    }
+    fprintf(file, "\n");
+
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      fprintf(file, "  ");
+      if (inst->dst != IR_NONE) {
+        fprintf(file, "v%d:%s = ", inst->dst, type_names[inst->type]);
+      }
+      ir_print_op(file, inst->op);
+      switch ((IrOp)inst->op) {
+      case IR_CONST:
+        fprintf(file, " %ld", (long)inst->imm);
+        break;
+      case IR_LOAD:
+        fprintf(file, "%d slot%d+%ld", inst->width, inst->slot,
+                (long)inst->imm);
+        break;
+      case IR_STORE:
+        fprintf(file, "%d slot%d+%ld, ", inst->width, inst->slot,
+                (long)inst->imm);
+        ir_print_value(fn, file, inst->a);
+        break;
+      case IR_COPY:
+        if (inst->width) {
+          fprintf(file, "%d", inst->width);
+        }
+        fprintf(file, " ");
+        ir_print_value(fn, file, inst->a);
+        break;
+      case IR_JUMP:
+        fprintf(file, " bb%d", block->succ[0]);
+        break;
+      case IR_BRANCH:
+        fprintf(file, " v%d, bb%d, bb%d", inst->a, block->succ[0],
+                block->succ[1]);
+        break;
+      case IR_RET:
+        if (inst->a != IR_NONE) {
+          fprintf(file, " ");
+          ir_print_value(fn, file, inst->a);
+        }
+        break;
+      case IR_NEG:
+        fprintf(file, " ");
+        ir_print_value(fn, file, inst->a);
+        break;
+      default:
+        fprintf(file, " ");
+        ir_print_value(fn, file, inst->a);
+        fprintf(file, ", ");
+        ir_print_value(fn, file, inst->b);
+        break;
+      }
+      if (inst->dst != IR_NONE && fn->regs[inst->dst] != IR_NO_REG) {
+        fprintf(file, "  ; %s", ir_reg_names[fn->regs[inst->dst]][0]);
+      } else if (inst->dst != IR_NONE) {
+        fprintf(file, "  ; home %d", fn->homes[inst->dst]);
+      }
+      fprintf(file, "\n");
+    }
+  }
+}
+
+typedef struct IrEmit {
+  Parser *parser;
+  IrFunc *fn;
+  FILE *file;
+  String name;
+  // homes start below the locals, the
+  // saved registers come below the homes
+  int homes_base;
+  int saves_base;
+} IrEmit;
+
+static int ir_size_index(int bytes) {
+  return bytes == 8 ? 0 : bytes == 4 ? 1 : 2;
+}
+
+static bool ir_in_reg(IrEmit *emit, int value) {
+  return emit->fn->regs[value] != IR_NO_REG;
+}
+
+// the register or stack home of a value,
+// bytes picks the name of the register
+static const char *ir_value(IrEmit *emit, int value, int bytes, char *buf) {
+  if (ir_is_const(emit->fn, value)) {
+    snprintf(buf, 32, "$%ld", (long)emit->fn->consts[value]);
+    return buf;
+  }
+  uint8_t reg = emit->fn->regs[value];
+  if (reg != IR_NO_REG) {
+    return ir_reg_names[reg][ir_size_index(bytes)];
+  }
+  snprintf(buf, 32, "-%d(%%rbp)",
+           emit->homes_base + 8 * (emit->fn->homes[value] + 1));
+  return buf;
+}
+
+// a 64 bit register that holds the value, values on the
+// stack are loaded into scratch. ints are zero extended
+static const char *ir_value_reg(IrEmit *emit, int value,
+                                AssemblyRegisterType scratch) {
+  char buf[32];
+  if (ir_in_reg(emit, value)) {
+    return ir_reg_names[emit->fn->regs[value]][0];
+  }
+  if (emit->fn->types[value] == IR_I64 && !ir_is_const(emit->fn, value)) {
+    fprintf(emit->file, "  movq %s, %s\n", ir_value(emit, value, 8, buf),
+            ir_reg_names[scratch][0]);
+  } else {
+    fprintf(emit->file, "  movl %s, %s\n", ir_value(emit, value, 4, buf),
+            ir_reg_names[scratch][1]);
+  }
+  return ir_reg_names[scratch][0];
+}
+
+// register the result of an instruction is computed in
+static AssemblyRegisterType ir_result_reg(IrEmit *emit, int value) {
+  return ir_in_reg(emit, value) ? emit->fn->regs[value] : RAX;
+}
+
+// moves a result that was computed in %rax to its home
+static void ir_result_done(IrEmit *emit, int value) {
+  char buf[32];
+  if (ir_in_reg(emit, value)) {
+    return;
+  }
+  if (emit->fn->types[value] == IR_I64) {
+    fprintf(emit->file, "  movq %%rax, %s\n", ir_value(emit, value, 8, buf));
+  } else {
+    fprintf(emit->file, "  movl %%eax, %s\n", ir_value(emit, value, 4, buf));
+  }
+}
+
+static bool ir_same_location(IrEmit *emit, int a, int b) {
+  IrFunc *fn = emit->fn;
+  if (fn->regs[a] != IR_NO_REG || fn->regs[b] != IR_NO_REG) {
+    return fn->regs[a] == fn->regs[b];
+  }
+  return fn->homes[a] == fn->homes[b];
+}
+
+static void ir_emit_copy(IrEmit *emit, IrInst *inst) {
+  FILE *file = emit->file;
+  IrFunc *fn = emit->fn;
+  char buf[32];
+  int width = inst->width;
+  if (width == 0) {
+    width = fn->types[inst->dst] == IR_I64 ? 8 : 4;
+  }
+  if (ir_is_const(fn, inst->a)) {
+    int64_t value = fn->consts[inst->a];
+    if (width == 1) {
+      value = (int8_t)value;
+    }
+    // movq sign extends the immediate, ints are zero extended
+    if (!ir_in_reg(emit, inst->dst) && (width != 8 || value >= 0)) {
+      fprintf(file, "  mov%c $%ld, %s\n", width == 8 ? 'q' : 'l',
+              (long)value, ir_value(emit, inst->dst, width, buf));
+      return;
+    }
+    AssemblyRegisterType reg = ir_result_reg(emit, inst->dst);
+    fprintf(file, "  movl $%ld, %s\n", (long)value, ir_reg_names[reg][1]);
+    ir_result_done(emit, inst->dst);
+    return;
+  }
+  // ints in registers are zero extended already
+  bool as_is = width == 4 ? fn->types[inst->a] == IR_I32
+                          : width == 8 && (fn->types[inst->a] == IR_I64 ||
+                                           ir_in_reg(emit, inst->a));
+  if (as_is && ir_same_location(emit, inst->dst, inst->a)) {
+    return;
+  }
+  if (width != 1 && !ir_in_reg(emit, inst->dst) &&
+      ir_in_reg(emit, inst->a)) {
+    fprintf(file, "  mov%c %s, %s\n", width == 8 ? 'q' : 'l',
+            ir_value(emit, inst->a, width, buf),
+            ir_value(emit, inst->dst, width, buf));
+    return;
+  }
+
+  AssemblyRegisterType reg = ir_result_reg(emit, inst->dst);
+  if (width == 1) {
+    fprintf(file, "  movsbl %s, %s\n", ir_value(emit, inst->a, 1, buf),
+            ir_reg_names[reg][1]);
+  } else if (width == 8 && (fn->types[inst->a] == IR_I64 ||
+                            ir_in_reg(emit, inst->a))) {
+    fprintf(file, "  movq %s, %s\n", ir_value(emit, inst->a, 8, buf),
+            ir_reg_names[reg][0]);
+  } else {
+    fprintf(file, "  movl %s, %s\n", ir_value(emit, inst->a, 4, buf),
+            ir_reg_names[reg][1]);
+  }
+  ir_result_done(emit, inst->dst);
+}
+
+static void ir_emit_jump(IrEmit *emit, const char *jump, int from, int to) {
+  if (strcmp(jump, "jmp") == 0 && to == from + 1) {
+    return;
+  }
+  fprintf(emit->file, "  %s %.*sbb%d\n", jump, emit->name.len,
+          emit->name.data, to);
+}
+
+static void ir_emit_inst(IrEmit *emit, int b, IrInst *inst) {
+  FILE *file = emit->file;
+  IrFunc *fn = emit->fn;
+  IrBlock *block = &fn->blocks[b];
+  char buf[32];
+  int location = 0;
+  if (inst->slot != IR_NONE) {
+    location = fn->slots[inst->slot].offset - inst->imm;
+  }
+
+  switch ((IrOp)inst->op) {
+  case IR_CONST:
+    fprintf(file, "  movl $%ld, %s\n", (long)inst->imm,
+            ir_value(emit, inst->dst, 4, buf));
+    break;
+  case IR_LOAD: {
+    AssemblyRegisterType reg = ir_result_reg(emit, inst->dst);
+    if (inst->width == 8) {
+      fprintf(file, "  movq -%d(%%rbp), %s\n", location, ir_reg_names[reg][0]);
+    } else if (inst->width == 4) {
+      fprintf(file, "  movl -%d(%%rbp), %s\n", location, ir_reg_names[reg][1]);
+    } else {
+      fprintf(file, "  movsbl -%d(%%rbp), %s\n", location,
+              ir_reg_names[reg][1]);
+    }
+    ir_result_done(emit, inst->dst);
+    break;
+  }
+  case IR_STORE: {
+    static const char *moves[] = {"movq", "movl", "movb"};
+    int size = ir_size_index(inst->width);
+    if (ir_is_const(fn, inst->a) &&
+        (inst->width != 8 || fn->consts[inst->a] >= 0)) {
+      int64_t value = fn->consts[inst->a];
+      fprintf(file, "  %s $%ld, -%d(%%rbp)\n", moves[size],
+              (long)(inst->width == 1 ? (int8_t)value : value), location);
+      break;
+    }
+    AssemblyRegisterType reg = RAX;
+    if (ir_in_reg(emit, inst->a)) {
+      reg = fn->regs[inst->a];
+    } else {
+      ir_value_reg(emit, inst->a, RAX);
+    }
+    fprintf(file, "  %s %s, -%d(%%rbp)\n", moves[size],
+            ir_reg_names[reg][size], location);
+    break;
+  }
+  case IR_COPY:
+    ir_emit_copy(emit, inst);
+    break;
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL: {
+    static const char *names[] = {
+        [IR_ADD] = "addl", [IR_SUB] = "subl", [IR_MUL] = "imull"};
+    int a = inst->a;
+    int b = inst->b;
+    // constants go to the right where they are immediates
+    if (ir_is_const(fn, a) && inst->op != IR_SUB) {
+      a = inst->b;
+      b = inst->a;
+    }
+    if (inst->op == IR_MUL && ir_is_const(fn, b)) {
+      AssemblyRegisterType reg = ir_result_reg(emit, inst->dst);
+      if (fn->regs[a] != reg) {
+        fprintf(file, "  movl %s, %s\n", ir_value(emit, a, 4, buf),
+                ir_reg_names[reg][1]);
+      }
+      strength_mul(file, 2, reg, (int32_t)fn->consts[b]);
+      ir_result_done(emit, inst->dst);
+      break;
+    }
+    uint8_t reg = fn->regs[inst->dst];
+    // the result register can't be overwritten
+    // with a before b was read
+    if (reg != IR_NO_REG && fn->regs[b] == reg && fn->regs[a] != reg) {
+      if (inst->op == IR_SUB) {
+        reg = IR_NO_REG;
+      } else {
+        int swap = a;
+        a = b;
+        b = swap;
+      }
+    }
+    if (reg == IR_NO_REG) {
+      fprintf(file, "  movl %s, %%eax\n", ir_value(emit, a, 4, buf));
+      fprintf(file, "  %s %s, %%eax\n", names[inst->op],
+              ir_value(emit, b, 4, buf));
+      fprintf(file, "  movl %%eax, %s\n", ir_value(emit, inst->dst, 4, buf));
+      break;
+    }
+    if (fn->regs[a] != reg) {
+      fprintf(file, "  movl %s, %s\n", ir_value(emit, a, 4, buf),
+              ir_reg_names[reg][1]);
+    }
+    fprintf(file, "  %s %s, %s\n", names[inst->op], ir_value(emit, b, 4, buf),
+            ir_reg_names[reg][1]);
+    break;
+  }
+  case IR_DIV:
+  case IR_MOD:
+    fprintf(file, "  movl %s, %%eax\n", ir_value(emit, inst->a, 4, buf));
+    if (ir_is_const(fn, inst->b)) {
+      strength_div(file, 2, (int32_t)fn->consts[inst->b],
+                   inst->op == IR_MOD);
+    } else {
+      fprintf(file, "  cltd\n");
+      fprintf(file, "  idivl %s\n", ir_value(emit, inst->b, 4, buf));
+      if (inst->op == IR_MOD) {
+        fprintf(file, "  movl %%edx, %%eax\n");
+      }
+    }
+    fprintf(file, "  movl %%eax, %s\n", ir_value(emit, inst->dst, 4, buf));
+    break;
+  case IR_NEG: {
+    AssemblyRegisterType reg = ir_result_reg(emit, inst->dst);
+    if (fn->regs[inst->a] != reg) {
+      fprintf(file, "  movl %s, %s\n", ir_value(emit, inst->a, 4, buf),
+              ir_reg_names[reg][1]);
+    }
+    fprintf(file, "  negl %s\n", ir_reg_names[reg][1]);
+    ir_result_done(emit, inst->dst);
+    break;
+  }
+  case IR_LESS:
+  case IR_LESS_EQUAL:
+  case IR_GREATER:
+  case IR_GREATER_EQUAL:
+  case IR_EQUAL: {
+    static const char *setcc[] = {
+        [IR_LESS] = "setl",    [IR_LESS_EQUAL] = "setle",
+        [IR_GREATER] = "setg", [IR_GREATER_EQUAL] = "setge",
+        [IR_EQUAL] = "sete",
+    };
+    static const IrOp swapped[] = {
+        [IR_LESS] = IR_GREATER,    [IR_LESS_EQUAL] = IR_GREATER_EQUAL,
+        [IR_GREATER] = IR_LESS,    [IR_GREATER_EQUAL] = IR_LESS_EQUAL,
+        [IR_EQUAL] = IR_EQUAL,
+    };
+    int a = inst->a;
+    int b = inst->b;
+    IrOp op = inst->op;
+    if (ir_is_const(fn, a)) {
+      a = inst->b;
+      b = inst->a;
+      op = swapped[op];
+    }
+    if (fn->types[a] == IR_I64 || fn->types[b] == IR_I64) {
+      const char *left = ir_value_reg(emit, a, RAX);
+      const char *right = ir_value_reg(emit, b, RDX);
+      fprintf(file, "  cmpq %s, %s\n", right, left);
+    } else {
+      // one operand may stay in memory
+      char left_buf[32];
+      const char *left = "%eax";
+      if (ir_in_reg(emit, a) || ir_in_reg(emit, b) || ir_is_const(fn, b)) {
+        left = ir_value(emit, a, 4, left_buf);
+      } else {
+        ir_value_reg(emit, a, RAX);
+      }
+      fprintf(file, "  cmpl %s, %s\n", ir_value(emit, b, 4, buf), left);
+    }
+    fprintf(file, "  %s %%al\n", setcc[op]);
+    fprintf(file, "  movzbl %%al, %s\n",
+            ir_reg_names[ir_result_reg(emit, inst->dst)][1]);
+    ir_result_done(emit, inst->dst);
+    break;
+  }
+  case IR_JUMP:
+    ir_emit_jump(emit, "jmp", b, block->succ[0]);
+    break;
+  case IR_BRANCH:
+    fprintf(file, "  cmpl $0, %s\n", ir_value(emit, inst->a, 4, buf));
+    if (block->succ[1] == b + 1) {
+      ir_emit_jump(emit, "jne", b, block->succ[0]);
+    } else {
+      ir_emit_jump(emit, "je", b, block->succ[1]);
+      ir_emit_jump(emit, "jmp", b, block->succ[0]);
+    }
+    break;
+  case IR_RET:
+    if (inst->a != IR_NONE) {
+      if (fn->types[inst->a] == IR_I64) {
+        fprintf(file, "  movq %s, %%rax\n", ir_value(emit, inst->a, 8, buf));
+      } else {
+        fprintf(file, "  movl %s, %%eax\n", ir_value(emit, inst->a, 4, buf));
+      }
+    }
+    if (b + 1 < fn->num_blocks) {
+      fprintf(file, "  jmp %.*sexit\n", emit->name.len, emit->name.data);
+    }
+    break;
+  }
+}
+
+// the callee saved registers the allocator handed out
+static void ir_emit_saves(IrEmit *emit, bool restore) {
+  static const AssemblyRegisterType saved[] = {RBX, R12, R13, R14};
+  int n = 0;
+  for (int i = 0; i < (int)(sizeof(saved) / sizeof(*saved)); i++) {
+    if (!(emit->fn->used_regs & (1u << saved[i]))) {
+      continue;
+    }
+    int offset = emit->saves_base + 8 * ++n;
+    if (restore) {
+      fprintf(emit->file, "  movq -%d(%%rbp), %s\n", offset,
+              ir_reg_names[saved[i]][0]);
+    } else {
+      fprintf(emit->file, "  movq %s, -%d(%%rbp)\n",
+              ir_reg_names[saved[i]][0], offset);
+    }
+  }
+}
+
+void ir_emit_function(Parser *parser, IrFunc *fn, FILE *file) {
+  AstFuncPrototype *proto = &fn->node->func.prototype->funcproto;
+  IrEmit emit = {.parser = parser, .fn = fn, .file = file,
+                 .name = parser_token_content(parser, proto->name)};
+  emit.homes_base = offset_align(fn->locals_size, 8);
+  emit.saves_base = emit.homes_base + 8 * fn->num_homes;
+  int frame_size =
+      offset_align(emit.saves_base + 8 * __builtin_popcount(fn->used_regs), 16);
+
+  fprintf(file, "%.*s:\n", emit.name.len, emit.name.data);
+  fprintf(file, "  pushq %%rbp\n");
+  fprintf(file, "  movq %%rsp, %%rbp\n");
+  // same realigned frame as the ast code generation
+  if (fn->frame_align > 16) {
+    fprintf(file, "  leaq -8(%%rbp), %%rsp\n");
+    fprintf(file, "  andq $-%d, %%rsp\n", fn->frame_align);
+    fprintf(file, "  movq %%rbp, (%%rsp)\n");
+    fprintf(file, "  movq %%rsp, %%rbp\n");
+  }
+  if (frame_size > 0) {
+    fprintf(file, "  subq $%d, %%rsp\n", frame_size);
+  }
+  ir_emit_saves(&emit, false);
+
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    if (b > 0) {
+      fprintf(file, "  %.*sbb%d:\n", emit.name.len, emit.name.data, b);
+    }
+    for (int i = 0; i < block->len; i++) {
+      ir_emit_inst(&emit, b, &block->insts[i]);
+    }
+  }
+
+  fprintf(file, "  %.*sexit:\n", emit.name.len, emit.name.data);
+  ir_emit_saves(&emit, true);
+  if (fn->frame_align > 16) {
+    fprintf(file, "  movq (%%rbp), %%rbp\n");
+  }
+  fprintf(file, "  movq %%rbp, %%rsp\n");
+  fprintf(file, "  popq %%rbp\n");
+  fprintf(file, "  ret\n");
+}
+
+// lowers every function of the program to the ir, emits it when
+// file is set and prints it when ir_file is set. functions the
+// ir can't express yet are emitted by the ast code generation
+static void ir_program(Parser *parser, AstNode *program, FILE *file,
+                       FILE *ir_file) {
+  if (file) {
+    dump_assembly_header(file, 0);
+  }
+
+  AstNodeList *items = &program->program.items;
+  for (int i = 0; i < items->len; i++) {
+    AstNode *item = items->nodes[i];
+
+    if (item->kind == AST_DECL) {
+      // code outside of functions is never executed,
+      // only the stack slot of the variable is visible
+      vartable_add_stack_var(&parser->assembly_variables,
+                             item->decl.name.symbol,
+                             decl_stack_size(parser, item),
+                             decl_stack_align(parser, item));
+      continue;
+    }
+    if (item->kind != AST_FUNC_DEF) {
+      if (file) {
+        parser_dump_assembly_program(parser, item, file, 0, NULL);
+      }
+      continue;
+    }
+
+    ArenaMark mark = arena_mark(&parser->arena);
+    IrFunc fn;
+    if (ir_lower_function(parser, item, &fn) < 0) {
+      if (ir_file) {
+        AstFuncPrototype *proto = &item->func.prototype->funcproto;
+        String name = parser_token_content(parser, proto->name);
+        fprintf(ir_file, "function %.*s is not lowered to the ir\n",
+                name.len, name.data);
+      }
+      if (file) {
+        parser_dump_assembly_program(parser, item, file, 0, NULL);
+      }
+    } else {
+      if (ir_file) {
+        ir_func_print(parser, &fn, ir_file);
+      }
+      if (file) {
+        ir_emit_function(parser, &fn, file);
+      }
+    }
+    arena_reset(&parser->arena, mark);
+  }
+}
+
+void parser_dump_assembly_ir(Parser *parser, FILE *file) {
+  if (parser->num_errors) {
+    fprintf(file, "encountered error previously\n");
+    return;
+  }
+  ir_program(parser, parser->root, file, NULL);
+}
+
+void parser_dump_ir(Parser *parser, FILE *file) {
+  if (parser->num_errors) {
+    return;
+  }
+  int checkpoint = vartable_checkpoint_get(&parser->assembly_variables);
+  ir_program(parser, parser->root, NULL, file);
+  vartable_checkpoint_set(&parser->assembly_variables, checkpoint);
+}
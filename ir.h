@@ -0,0 +1,128 @@
+#ifndef MY_IR_H
+#define MY_IR_H
+
+//////// three address ir ////////
+// every function is lowered into basic blocks of linear
+// instructions that read and write virtual registers.
+// a block ends with exactly one jump, branch or return
+// and its successors form the control flow graph.
+// locals start in their stack slots, loads and stores
+// name the slot and the displacement of the member.
+// scalar locals are promoted to values of their own
+// that are assigned with copies, so values can
+// have several definitions. values that are known
+// at compile time are folded into immediates
+#define FOREACH_IR_OP(MACRO)                                                   \
+  MACRO(IR_CONST)                                                              \
+  MACRO(IR_LOAD)                                                               \
+  MACRO(IR_STORE)                                                              \
+  MACRO(IR_COPY)                                                               \
+  MACRO(IR_ADD)                                                                \
+  MACRO(IR_SUB)                                                                \
+  MACRO(IR_MUL)                                                                \
+  MACRO(IR_DIV)                                                                \
+  MACRO(IR_MOD)                                                                \
+  MACRO(IR_NEG)                                                                \
+  MACRO(IR_LESS)                                                               \
+  MACRO(IR_LESS_EQUAL)                                                         \
+  MACRO(IR_GREATER)                                                            \
+  MACRO(IR_GREATER_EQUAL)                                                      \
+  MACRO(IR_EQUAL)                                                              \
+  MACRO(IR_JUMP)                                                               \
+  MACRO(IR_BRANCH)                                                             \
+  MACRO(IR_RET)
+
+typedef enum IrOp { FOREACH_IR_OP(GENERATE_ENUM) } IrOp;
+
+// int values are kept zero extended in their 64 bit
+// register. ints are compared as signed 32 bit numbers,
+// comparisons with an i64 look at all 64 bits
+#define FOREACH_IR_TYPE(MACRO)                                                 \
+  MACRO(IR_VOID)                                                               \
+  MACRO(IR_I32)                                                                \
+  MACRO(IR_I64)
+
+typedef enum IrType { FOREACH_IR_TYPE(GENERATE_ENUM) } IrType;
+
+#define IR_NONE (-1)
+#define IR_NO_REG 0xff
+
+typedef struct IrInst {
+  uint8_t op;
+  // type of dst
+  uint8_t type;
+  // bytes a load or store accesses, loads of
+  // a single byte are sign extended. a copy narrows
+  // like a store to that many bytes, 0 copies as is
+  uint8_t width;
+  int32_t dst;
+  int32_t a;
+  int32_t b;
+  // stack slot of a load or store
+  int32_t slot;
+  // constant or the member displacement in the slot
+  int64_t imm;
+} IrInst;
+
+// a branch goes to succ[0] if a is not zero, else to succ[1].
+// a jump only has succ[0], a return none
+typedef struct IrBlock {
+  IrInst *insts;
+  int len;
+  int cap;
+  int succ[2];
+  // position in the layout, -1 until the block is started
+  int order;
+} IrBlock;
+
+// the variable starts at -offset(%rbp)
+typedef struct IrSlot {
+  int offset;
+  int size;
+  // next slot at the same offset or -1
+  int next;
+} IrSlot;
+
+// all arrays live in the parser arena and are
+// dropped after the function was emitted
+typedef struct IrFunc {
+  struct AstNode *node;
+  IrBlock *blocks;
+  int num_blocks;
+  int blocks_cap;
+  // block that is appended to during lowering
+  int current;
+  int num_started;
+
+  uint8_t *types;
+  int num_values;
+  int values_cap;
+
+  IrSlot *slots;
+  int num_slots;
+  int slots_cap;
+  // offset -> first slot there or -1
+  int *slot_at;
+  int slot_at_cap;
+
+  // value -> register (an AssemblyRegisterType) or IR_NO_REG
+  uint8_t *regs;
+  // registers that have to be saved in the prologue
+  uint32_t used_regs;
+  // value -> 8 byte slot below the locals for the values
+  // without a register, values that aren't live at the
+  // same time share one
+  int *homes;
+  int num_homes;
+
+  // value -> whether it is a constant that no instruction
+  // defines, it is an immediate operand of its uses
+  bool *is_const;
+  int64_t *consts;
+
+  // bytes the locals take below %rbp and their alignment
+  int locals_size;
+  int frame_align;
+} IrFunc;
+
+#endif
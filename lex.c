@@ -54,7 +54,9 @@ int tokens_internalize(TokenArray *tokens, String content,
                        StringInterner *interner){
   for(int i=0; i<tokens->len; i++){
     String original = str_from_slice(content, tokens->data[i].string);
-    tokens->data[i].string = str_interner_put(interner, original);
+    SymbolId symbol = str_interner_intern(interner, original);
+    tokens->data[i].symbol = symbol;
+    tokens->data[i].string = str_interner_slice(interner, symbol);
   }
   return 0;
 }
@@ -173,6 +175,15 @@ int tokens_add_from_string(TokenArray *tokens, String content, int fileid){
       tokens_push(tokens, tok);
       break;
 
+    case '%':
+      tok.kind = TOK_MOD;
+      tok.file_id = fileid;
+      tok.col = i - lastlinepos;
+      tok.string.start = i;
+      tok.string.len = 1;
+      tokens_push(tokens, tok);
+      break;
+
     case '-':
       tok.kind = TOK_MINUS;
       tok.file_id = fileid;
@@ -285,10 +296,10 @@ int tokens_add_from_string(TokenArray *tokens, String content, int fileid){
     } break;
 
     default: {
-      if (isalpha(c)) {
+      if (isalpha(c) || c == '_') {
         int len = 1;
         while (i + len < content.len &&
-               isalnum(content.data[i + len])) {
+               (isalnum(content.data[i + len]) || content.data[i + len] == '_')) {
           len++;
         }
         tok.kind = TOK_IDENTIFIER;
@@ -326,6 +337,14 @@ int tokens_add_from_string(TokenArray *tokens, String content, int fileid){
           } else if(strncmp(content.data + tok.string.start, "return", 6) == 0){
             tok.kind = TOK_KEYWORD_RETURN;
           }
+        } else if(tok.string.len == 8){
+          if(strncmp(content.data + tok.string.start, "_Alignas", 8) == 0) {
+            tok.kind = TOK_KEYWORD_ALIGNAS;
+          }
+        } else if(tok.string.len == 13){
+          if(strncmp(content.data + tok.string.start, "__attribute__", 13) == 0) {
+            tok.kind = TOK_KEYWORD_ATTRIBUTE;
+          }
         }
         tokens_push(tokens, tok);
         i += len-1;
@@ -7,6 +7,7 @@ typedef struct {
   unsigned line;
   unsigned col;
   StrSlice string;
+  SymbolId symbol;
   int file_id;
 } Token;
 
@@ -0,0 +1,535 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//////// loop invariant code motion ///////
+// an edge to a block that dominates its source is a back edge,
+// the blocks that reach its source without passing the header
+// it goes to form a natural loop. every loop gets a preheader,
+// a block that only enters it. instructions whose operands
+// don't change in the loop and that can neither trap nor write
+// memory move there, if their value has a single definition
+// that comes before all of its uses. inner loops go first so
+// that something invariant in several loops leaves all of them
+
+typedef struct Cfg {
+  // the predecessors of block b are preds[pred_start[b]]
+  // up to preds[pred_start[b + 1]]
+  int *pred_start;
+  int *preds;
+  // position of every block in reverse postorder
+  int *rpo_index;
+  int *idom;
+} Cfg;
+
+typedef struct Loop {
+  int header;
+  // blocks of the loop in reverse postorder
+  int *blocks;
+  int num_blocks;
+} Loop;
+
+typedef struct Licm {
+  Cfg cfg;
+  Loop *loops;
+  int num_loops;
+  // block -> index of the loop that marked it last
+  int *mark;
+  int *num_defs;
+  // value -> its only definition comes before every use
+  bool *dominates_uses;
+  int *defs_in_loop;
+  bool *invariant;
+} Licm;
+
+static int cfg_intersect(Cfg *cfg, int a, int b) {
+  while (a != b) {
+    while (cfg->rpo_index[a] > cfg->rpo_index[b]) {
+      a = cfg->idom[a];
+    }
+    while (cfg->rpo_index[b] > cfg->rpo_index[a]) {
+      b = cfg->idom[b];
+    }
+  }
+  return a;
+}
+
+static bool cfg_dominates(Cfg *cfg, int a, int b) {
+  while (b != a && cfg->idom[b] != b) {
+    b = cfg->idom[b];
+  }
+  return b == a;
+}
+
+// predecessors, reverse postorder and immediate dominators
+// (cooper, harvey and kennedy). all blocks are reachable
+static int cfg_compute(Parser *parser, IrFunc *fn, Cfg *cfg) {
+  Arena *arena = &parser->arena;
+  int num_blocks = fn->num_blocks;
+  cfg->pred_start = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  cfg->preds = arena_alloc(arena, sizeof(int) * (2 * num_blocks + 1));
+  cfg->rpo_index = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  cfg->idom = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  int *rpo = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  int *stack = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  int *next_succ = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  if (!cfg->pred_start || !cfg->preds || !cfg->rpo_index || !cfg->idom ||
+      !rpo || !stack || !next_succ) {
+    fprintf(stderr, "couldn't allocate the control flow graph\n");
+    return -1;
+  }
+
+  memset(cfg->pred_start, 0, sizeof(int) * (num_blocks + 1));
+  for (int b = 0; b < num_blocks; b++) {
+    for (int s = 0; s < 2; s++) {
+      if (fn->blocks[b].succ[s] != IR_NONE) {
+        cfg->pred_start[fn->blocks[b].succ[s] + 1]++;
+      }
+    }
+  }
+  for (int b = 0; b < num_blocks; b++) {
+    cfg->pred_start[b + 1] += cfg->pred_start[b];
+    next_succ[b] = cfg->pred_start[b];
+  }
+  for (int b = 0; b < num_blocks; b++) {
+    for (int s = 0; s < 2; s++) {
+      int succ = fn->blocks[b].succ[s];
+      if (succ != IR_NONE) {
+        cfg->preds[next_succ[succ]++] = b;
+      }
+    }
+  }
+
+  // a block is numbered after all its successors
+  // were, from the back of rpo
+  for (int b = 0; b < num_blocks; b++) {
+    cfg->rpo_index[b] = IR_NONE;
+    next_succ[b] = 0;
+  }
+  int len = 0;
+  int num_done = 0;
+  stack[len++] = 0;
+  cfg->rpo_index[0] = 0;
+  while (len > 0) {
+    int b = stack[len - 1];
+    if (next_succ[b] == 2) {
+      len--;
+      rpo[num_blocks - 1 - num_done++] = b;
+      continue;
+    }
+    int succ = fn->blocks[b].succ[next_succ[b]++];
+    if (succ != IR_NONE && cfg->rpo_index[succ] == IR_NONE) {
+      cfg->rpo_index[succ] = 0;
+      stack[len++] = succ;
+    }
+  }
+  assert(num_done == num_blocks);
+  for (int i = 0; i < num_blocks; i++) {
+    cfg->rpo_index[rpo[i]] = i;
+    cfg->idom[rpo[i]] = IR_NONE;
+  }
+
+  cfg->idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < num_blocks; i++) {
+      int b = rpo[i];
+      int idom = IR_NONE;
+      for (int p = cfg->pred_start[b]; p < cfg->pred_start[b + 1]; p++) {
+        int pred = cfg->preds[p];
+        if (cfg->idom[pred] == IR_NONE) {
+          continue;
+        }
+        idom = idom == IR_NONE ? pred : cfg_intersect(cfg, pred, idom);
+      }
+      if (idom != cfg->idom[b]) {
+        cfg->idom[b] = idom;
+        changed = true;
+      }
+    }
+  }
+  return 0;
+}
+
+// the natural loops, the ones with fewer blocks first
+static int licm_find_loops(Parser *parser, IrFunc *fn, Licm *licm) {
+  Arena *arena = &parser->arena;
+  Cfg *cfg = &licm->cfg;
+  int num_blocks = fn->num_blocks;
+  licm->loops = arena_alloc(arena, sizeof(Loop) * (num_blocks + 1));
+  licm->mark = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  int *stack = arena_alloc(arena, sizeof(int) * (num_blocks + 1));
+  uint64_t *order = arena_alloc(arena, sizeof(uint64_t) * (num_blocks + 1));
+  if (!licm->loops || !licm->mark || !stack || !order) {
+    fprintf(stderr, "couldn't allocate loops\n");
+    return -1;
+  }
+  for (int b = 0; b < num_blocks; b++) {
+    licm->mark[b] = IR_NONE;
+  }
+
+  licm->num_loops = 0;
+  for (int h = 0; h < num_blocks; h++) {
+    int loop = licm->num_loops;
+    int len = 0;
+    int num_loop_blocks = 0;
+    for (int p = cfg->pred_start[h]; p < cfg->pred_start[h + 1]; p++) {
+      int pred = cfg->preds[p];
+      if (cfg_dominates(cfg, h, pred) && licm->mark[pred] != loop) {
+        licm->mark[pred] = loop;
+        stack[len++] = pred;
+      }
+    }
+    if (len == 0) {
+      continue;
+    }
+    if (licm->mark[h] != loop) {
+      licm->mark[h] = loop;
+      order[num_loop_blocks++] = (uint64_t)cfg->rpo_index[h] << 32 | h;
+    }
+    while (len > 0) {
+      int b = stack[--len];
+      order[num_loop_blocks++] = (uint64_t)cfg->rpo_index[b] << 32 | b;
+      for (int p = cfg->pred_start[b]; p < cfg->pred_start[b + 1]; p++) {
+        int pred = cfg->preds[p];
+        if (licm->mark[pred] != loop) {
+          licm->mark[pred] = loop;
+          stack[len++] = pred;
+        }
+      }
+    }
+
+    int *blocks = arena_alloc(arena, sizeof(int) * num_loop_blocks);
+    if (!blocks) {
+      fprintf(stderr, "couldn't allocate loops\n");
+      return -1;
+    }
+    qsort(order, num_loop_blocks, sizeof(*order), compare_u64);
+    for (int i = 0; i < num_loop_blocks; i++) {
+      blocks[i] = (uint32_t)order[i];
+    }
+    licm->loops[licm->num_loops++] =
+        (Loop){.header = h, .blocks = blocks, .num_blocks = num_loop_blocks};
+  }
+
+  for (int l = 0; l < licm->num_loops; l++) {
+    order[l] = (uint64_t)licm->loops[l].num_blocks << 32 | l;
+  }
+  qsort(order, licm->num_loops, sizeof(*order), compare_u64);
+  Loop *loops = arena_alloc(arena, sizeof(Loop) * (licm->num_loops + 1));
+  if (!loops) {
+    fprintf(stderr, "couldn't allocate loops\n");
+    return -1;
+  }
+  for (int l = 0; l < licm->num_loops; l++) {
+    loops[l] = licm->loops[(uint32_t)order[l]];
+  }
+  licm->loops = loops;
+  for (int b = 0; b < num_blocks; b++) {
+    licm->mark[b] = IR_NONE;
+  }
+  return 0;
+}
+
+static void licm_mark_loop(Licm *licm, int l) {
+  Loop *loop = &licm->loops[l];
+  for (int i = 0; i < loop->num_blocks; i++) {
+    licm->mark[loop->blocks[i]] = l;
+  }
+}
+
+// the only block outside of loop l that goes to its header if
+// all it does is that, else IR_NONE. the loop has to be marked
+static int licm_preheader(IrFunc *fn, Licm *licm, int l) {
+  Cfg *cfg = &licm->cfg;
+  int header = licm->loops[l].header;
+  int preheader = IR_NONE;
+  for (int p = cfg->pred_start[header]; p < cfg->pred_start[header + 1];
+       p++) {
+    int pred = cfg->preds[p];
+    if (licm->mark[pred] == l) {
+      continue;
+    }
+    if (preheader != IR_NONE || fn->blocks[pred].succ[1] != IR_NONE) {
+      return IR_NONE;
+    }
+    preheader = pred;
+  }
+  return preheader;
+}
+
+// adds the missing preheaders right in front of their headers,
+// returns 1 if it added any
+static int licm_add_preheaders(Parser *parser, IrFunc *fn, Licm *licm) {
+  int num_blocks = fn->num_blocks;
+  for (int l = 0; l < licm->num_loops; l++) {
+    int header = licm->loops[l].header;
+    licm_mark_loop(licm, l);
+    // the entry block has to stay first
+    if (header == 0 || licm_preheader(fn, licm, l) != IR_NONE) {
+      continue;
+    }
+    int preheader = ir_add_block(parser, fn);
+    IrInst jump = {.op = IR_JUMP, .type = IR_VOID, .dst = IR_NONE,
+                   .a = IR_NONE, .b = IR_NONE, .slot = IR_NONE};
+    if (preheader == IR_NONE ||
+        ir_insert(parser, &fn->blocks[preheader], 0, jump) < 0) {
+      return -1;
+    }
+    fn->blocks[preheader].succ[0] = header;
+    fn->blocks[preheader].order = 2 * header;
+    Cfg *cfg = &licm->cfg;
+    for (int p = cfg->pred_start[header]; p < cfg->pred_start[header + 1];
+         p++) {
+      if (licm->mark[cfg->preds[p]] == l) {
+        continue;
+      }
+      IrBlock *pred = &fn->blocks[cfg->preds[p]];
+      for (int s = 0; s < 2; s++) {
+        if (pred->succ[s] == header) {
+          pred->succ[s] = preheader;
+        }
+      }
+    }
+  }
+  if (fn->num_blocks == num_blocks) {
+    return 0;
+  }
+  for (int b = 0; b < num_blocks; b++) {
+    fn->blocks[b].order = 2 * b + 1;
+  }
+  fn->num_started = 2 * num_blocks;
+  return ir_finish(parser, fn) < 0 ? -1 : 1;
+}
+
+// a single definition of v that comes before all uses
+static int licm_find_dominating_defs(Parser *parser, IrFunc *fn,
+                                     Licm *licm) {
+  Arena *arena = &parser->arena;
+  int num_values = fn->num_values;
+  int *def_block = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  int *def_index = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  if (!def_block || !def_index) {
+    fprintf(stderr, "couldn't allocate invariant code motion\n");
+    return -1;
+  }
+  for (int v = 0; v < num_values; v++) {
+    licm->dominates_uses[v] = licm->num_defs[v] == 1;
+  }
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      if (block->insts[i].dst != IR_NONE) {
+        def_block[block->insts[i].dst] = b;
+        def_index[block->insts[i].dst] = i;
+      }
+    }
+  }
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      int operands[2] = {block->insts[i].a, block->insts[i].b};
+      for (int o = 0; o < 2; o++) {
+        int v = operands[o];
+        if (v == IR_NONE || !licm->dominates_uses[v]) {
+          continue;
+        }
+        licm->dominates_uses[v] =
+            def_block[v] == b ? def_index[v] < i
+                              : cfg_dominates(&licm->cfg, def_block[v], b);
+      }
+    }
+  }
+  return 0;
+}
+
+// whether a load reads bytes that a store in the loop writes
+static bool licm_load_clobbered(IrFunc *fn, IrInst *load, IrInst **stores,
+                                int num_stores) {
+  int start = -fn->slots[load->slot].offset + (int)load->imm;
+  int end = start + load->width;
+  for (int s = 0; s < num_stores; s++) {
+    int store_start = -fn->slots[stores[s]->slot].offset + (int)stores[s]->imm;
+    if (store_start < end && start < store_start + stores[s]->width) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool licm_can_hoist(IrFunc *fn, Licm *licm, IrInst *inst,
+                           IrInst **stores, int num_stores) {
+  switch ((IrOp)inst->op) {
+  case IR_COPY:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_NEG:
+  case IR_LESS:
+  case IR_LESS_EQUAL:
+  case IR_GREATER:
+  case IR_GREATER_EQUAL:
+  case IR_EQUAL:
+    break;
+  case IR_DIV:
+  case IR_MOD:
+    // it may not run at all in the loop
+    if (!ir_is_const(fn, inst->b) || fn->consts[inst->b] == 0 ||
+        fn->consts[inst->b] == -1) {
+      return false;
+    }
+    break;
+  case IR_LOAD:
+    if (licm_load_clobbered(fn, inst, stores, num_stores)) {
+      return false;
+    }
+    break;
+  default:
+    return false;
+  }
+  if (inst->dst == IR_NONE || !licm->dominates_uses[inst->dst]) {
+    return false;
+  }
+  int operands[2] = {inst->a, inst->b};
+  for (int o = 0; o < 2; o++) {
+    int v = operands[o];
+    if (v != IR_NONE && !ir_is_const(fn, v) && licm->defs_in_loop[v] > 0 &&
+        !licm->invariant[v]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// moves the invariant instructions of loop l to its preheader
+static int licm_hoist_loop(Parser *parser, IrFunc *fn, Licm *licm, int l) {
+  Loop *loop = &licm->loops[l];
+  licm_mark_loop(licm, l);
+  int preheader = licm_preheader(fn, licm, l);
+  if (preheader == IR_NONE) {
+    return 0;
+  }
+
+  int num_insts = 0;
+  for (int i = 0; i < loop->num_blocks; i++) {
+    num_insts += fn->blocks[loop->blocks[i]].len;
+  }
+  IrInst **stores = arena_alloc(&parser->arena, sizeof(IrInst *) * num_insts);
+  IrInst *hoisted = arena_alloc(&parser->arena, sizeof(IrInst) * num_insts);
+  if (!stores || !hoisted) {
+    fprintf(stderr, "couldn't allocate invariant code motion\n");
+    return -1;
+  }
+  int num_stores = 0;
+  for (int i = 0; i < loop->num_blocks; i++) {
+    IrBlock *block = &fn->blocks[loop->blocks[i]];
+    for (int k = 0; k < block->len; k++) {
+      IrInst *inst = &block->insts[k];
+      if (inst->op == IR_STORE) {
+        stores[num_stores++] = inst;
+      }
+      if (inst->dst != IR_NONE) {
+        licm->defs_in_loop[inst->dst]++;
+      }
+    }
+  }
+
+  // in reverse postorder the operands mostly come first
+  int num_hoisted = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < loop->num_blocks; i++) {
+      IrBlock *block = &fn->blocks[loop->blocks[i]];
+      for (int k = 0; k < block->len; k++) {
+        IrInst *inst = &block->insts[k];
+        if (inst->dst == IR_NONE || licm->invariant[inst->dst] ||
+            !licm_can_hoist(fn, licm, inst, stores, num_stores)) {
+          continue;
+        }
+        licm->invariant[inst->dst] = true;
+        hoisted[num_hoisted++] = *inst;
+        changed = true;
+      }
+    }
+  }
+
+  for (int i = 0; i < loop->num_blocks; i++) {
+    IrBlock *block = &fn->blocks[loop->blocks[i]];
+    int len = 0;
+    for (int k = 0; k < block->len; k++) {
+      IrInst *inst = &block->insts[k];
+      if (inst->dst != IR_NONE) {
+        licm->defs_in_loop[inst->dst] = 0;
+        if (licm->invariant[inst->dst]) {
+          licm->invariant[inst->dst] = false;
+          continue;
+        }
+      }
+      block->insts[len++] = *inst;
+    }
+    block->len = len;
+  }
+
+  IrBlock *block = &fn->blocks[preheader];
+  for (int i = 0; i < num_hoisted; i++) {
+    if (ir_insert(parser, block, block->len - 1, hoisted[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ir_hoist_invariants(Parser *parser, IrFunc *fn) {
+  Arena *arena = &parser->arena;
+  Licm licm;
+  if (cfg_compute(parser, fn, &licm.cfg) < 0 ||
+      licm_find_loops(parser, fn, &licm) < 0) {
+    return -1;
+  }
+  if (licm.num_loops == 0) {
+    return 0;
+  }
+  int added = licm_add_preheaders(parser, fn, &licm);
+  if (added < 0) {
+    return -1;
+  }
+  if (added && (cfg_compute(parser, fn, &licm.cfg) < 0 ||
+                licm_find_loops(parser, fn, &licm) < 0)) {
+    return -1;
+  }
+
+  int num_values = fn->num_values;
+  licm.num_defs = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  licm.dominates_uses = arena_alloc(arena, sizeof(bool) * (num_values + 1));
+  licm.defs_in_loop = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  licm.invariant = arena_alloc(arena, sizeof(bool) * (num_values + 1));
+  if (!licm.num_defs || !licm.dominates_uses || !licm.defs_in_loop ||
+      !licm.invariant) {
+    fprintf(stderr, "couldn't allocate invariant code motion\n");
+    return -1;
+  }
+  memset(licm.num_defs, 0, sizeof(int) * num_values);
+  memset(licm.defs_in_loop, 0, sizeof(int) * num_values);
+  memset(licm.invariant, 0, sizeof(bool) * num_values);
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      if (block->insts[i].dst != IR_NONE) {
+        licm.num_defs[block->insts[i].dst]++;
+      }
+    }
+  }
+  if (licm_find_dominating_defs(parser, fn, &licm) < 0) {
+    return -1;
+  }
+
+  for (int l = 0; l < licm.num_loops; l++) {
+    if (licm_hoist_loop(parser, fn, &licm, l) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
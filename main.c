@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <string.h>
+#include <unistd.h>
 #include "compiler.h"
 
 int offset_align(int offset, int multiple) {
@@ -28,7 +29,73 @@ int main(int argc, char *argv[]) {
 
   int status = 0;
 
-  if (argc != 2) {
+  // -fast compiles in a single pass, see parser_compile_fast
+  bool fast = false;
+  // -j<n> type checks the function bodies on n threads,
+  // -j alone uses one thread per processor
+  int num_threads = 1;
+  // -reorder-structs places struct members by alignment,
+  // -struct-report prints what that saved
+  bool reorder_structs = false;
+  bool struct_report = false;
+  // -no-ir emits straight from the ast,
+  // -dump-ir prints the ir of every function
+  bool use_ir = true;
+  bool dump_ir = false;
+  // -no-peephole keeps the emitted code as it is,
+  // -peephole-stats prints how often every rule hit
+  bool peephole = true;
+  bool peephole_stats = false;
+  // -bench times the hash map and the dependency
+  // graph on large generated inputs and exits
+  bool bench = false;
+  char *input = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-fast") == 0) {
+      fast = true;
+    } else if (strcmp(argv[i], "-reorder-structs") == 0) {
+      reorder_structs = true;
+    } else if (strcmp(argv[i], "-struct-report") == 0) {
+      struct_report = true;
+    } else if (strcmp(argv[i], "-no-ir") == 0) {
+      use_ir = false;
+    } else if (strcmp(argv[i], "-dump-ir") == 0) {
+      dump_ir = true;
+    } else if (strcmp(argv[i], "-no-peephole") == 0) {
+      peephole = false;
+    } else if (strcmp(argv[i], "-peephole-stats") == 0) {
+      peephole_stats = true;
+    } else if (strcmp(argv[i], "-bench") == 0) {
+      bench = true;
+    } else if (strncmp(argv[i], "-j", 2) == 0) {
+      if (argv[i][2] == '\0') {
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+      } else {
+        num_threads = atoi(argv[i] + 2);
+      }
+      if (num_threads < 1) {
+        fprintf(stderr, "invalid number of threads %s\n", argv[i]);
+        exit(1);
+      }
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      exit(1);
+    } else if (input == NULL) {
+      input = argv[i];
+    } else {
+      input = NULL;
+      break;
+    }
+  }
+
+  if (bench) {
+    ptr_bucket_bench(4000);
+    ptr_bucket_bench(40000);
+    depgraph_bench(100000);
+    return 0;
+  }
+
+  if (input == NULL) {
     fprintf(stderr, "wrong number of arguments. need a c file as input\n");
     exit(1);
   }
@@ -42,11 +109,15 @@ int main(int argc, char *argv[]) {
 
   Parser parser;
   parser_init(&parser);
+  parser.num_threads = num_threads;
+  parser.reorder_structs = reorder_structs;
+  parser.use_ir = use_ir;
+  parser.peephole = peephole;
 
   String input_file_name    = {
-    .data = argv[1],
+    .data = input,
     .cap = 0,
-    .len = strlen(argv[1])
+    .len = strlen(input)
   };
 
   int    input_file_id      = filemanager_load_file(&files, &input_file_name);
@@ -54,7 +125,54 @@ int main(int argc, char *argv[]) {
   char   *filename = "myassembly.s";
   String out_file_name = {.data= filename, .cap = 0, .len=strlen(filename)};
 
+  if (fast) {
+    FILE *file = fopen(filename, "w");
+    if(!file){
+      fprintf(stderr, "couldnt open %s for writing\n", filename);
+      exit(2);
+    }
+    // the peephole pass needs all of the
+    // code, it is collected in memory first
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = peephole ? open_memstream(&text, &len) : NULL;
+    if (peephole && !out) {
+      fprintf(stderr, "couldn't buffer the assembly for the peephole pass\n");
+    }
+    if (parser_compile_fast(&parser, input_file_content, input_file_id,
+                            &files, out ? out : file) > 0) {
+      // drop what was emitted before the error
+      file = freopen(filename, "w", file);
+      if (!file) {
+        fprintf(stderr, "couldnt open %s for writing\n", filename);
+        exit(2);
+      }
+      fprintf(file, "encountered error previously\n");
+    } else if (out) {
+      fflush(out);
+      if (peephole_run(text, len, file, parser.peephole_hits) < 0) {
+        fwrite(text, 1, len, file);
+      }
+    }
+    if (out) {
+      fclose(out);
+      free(text);
+    }
+    fclose(file);
+    if (peephole_stats && peephole) {
+      peephole_print_stats(parser.peephole_hits, stderr);
+    }
+    filemanager_quit(&files);
+    return 0;
+  }
+
   parser_parse(&parser, input_file_content, input_file_id, &files);
+  if (struct_report && parser.num_errors == 0) {
+    parser_struct_report(&parser, stderr);
+  }
+  if (dump_ir) {
+    parser_dump_ir(&parser, stderr);
+  }
   parser_dump_assembly(&parser, stdout);
 
   FILE *file = fopen(filename, "w");
@@ -65,6 +183,9 @@ int main(int argc, char *argv[]) {
 
   parser_dump_assembly(&parser, file);
   fclose(file);
+  if (peephole_stats && peephole) {
+    peephole_print_stats(parser.peephole_hits, stderr);
+  }
   filemanager_quit(&files);
 
   StrSlice t = {.len = 3, .start = 20};
@@ -6,7 +6,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-void     astnode_free(AstNode *node);
 AstNode *parse_expr(Parser *parser);
 
 String parser_token_content(Parser *parser, Token tok);
@@ -24,30 +23,21 @@ int tok_is_maybe_type(Token tok) {
   }
 }
 
-int astnodelist_init(AstNodeList *list) {
+// the first entries of a list live right behind the node
+// that owns it, see astnode_list_new
+int astnodelist_init(AstNode *owner, AstNodeList *list) {
   list->len = 0;
-  list->cap = 10;
-  list->nodes = malloc(sizeof(AstNode) * list->cap);
-  if (list->nodes == NULL) {
-    fprintf(stderr, "couldnt initialize ast node list \n");
-    return -1;
-  }
+  list->cap = ASTNODELIST_INLINE;
+  list->nodes = (AstNode **)(owner + 1);
   return 1;
 }
 
-void astnodelist_free_nodes(AstNodeList *list) {
-  for (int i = 0; i < list->len; i++) {
-    astnode_free(list->nodes[i]);
-  }
-  list->nodes = NULL;
-  list->cap = 0;
-  list->len = 0;
-}
-
-int astnodelist_push(AstNodeList *list, AstNode *node) {
+int astnodelist_push(Parser *parser, AstNodeList *list, AstNode *node) {
   if (list->len >= list->cap) {
     int newcap = list->cap * 2;
-    AstNode **newdata = realloc(list->nodes, sizeof(AstNode *) * newcap);
+    AstNode **newdata =
+        arena_realloc(&parser->arena, list->nodes, sizeof(AstNode *) * list->cap,
+                      sizeof(AstNode *) * newcap);
     if (!newdata) {
       fprintf(stderr, "couldnt reallocated nodelist \n");
       return -1;
@@ -61,176 +51,149 @@ int astnodelist_push(AstNodeList *list, AstNode *node) {
   return 0;
 }
 
-AstNode *astnode_new() {
-  AstNode *node = malloc(sizeof(AstNode));
+AstNode *astnode_new(Parser *parser) {
+  AstNode *node = arena_alloc(&parser->arena, sizeof(AstNode));
+  node->kind = AST_ERROR;
+  node->flat = 0;
+  node->error.kind = ERR_UNINITIALIZED_NODE;
+  node->type = NULL;
+  return node;
+}
+
+// nodes with a list get room for its first
+// few entries in the same allocation
+AstNode *astnode_list_new(Parser *parser) {
+  AstNode *node = arena_alloc(&parser->arena, sizeof(AstNode) +
+                                                  sizeof(AstNode *) *
+                                                      ASTNODELIST_INLINE);
   node->kind = AST_ERROR;
+  node->flat = 0;
   node->error.kind = ERR_UNINITIALIZED_NODE;
   node->type = NULL;
   return node;
 }
 
-AstNode *astnode_structure_new() {
-  AstNode *node = malloc(sizeof(AstNode));
+AstNode *astnode_structure_new(Parser *parser) {
+  AstNode *node = astnode_list_new(parser);
   node->kind = AST_STRUCT;
+  node->flat = 0;
   node->type = NULL;
-  astnodelist_init(&node->structure.members);
+  astnodelist_init(node, &node->structure.members);
   node->structure.members_all_defined = false;
   node->structure.size = -1;
+  node->structure.declared_size = -1;
+  node->structure.layout = NULL;
+  node->structure.align = 0;
   return node;
 }
 
-void astnode_unexpected_token(AstNode *node, Token actual,
+// errors are recorded when they are created, so reporting them
+// doesn't need another pass over the tree. only the innermost
+// error of a chain is reported, with the invalid ast that
+// wraps it as the reason
+static int diagnostic_push(Parser *parser, AstNode *error) {
+  if (parser->num_diagnostics >= parser->diagnostics_cap) {
+    uint32_t newcap =
+        parser->diagnostics_cap ? parser->diagnostics_cap * 2 : 16;
+    ParseDiagnostic *diagnostics =
+        realloc(parser->diagnostics, sizeof(*diagnostics) * newcap);
+    if (!diagnostics) {
+      fprintf(stderr, "couldn't grow parse diagnostics\n");
+      return -1;
+    }
+    parser->diagnostics = diagnostics;
+    parser->diagnostics_cap = newcap;
+  }
+  ParseDiagnostic *diagnostic = &parser->diagnostics[parser->num_diagnostics];
+  diagnostic->error = error;
+  diagnostic->because = NULL;
+  error->error.diagnostic = parser->num_diagnostics++;
+  parser->num_errors++;
+  return 0;
+}
+
+// the node was reported and gets overwritten
+static bool diagnostic_recorded(AstNode *node) {
+  return node->kind == AST_ERROR && node->error.kind != ERR_UNINITIALIZED_NODE &&
+         node->error.diagnostic >= 0;
+}
+
+void astnode_unexpected_token(Parser *parser, AstNode *node, Token actual,
                               const char *triedToParse) {
+  bool recorded = diagnostic_recorded(node);
   node->kind = AST_ERROR;
   node->error.kind = ERR_UNEXPECTED_TOKEN;
   node->error.unexpectedToken.actual = actual;
   node->error.unexpectedToken.triedToParse = triedToParse;
+  if (recorded) {
+    parser->diagnostics[node->error.diagnostic].because = NULL;
+    return;
+  }
+  diagnostic_push(parser, node);
 }
 
-void astnode_invalid_ast(AstNode *node, AstNode *invalid,
+void astnode_invalid_ast(Parser *parser, AstNode *node, AstNode *invalid,
                          const char *description, Token context_token) {
+  if (diagnostic_recorded(node)) {
+    // the error is now only
+    // the reason for another one
+    parser->diagnostics[node->error.diagnostic].error = NULL;
+    parser->num_errors--;
+  }
   node->kind = AST_ERROR;
   node->error.kind = ERR_INVALID_AST;
+  node->error.diagnostic = -1;
   node->error.invalid.node = invalid;
   node->error.invalid.description = description;
   node->error.invalid.context_token = context_token;
-}
 
-void astnode_free(AstNode *node) {
-  if (node == NULL) {
+  // wrapping something valid, like a block
+  // without closing brace, ends the chain
+  if (invalid == NULL || invalid->kind != AST_ERROR) {
+    diagnostic_push(parser, node);
     return;
   }
-  switch (node->kind) {
-  case AST_FORLOOP: {
-    astnode_free(node->forloop.init);
-    astnode_free(node->forloop.condition);
-    astnode_free(node->forloop.step);
-    astnode_free(node->forloop.stmt);
-    free(node);
-    break;
-  }
-  case AST_BREAK: {
-    free(node);
-    break;
-  }
-  case AST_RETURN: {
-    astnode_free(node->ret.expr);
-    break;
-  }
-  case AST_IF_ELSE: {
-    astnode_free(node->ifelse.condition);
-    astnode_free(node->ifelse.elseblock);
-    astnode_free(node->ifelse.ifblock);
-    break;
-  }
-  case AST_FUNC_CALL: {
-    astnodelist_free_nodes(&node->funccall.params);
-    free(node);
-    break;
-  }
-  case AST_FUNC_DEF: {
-    astnode_free(node->func.prototype);
-    astnode_free(node->func.block);
-    free(node);
-    break;
-  }
-  case AST_FUNC_PROTO: {
-    astnodelist_free_nodes(&node->funcproto.params);
-    free(node);
-    break;
-  }
-  case AST_PROGRAM: {
-    astnodelist_free_nodes(&node->program.items);
-    free(node);
-    break;
-  }
-  case AST_BLOCK: {
-    astnodelist_free_nodes(&node->block);
-    free(node);
-    break;
-  }
-  case AST_LITERAL:
-    free(node);
-    break;
-  case AST_VAR: {
-    AstNode *member = node->var.member_access;
-    while(member ){
-      AstNode *next = member->member.next;
-      free(member);
-      member = next;
-    }
-    free(node);
-    break;
-  }
-  case AST_DECL:
-    astnode_free(node->decl.expr);
-    free(node);
-    break;
-  case AST_ERROR: {
-    switch (node->error.kind) {
-    case ERR_UNINITIALIZED_NODE:
-    case ERR_UNEXPECTED_TOKEN:
-      free(node);
-      break;
-    case ERR_INVALID_AST:
-      astnode_free(node->error.invalid.node);
-      free(node);
-      break;
+  if (diagnostic_recorded(invalid)) {
+    ParseDiagnostic *diagnostic = &parser->diagnostics[invalid->error.diagnostic];
+    if (diagnostic->because == NULL) {
+      diagnostic->because = node;
     }
-    break;
-  }
-  case AST_STRUCT:
-    astnodelist_free_nodes(&node->structure.members);
-    free(node);
-    break;
-  case AST_BINOP:
-    astnode_free(node->binop.left);
-    astnode_free(node->binop.right);
-    free(node);
-    break;
-  case AST_UNOP:
-    astnode_free(node->unop.expr);
-    free(node);
-    break;
-  case AST_MEMBER_ACCESS:
-    break;
   }
 }
 
 AstNode *parse_member_access(Parser *parser){
-  AstNode *last = astnode_new();
+  AstNode *last = astnode_new(parser);
   AstNode *node = last;
   AstNode *prev = NULL;
   Token tok = lex_peek(&parser->lexer);
   if(tok.kind != TOK_DOT){
-    astnode_unexpected_token(node, tok, " dot . for member access");
+    astnode_unexpected_token(parser, node, tok, " dot . for member access");
     return node;
   }
   while(tok.kind == TOK_DOT){
     Token identifier = lex_next(&parser->lexer);
     if(identifier.kind != TOK_IDENTIFIER){
-      astnode_unexpected_token(node, identifier, " identifier after dot for member access");
+      astnode_unexpected_token(parser, node, identifier, " identifier after dot for member access");
       return node;
     }
     last->kind = AST_MEMBER_ACCESS;
     last->member.name = identifier;
-    last->member.next = astnode_new();
+    last->member.next = astnode_new(parser);
     prev = last;
     last = last->member.next;
     tok = lex_next(&parser->lexer);
   }
   if(prev != NULL){
-    astnode_free(last);
     prev->member.next = NULL;
   }
   return node;
 }
 
 AstNode *parse_var(Parser *parser) {
-  AstNode *var = astnode_new();
+  AstNode *var = astnode_new(parser);
   Token identifier = lex_peek(&parser->lexer);
   if (identifier.kind != TOK_IDENTIFIER) {
-    astnode_unexpected_token(var, identifier,
+    astnode_unexpected_token(parser, var, identifier,
                              "expected identifier as variable name");
     return var;
   }
@@ -238,13 +201,15 @@ AstNode *parse_var(Parser *parser) {
   var->kind = AST_VAR;
   var->var.name = identifier;
   var->var.member_access = NULL;
+  var->var.offset = 0;
+  var->var.width = 0;
 
   AstNode *decl =
-      scope_get(&parser->scope, str_slice_to_uint64(identifier.string));
+      scope_get(&parser->scope, identifier.symbol);
 
   var->var.declaration = decl;
   if (decl == NULL) {
-    astnode_unexpected_token(var, identifier, "previously declared variable");
+    astnode_unexpected_token(parser, var, identifier, "previously declared variable");
     return var;
   }
 
@@ -258,12 +223,12 @@ AstNode *parse_var(Parser *parser) {
 }
 
 AstNode *parse_funccall(Parser *parser) {
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_list_new(parser);
   node->kind = AST_FUNC_CALL;
   Token tok = lex_peek(&parser->lexer);
 
   if (tok.kind != TOK_IDENTIFIER) {
-    astnode_unexpected_token(node, tok, "name of function call");
+    astnode_unexpected_token(parser, node, tok, "name of function call");
     return node;
   }
 
@@ -272,29 +237,29 @@ AstNode *parse_funccall(Parser *parser) {
   tok = lex_next(&parser->lexer);
 
   if (tok.kind != TOK_PAREN_OPEN) {
-    astnode_unexpected_token(node, tok,
+    astnode_unexpected_token(parser, node, tok,
                              "starting ( for function call arguments ");
     return node;
   }
 
   tok = lex_next(&parser->lexer);
 
-  astnodelist_init(&node->funccall.params);
+  astnodelist_init(node, &node->funccall.params);
 
   while (tok.kind != TOK_EOF && tok.kind != TOK_PAREN_CLOSE) {
 
     AstNode *expr = parse_expr(parser);
-    astnodelist_push(&node->funccall.params, expr);
+    astnodelist_push(parser, &node->funccall.params, expr);
 
     tok = lex_peek(&parser->lexer);
     if (tok.kind == TOK_COMMA) {
       tok = lex_next(&parser->lexer);
     } else if (tok.kind != TOK_PAREN_CLOSE) {
 
-      AstNode *unexpected = astnode_new();
-      astnode_unexpected_token(unexpected, tok,
+      AstNode *unexpected = astnode_new(parser);
+      astnode_unexpected_token(parser, unexpected, tok,
                                "comma , in function argument list");
-      astnodelist_push(&node->funccall.params, unexpected);
+      astnodelist_push(parser, &node->funccall.params, unexpected);
       while (tok.kind != TOK_SEMICOLON && tok.kind != TOK_EOF &&
              tok.kind != TOK_PAREN_CLOSE) {
         tok = lex_next(&parser->lexer);
@@ -308,9 +273,11 @@ AstNode *parse_funccall(Parser *parser) {
   return node;
 }
 
-AstNode *parse_factor(Parser *parser) {
+// literals, variables and function calls, prefix
+// operators and parens are handled by parse_expr
+AstNode *parse_primary(Parser *parser) {
   Token tok = lex_peek(&parser->lexer);
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_new(parser);
   switch (tok.kind) {
 
   case TOK_LITERAL_INT:
@@ -319,13 +286,6 @@ AstNode *parse_factor(Parser *parser) {
     lex_next(&parser->lexer);
     break;
 
-  case TOK_MUL:
-    node->kind = AST_UNOP;
-    node->unop.op = tok;
-    lex_next(&parser->lexer);
-    node->unop.expr = parse_factor(parser);
-    break;
-
   case TOK_IDENTIFIER: {
 
     Token ahead = lex_peekn(&parser->lexer, 1);
@@ -335,131 +295,252 @@ AstNode *parse_factor(Parser *parser) {
 
     AstNode *var = parse_var(parser);
     if (var->kind != AST_ERROR) {
-      free(node);
       return var;
     }
-    astnode_invalid_ast(node, var,
+    astnode_invalid_ast(parser, node, var,
                         "tried to parse variable as primary expression", tok);
     return node;
   } break;
 
-  case TOK_SINGLE_AMPERSAND: {
+  default:
+    astnode_unexpected_token(parser, node, tok, "factor");
     lex_next(&parser->lexer);
-    AstNode *expr = parse_factor(parser);
-    if (expr->kind == AST_ERROR) {
-      astnode_invalid_ast(
-          node, expr, "tried to parse expression after unary operator & ", tok);
-      return node;
-    }
-    node->kind = AST_UNOP;
-    node->unop.expr = expr;
-    node->unop.op = tok;
     break;
   }
-  case TOK_MINUS: {
-    lex_next(&parser->lexer);
-    AstNode *expr = parse_factor(parser);
-    if (expr->kind == AST_ERROR) {
-      astnode_invalid_ast(
-          node, expr, "after unary operator - is something unexpected", tok);
-      return node;
-    }
-    node->kind = AST_UNOP;
-    node->unop.expr = expr;
-    node->unop.op = tok;
-    break;
+  return node;
+}
+
+typedef enum { ASSOC_NONE, ASSOC_LEFT, ASSOC_RIGHT } Associativity;
+
+typedef struct BinaryOp {
+  uint8_t precedence;
+  uint8_t assoc;
+} BinaryOp;
+
+#define GENERATE_BINARY_OP(TOK, PRECEDENCE, ASSOC)                             \
+  [TOK] = {.precedence = PRECEDENCE, .assoc = ASSOC},
+
+// tokens that are no binary operator have precedence 0
+static const BinaryOp binary_ops[TOK_EOF + 1] = {
+    FOREACH_BINARY_OP(GENERATE_BINARY_OP)};
+
+int op_precedence(Token tok) { return binary_ops[tok.kind].precedence; }
+
+int exprstack_init(ExprStack *stack) {
+  stack->num_ops = 0;
+  stack->ops_cap = 64;
+  stack->num_operands = 0;
+  stack->operands_cap = 64;
+  stack->ops = malloc(sizeof(*stack->ops) * stack->ops_cap);
+  stack->operands = malloc(sizeof(*stack->operands) * stack->operands_cap);
+  if (!stack->ops || !stack->operands) {
+    free(stack->ops);
+    free(stack->operands);
+    stack->ops = NULL;
+    stack->operands = NULL;
+    return -1;
   }
-  case TOK_PAREN_OPEN: {
-    lex_next(&parser->lexer);
-    AstNode *expr = parse_expr(parser);
-    if (expr->kind == AST_ERROR) {
-      astnode_invalid_ast(node, expr,
-                          "tried to parse expression inside parens (...)", tok);
-      return node;
-    }
+  return 0;
+}
 
-    tok = lex_peek(&parser->lexer);
-    if (tok.kind != TOK_PAREN_CLOSE) {
-      astnode_unexpected_token(node, tok, "closing paren ) of expression");
-      return node;
+void exprstack_quit(ExprStack *stack) {
+  free(stack->ops);
+  free(stack->operands);
+  stack->ops = NULL;
+  stack->operands = NULL;
+  stack->num_ops = 0;
+  stack->num_operands = 0;
+}
+
+int exprstack_push_op(ExprStack *stack, Token op, ExprOpKind kind) {
+  if (stack->num_ops >= stack->ops_cap) {
+    uint32_t newcap = stack->ops_cap * 2;
+    ExprOp *ops = realloc(stack->ops, sizeof(*ops) * newcap);
+    if (!ops) {
+      fprintf(stderr, "couldn't grow expression operator stack\n");
+      return -1;
     }
-    lex_next(&parser->lexer);
-    free(node);
-    return expr;
+    stack->ops = ops;
+    stack->ops_cap = newcap;
   }
-  default:
-    astnode_unexpected_token(node, tok, "factor");
-    lex_next(&parser->lexer);
-    break;
+  stack->ops[stack->num_ops].op = op;
+  stack->ops[stack->num_ops].kind = kind;
+  stack->num_ops++;
+  return 0;
+}
+
+int exprstack_push_operand(ExprStack *stack, AstNode *operand) {
+  if (stack->num_operands >= stack->operands_cap) {
+    uint32_t newcap = stack->operands_cap * 2;
+    AstNode **operands = realloc(stack->operands, sizeof(*operands) * newcap);
+    if (!operands) {
+      fprintf(stderr, "couldn't grow expression operand stack\n");
+      return -1;
+    }
+    stack->operands = operands;
+    stack->operands_cap = newcap;
   }
-  return node;
+  stack->operands[stack->num_operands++] = operand;
+  return 0;
 }
 
-int op_precedence(Token tok) {
-  switch (tok.kind) {
+// applies the operator on top to its operands,
+// the result replaces them on the operand stack
+void exprstack_reduce(Parser *parser, ExprStack *stack) {
+  ExprOp op = stack->ops[--stack->num_ops];
+  AstNode *node = astnode_new(parser);
 
-  case TOK_LOGICAL_EQUAL:
-  case TOK_LOGICAL_LESS:
-  case TOK_LOGICAL_GREATER_EQUAL:
-  case TOK_LOGICAL_LESS_EQUAL:
-  case TOK_LOGICAL_GREATER:
-    return 2;
-
-  case TOK_MUL:
-    return 10;
-  case TOK_DIV:
-    return 10;
-  case TOK_PLUS:
-    return 5;
-  case TOK_MINUS:
-    return 5;
-  case TOK_ASSIGN:
-    return 1;
-  default:
-    return 0;
+  if (op.kind == EXPR_OP_UNARY) {
+    node->kind = AST_UNOP;
+    node->unop.op = op.op;
+    node->unop.expr = stack->operands[stack->num_operands - 1];
+    stack->operands[stack->num_operands - 1] = node;
+    return;
   }
+
+  assert(op.kind == EXPR_OP_BINARY);
+  node->kind = AST_BINOP;
+  node->binop.op = op.op;
+  node->binop.right = stack->operands[--stack->num_operands];
+  node->binop.left = stack->operands[stack->num_operands - 1];
+  stack->operands[stack->num_operands - 1] = node;
 }
 
-AstNode *parse_expr_1(Parser *parser, AstNode *left, int min_precedence) {
-  Token lookahead = lex_peek(&parser->lexer);
+// describes what the failed operand belonged to,
+// which is the operator waiting for it
+AstNode *exprstack_error(Parser *parser, ExprStack *stack, uint32_t op_base,
+                         uint32_t operand_base, AstNode *error) {
+  AstNode *node = error;
+  if (stack->num_ops > op_base) {
+    ExprOp top = stack->ops[stack->num_ops - 1];
+    const char *description = "I expected a primary expression";
+    if (top.kind == EXPR_OP_PAREN) {
+      description = "tried to parse expression inside parens (...)";
+    } else if (top.kind == EXPR_OP_UNARY && top.op.kind == TOK_MINUS) {
+      description = "after unary operator - is something unexpected";
+    } else if (top.kind == EXPR_OP_UNARY && top.op.kind == TOK_MUL) {
+      description = "tried to parse expression after unary operator * ";
+    } else if (top.kind == EXPR_OP_UNARY) {
+      description = "tried to parse expression after unary operator & ";
+    }
+    // the left operand is lost anyway
+    if (top.kind == EXPR_OP_BINARY) {
+      node = stack->operands[stack->num_operands - 1];
+    } else {
+      node = astnode_new(parser);
+    }
+    astnode_invalid_ast(parser, node, error, description, top.op);
+  }
+  stack->num_ops = op_base;
+  stack->num_operands = operand_base;
+  return node;
+}
 
-  while (op_precedence(lookahead) >= min_precedence) {
-    Token op = lookahead;
-    lex_next(&parser->lexer);
+// operator precedence parsing with explicit stacks,
+// so neither long chains nor deep parens recurse.
+// only the arguments of function calls start a
+// nested expression (on top of the same stacks)
+AstNode *parse_expr(Parser *parser) {
+  ExprStack *stack = &parser->expr_stack;
+  uint32_t op_base = stack->num_ops;
+  uint32_t operand_base = stack->num_operands;
+  int parens = 0;
+
+  while (1) {
+    // prefix operators and parens wait for their operand
+    Token tok = lex_peek(&parser->lexer);
+    while (tok.kind == TOK_PAREN_OPEN || tok.kind == TOK_MUL ||
+           tok.kind == TOK_MINUS || tok.kind == TOK_SINGLE_AMPERSAND) {
+      ExprOpKind kind = EXPR_OP_UNARY;
+      if (tok.kind == TOK_PAREN_OPEN) {
+        kind = EXPR_OP_PAREN;
+        parens++;
+      }
+      if (exprstack_push_op(stack, tok, kind) < 0) {
+        AstNode *node = astnode_new(parser);
+        astnode_unexpected_token(parser, node, tok, "a smaller expression");
+        return exprstack_error(parser, stack, op_base, operand_base, node);
+      }
+      tok = lex_next(&parser->lexer);
+    }
 
-    AstNode *right = parse_factor(parser);
-    if (right->kind == AST_ERROR) {
-      astnode_invalid_ast(left, right, "I expected a primary expression", op);
-      return left;
+    AstNode *operand = parse_primary(parser);
+    if (operand->kind == AST_ERROR &&
+        (stack->num_ops > op_base || stack->num_operands > operand_base)) {
+      return exprstack_error(parser, stack, op_base, operand_base, operand);
+    }
+    // a broken first operand still gets its operators parsed,
+    // statements like int *p; report the undeclared p
+    if (exprstack_push_operand(stack, operand) < 0) {
+      AstNode *node = astnode_new(parser);
+      astnode_unexpected_token(parser, node, tok, "a smaller expression");
+      return exprstack_error(parser, stack, op_base, operand_base, node);
     }
 
-    lookahead = lex_peek(&parser->lexer);
+    // the operand is complete, so are the prefix
+    // operators in front of it and closed parens
+    while (1) {
+      while (stack->num_ops > op_base &&
+             stack->ops[stack->num_ops - 1].kind == EXPR_OP_UNARY) {
+        exprstack_reduce(parser, stack);
+      }
+      tok = lex_peek(&parser->lexer);
+      if (tok.kind != TOK_PAREN_CLOSE || parens == 0) {
+        break;
+      }
+      while (stack->ops[stack->num_ops - 1].kind != EXPR_OP_PAREN) {
+        exprstack_reduce(parser, stack);
+      }
+      stack->num_ops--;
+      parens--;
+      tok = lex_next(&parser->lexer);
+    }
 
-    while (op_precedence(lookahead) > op_precedence(op)) {
-      right = parse_expr_1(parser, right, op_precedence(op) + 1);
+    BinaryOp op = binary_ops[tok.kind];
+    if (op.precedence == 0) {
+      break;
+    }
 
-      if (right->kind == AST_ERROR) {
-        astnode_invalid_ast(left, right, "wanted any right expression",
-                            lookahead);
-        return left;
+    while (stack->num_ops > op_base) {
+      ExprOp top = stack->ops[stack->num_ops - 1];
+      if (top.kind != EXPR_OP_BINARY) {
+        break;
+      }
+      int top_precedence = binary_ops[top.op.kind].precedence;
+      if (top_precedence < op.precedence ||
+          (top_precedence == op.precedence && op.assoc == ASSOC_RIGHT)) {
+        break;
       }
+      exprstack_reduce(parser, stack);
+    }
 
-      lookahead = lex_peek(&parser->lexer);
+    if (exprstack_push_op(stack, tok, EXPR_OP_BINARY) < 0) {
+      AstNode *node = astnode_new(parser);
+      astnode_unexpected_token(parser, node, tok, "a smaller expression");
+      return exprstack_error(parser, stack, op_base, operand_base, node);
     }
+    lex_next(&parser->lexer);
+  }
 
-    AstNode *binop = astnode_new();
-    binop->kind = AST_BINOP;
-    binop->binop.left = left;
-    binop->binop.right = right;
-    binop->binop.op = op;
-    left = binop;
+  if (parens > 0) {
+    // the error belongs to whatever
+    // waited for the unclosed paren
+    Token tok = lex_peek(&parser->lexer);
+    AstNode *node = astnode_new(parser);
+    astnode_unexpected_token(parser, node, tok, "closing paren ) of expression");
+    while (stack->ops[stack->num_ops - 1].kind != EXPR_OP_PAREN) {
+      stack->num_ops--;
+    }
+    stack->num_ops--;
+    return exprstack_error(parser, stack, op_base, operand_base, node);
   }
-  return left;
-}
 
-AstNode *parse_expr(Parser *parser) {
-  AstNode *expr = parse_factor(parser);
-  return parse_expr_1(parser, expr, 1);
+  while (stack->num_ops > op_base) {
+    exprstack_reduce(parser, stack);
+  }
+  AstNode *expr = stack->operands[operand_base];
+  stack->num_operands = operand_base;
+  return expr;
 }
 
 int size_of_type(Parser *parser, Token kind) {
@@ -469,8 +550,7 @@ int size_of_type(Parser *parser, Token kind) {
   } else if (kind.kind == TOK_KEYWORD_CHAR) {
     size = 1;
   } else if (kind.kind == TOK_IDENTIFIER) {
-    uint64_t key = str_slice_to_uint64(kind.string);
-    AstNode *def = ptr_bucket_get(&parser->struct_definitions, key);
+    AstNode *def = symbolmap_get(&parser->struct_definitions, kind.symbol);
     if (def != NULL) {
       assert(def->kind == AST_STRUCT);
       size = def->structure.size;
@@ -481,17 +561,98 @@ int size_of_type(Parser *parser, Token kind) {
 
 int push_decl_to_scope(Parser *parser, AstNode *decl) {
   assert(decl->kind == AST_DECL);
-  uint64_t key = str_slice_to_uint64(decl->decl.name.string);
-  return scope_put(&parser->scope, key, decl);
+  return scope_put(&parser->scope, decl->decl.name.symbol, decl);
+}
+
+int tok_is_alignment(Token tok) {
+  return tok.kind == TOK_KEYWORD_ALIGNAS || tok.kind == TOK_KEYWORD_ATTRIBUTE;
+}
+
+static bool expect_token(Parser *parser, AstNode *node, TokenKind kind,
+                         const char *what) {
+  Token tok = lex_peek(&parser->lexer);
+  if (tok.kind != kind) {
+    astnode_unexpected_token(parser, node, tok, what);
+    return false;
+  }
+  lex_next(&parser->lexer);
+  return true;
+}
+
+// _Alignas(N) or __attribute__((aligned(N))), any number of
+// them. returns the largest N, 0 if there was none or -1
+// after an error that is recorded on node
+int parse_alignment(Parser *parser, AstNode *node) {
+  int align = 0;
+  Token tok = lex_peek(&parser->lexer);
+  while (tok_is_alignment(tok)) {
+    bool attribute = tok.kind == TOK_KEYWORD_ATTRIBUTE;
+    lex_next(&parser->lexer);
+
+    if (!expect_token(parser, node, TOK_PAREN_OPEN, "( after alignment")) {
+      return -1;
+    }
+    if (attribute) {
+      if (!expect_token(parser, node, TOK_PAREN_OPEN, "(( of attribute")) {
+        return -1;
+      }
+      tok = lex_peek(&parser->lexer);
+      String name = parser_token_content(parser, tok);
+      if (tok.kind != TOK_IDENTIFIER || name.len != 7 ||
+          strncmp(name.data, "aligned", 7) != 0) {
+        astnode_unexpected_token(parser, node, tok,
+                                 "aligned, the only supported attribute");
+        return -1;
+      }
+      lex_next(&parser->lexer);
+      if (!expect_token(parser, node, TOK_PAREN_OPEN, "( after aligned")) {
+        return -1;
+      }
+    }
+
+    tok = lex_peek(&parser->lexer);
+    String literal = parser_token_content(parser, tok);
+    int value = 0;
+    for (uint32_t i = 0; i < literal.len && value <= 4096; i++) {
+      value = value * 10 + (literal.data[i] - '0');
+    }
+    if (tok.kind != TOK_LITERAL_INT || value <= 0 || value > 4096 ||
+        (value & (value - 1)) != 0) {
+      astnode_unexpected_token(parser, node, tok,
+                               "alignment that is a power of two up to 4096");
+      return -1;
+    }
+    lex_next(&parser->lexer);
+
+    if (!expect_token(parser, node, TOK_PAREN_CLOSE, ") after alignment") ||
+        (attribute &&
+         (!expect_token(parser, node, TOK_PAREN_CLOSE, ") after aligned") ||
+          !expect_token(parser, node, TOK_PAREN_CLOSE, ")) of attribute")))) {
+      return -1;
+    }
+
+    if (value > align) {
+      align = value;
+    }
+    tok = lex_peek(&parser->lexer);
+  }
+
+  if (align > parser->max_align) {
+    parser->max_align = align;
+  }
+  return align;
 }
 
 AstNode *parse_decl(Parser *parser, int parseSemicolon) {
+  AstNode *node = astnode_new(parser);
+  int align = parse_alignment(parser, node);
+  if (align < 0) {
+    return node;
+  }
   Token tok = lex_peek(&parser->lexer);
-  AstNode *node = astnode_new();
 
   if (!tok_is_maybe_type(tok)) {
-    astnode_unexpected_token(
-        node, tok,
+    astnode_unexpected_token(parser, node, tok,
         "variable declaration (starting with name of type like int or char)");
     return node;
   }
@@ -507,7 +668,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
   }
 
   if (tok.kind != TOK_IDENTIFIER) {
-    astnode_unexpected_token(node, tok, "variable name for declaration");
+    astnode_unexpected_token(parser, node, tok, "variable name for declaration");
     lex_next(&parser->lexer);
     return node;
   }
@@ -515,6 +676,16 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
   Token name = tok;
 
   tok = lex_next(&parser->lexer);
+  if (tok_is_alignment(tok)) {
+    int after = parse_alignment(parser, node);
+    if (after < 0) {
+      return node;
+    }
+    if (after > align) {
+      align = after;
+    }
+    tok = lex_peek(&parser->lexer);
+  }
 
   if (parseSemicolon && tok.kind == TOK_SEMICOLON) {
     lex_next(&parser->lexer);
@@ -522,6 +693,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
     node->decl.kind = kind;
     node->decl.name = name;
     node->decl.num_pointers = num_pointers;
+    node->decl.align = align;
     node->decl.size = size_of_type(parser, kind);
     if (num_pointers > 0) {
       node->decl.size = 8;
@@ -540,6 +712,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
     node->decl.expr = NULL;
     node->decl.size = size_of_type(parser, kind);
     node->decl.num_pointers = num_pointers;
+    node->decl.align = align;
     if (num_pointers > 0) {
       node->decl.size = 8;
     }
@@ -549,7 +722,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
   }
 
   if (tok.kind != TOK_ASSIGN) {
-    astnode_unexpected_token(node, tok,
+    astnode_unexpected_token(parser, node, tok,
                              "assignment (=) after declaration name ");
     return node;
   }
@@ -558,7 +731,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
 
   AstNode *expr = parse_expr(parser);
   if (expr->kind == AST_ERROR) {
-    astnode_invalid_ast(node, expr, "expression after = seems to be invalid",
+    astnode_invalid_ast(parser, node, expr, "expression after = seems to be invalid",
                         tok);
     return node;
   }
@@ -567,7 +740,7 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
 
   if (parseSemicolon) {
     if (tok.kind != TOK_SEMICOLON) {
-      astnode_unexpected_token(node, tok,
+      astnode_unexpected_token(parser, node, tok,
                                "semicolon ; of declaration statement");
       tok = lex_next(&parser->lexer);
       return node;
@@ -581,8 +754,8 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
   node->decl.name = name;
   node->decl.expr = expr;
   node->decl.num_pointers = num_pointers;
+  node->decl.align = align;
   node->decl.size = size_of_type(parser, kind);
-  node->decl.assembly_base_offset = 0;
   if (num_pointers > 0) {
     node->decl.size = 8;
   }
@@ -594,10 +767,10 @@ AstNode *parse_decl(Parser *parser, int parseSemicolon) {
 AstNode *parse_stmt_block(Parser *parser);
 
 AstNode *parse_return(Parser *parser) {
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_new(parser);
   Token tok = lex_peek(&parser->lexer);
   if (tok.kind != TOK_KEYWORD_RETURN) {
-    astnode_unexpected_token(node, tok, "return keyword");
+    astnode_unexpected_token(parser, node, tok, "return keyword");
     return node;
   }
   tok = lex_next(&parser->lexer);
@@ -611,13 +784,13 @@ AstNode *parse_return(Parser *parser) {
 
   AstNode *expr = parse_expr(parser);
   if (expr->kind == AST_ERROR) {
-    astnode_invalid_ast(node, expr, "expected expression after return", tok);
+    astnode_invalid_ast(parser, node, expr, "expected expression after return", tok);
     return node;
   }
 
   tok = lex_peek(&parser->lexer);
   if (tok.kind != TOK_SEMICOLON) {
-    astnode_unexpected_token(node, tok, "semicolon after return stmt");
+    astnode_unexpected_token(parser, node, tok, "semicolon after return stmt");
     return node;
   }
   lex_next(&parser->lexer);
@@ -639,16 +812,15 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
     }
   }
 
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_new(parser);
   Token ahead = lex_peekn(&parser->lexer, 1);
 
   if (tok.kind == TOK_KEYWORD_RETURN) {
     AstNode *ret = parse_return(parser);
     if (ret->kind == AST_ERROR) {
-      astnode_invalid_ast(node, ret, "expected statement", tok);
+      astnode_invalid_ast(parser, node, ret, "expected statement", tok);
       return node;
     }
-    free(node);
     return ret;
   }
 
@@ -657,7 +829,7 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
     tok = lex_next(&parser->lexer);
     if (consumeSemicolon) {
       if (tok.kind != TOK_SEMICOLON) {
-        astnode_unexpected_token(node, tok, "semicolon ; after break");
+        astnode_unexpected_token(parser, node, tok, "semicolon ; after break");
         return node;
       }
       lex_next(&parser->lexer);
@@ -668,25 +840,27 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
   if (tok.kind == TOK_KEYWORD_IF) {
     AstNode *ifelse = parse_ifelse(parser);
     if (ifelse->kind == AST_ERROR) {
-      astnode_invalid_ast(node, ifelse, "expected if statement", tok);
+      astnode_invalid_ast(parser, node, ifelse, "expected if statement", tok);
       return node;
     }
-    free(node);
     return ifelse;
   }
 
   if (tok.kind == TOK_KEYWORD_FOR) {
+    // declarations in the loop header
+    // are only visible inside the loop
+    int scope_mark = scope_enter(&parser->scope);
     AstNode *fornode = parse_for(parser);
+    scope_leave(&parser->scope, scope_mark);
     if (fornode->kind == AST_ERROR) {
-      astnode_invalid_ast(node, fornode, "expected for loop", tok);
+      astnode_invalid_ast(parser, node, fornode, "expected for loop", tok);
       return node;
     }
-    free(node);
     return fornode;
   }
 
   if (tok.kind == TOK_MUL) {
-    astnode_unexpected_token(node, tok,
+    astnode_unexpected_token(parser, node, tok,
                              "dereferenced assignment but "
                              "its not supported yet");
     return node;
@@ -696,24 +870,23 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
   if (tok.kind == TOK_BRACE_OPEN) {
     AstNode *block = parse_stmt_block(parser);
     if (block->kind == AST_ERROR) {
-      astnode_invalid_ast(node, block, "expected statement block because of {",
+      astnode_invalid_ast(parser, node, block, "expected statement block because of {",
                           tok);
       return node;
     }
-    free(node);
     return block;
   }
 
   // declaration
-  if ((tok.kind == TOK_IDENTIFIER || tok.kind == TOK_KEYWORD_CHAR ||
-       tok.kind == TOK_KEYWORD_INT) &&
-      ahead.kind == TOK_IDENTIFIER) {
+  if (((tok.kind == TOK_IDENTIFIER || tok.kind == TOK_KEYWORD_CHAR ||
+        tok.kind == TOK_KEYWORD_INT) &&
+       ahead.kind == TOK_IDENTIFIER) ||
+      tok_is_alignment(tok)) {
     AstNode *decl = parse_decl(parser, consumeSemicolon);
     if (decl->kind == AST_ERROR) {
-      astnode_invalid_ast(node, decl, "expected variable declaration", tok);
+      astnode_invalid_ast(parser, node, decl, "expected variable declaration", tok);
       return node;
     }
-    free(node);
     return decl;
   }
 
@@ -722,7 +895,7 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
 
   /*   AstNode *var = parse_var(parser); */
   /*   if (var->kind == AST_ERROR) { */
-  /*     astnode_invalid_ast(node, var, "expected varable in assignment statement", */
+  /*     astnode_invalid_ast(parser, node, var, "expected varable in assignment statement", */
   /*                         tok); */
   /*     return node; */
   /*   } */
@@ -733,7 +906,7 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
   /*   if (consumeSemicolon) { */
   /*     Token semicolon = lex_peek(&parser->lexer); */
   /*     if (semicolon.kind != TOK_SEMICOLON) { */
-  /*       astnode_unexpected_token(node, semicolon, "semicolon of statement"); */
+  /*       astnode_unexpected_token(parser, node, semicolon, "semicolon of statement"); */
   /*       lex_next(&parser->lexer); */
   /*       return node; */
   /*     } */
@@ -749,7 +922,7 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
   // expression
   AstNode *expr = parse_expr(parser);
   if (expr->kind == AST_ERROR) {
-    astnode_invalid_ast(node, expr, "expected an expression statement", tok);
+    astnode_invalid_ast(parser, node, expr, "expected an expression statement", tok);
     lex_next(&parser->lexer);
     return node;
   }
@@ -757,29 +930,28 @@ AstNode *parse_stmt(Parser *parser, int consumeSemicolon) {
   if (consumeSemicolon) {
     Token semicolon = lex_peek(&parser->lexer);
     if (semicolon.kind != TOK_SEMICOLON) {
-      astnode_unexpected_token(node, semicolon, "semicolon of statement");
+      astnode_unexpected_token(parser, node, semicolon, "semicolon of statement");
       return node;
     }
   }
 
   lex_next(&parser->lexer);
-  free(node);
   return expr;
 }
 
 AstNode *parse_ifelse(Parser *parser) {
   Token tok = lex_peek(&parser->lexer);
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_new(parser);
 
   if (tok.kind != TOK_KEYWORD_IF) {
-    astnode_unexpected_token(node, tok, "if keyword");
+    astnode_unexpected_token(parser, node, tok, "if keyword");
     return node;
   }
 
   tok = lex_next(&parser->lexer);
 
   if (tok.kind != TOK_PAREN_OPEN) {
-    astnode_unexpected_token(node, tok, "open paren ( after if keyword");
+    astnode_unexpected_token(parser, node, tok, "open paren ( after if keyword");
     return node;
   }
 
@@ -787,7 +959,7 @@ AstNode *parse_ifelse(Parser *parser) {
 
   AstNode *condition = parse_expr(parser);
   if (condition->kind == AST_ERROR) {
-    astnode_invalid_ast(node, condition,
+    astnode_invalid_ast(parser, node, condition,
                         "expected expression as condition for if branch", tok);
     return node;
   }
@@ -795,8 +967,7 @@ AstNode *parse_ifelse(Parser *parser) {
   tok = lex_peek(&parser->lexer);
 
   if (tok.kind != TOK_PAREN_CLOSE) {
-    astnode_unexpected_token(node, tok, "close paren ) after if expression");
-    astnode_free(condition);
+    astnode_unexpected_token(parser, node, tok, "close paren ) after if expression");
     return node;
   }
 
@@ -804,9 +975,8 @@ AstNode *parse_ifelse(Parser *parser) {
 
   AstNode *stmt = parse_stmt(parser, 1);
   if (stmt->kind == AST_ERROR) {
-    astnode_invalid_ast(node, stmt, "expected valid compound statement for if",
+    astnode_invalid_ast(parser, node, stmt, "expected valid compound statement for if",
                         tok);
-    astnode_free(condition);
     return node;
   }
 
@@ -824,9 +994,7 @@ AstNode *parse_ifelse(Parser *parser) {
 
   AstNode *elsestmt = parse_stmt(parser, 1);
   if (elsestmt->kind == AST_ERROR) {
-    astnode_invalid_ast(node, elsestmt, "expected correct else statement", tok);
-    astnode_free(condition);
-    astnode_free(stmt);
+    astnode_invalid_ast(parser, node, elsestmt, "expected correct else statement", tok);
     return node;
   }
 
@@ -839,17 +1007,17 @@ AstNode *parse_ifelse(Parser *parser) {
 
 AstNode *parse_for(Parser *parser) {
   Token tok = lex_peek(&parser->lexer);
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_new(parser);
 
   if (tok.kind != TOK_KEYWORD_FOR) {
-    astnode_unexpected_token(node, tok, "for keyword");
+    astnode_unexpected_token(parser, node, tok, "for keyword");
     return node;
   }
 
   tok = lex_next(&parser->lexer);
 
   if (tok.kind != TOK_PAREN_OPEN) {
-    astnode_unexpected_token(node, tok, "open paren ( after for");
+    astnode_unexpected_token(parser, node, tok, "open paren ( after for");
     return node;
   }
 
@@ -859,7 +1027,7 @@ AstNode *parse_for(Parser *parser) {
   if (tok.kind != TOK_SEMICOLON) {
     init = parse_stmt(parser, 1);
     if (init->kind == AST_ERROR) {
-      astnode_invalid_ast(node, init, "expected initial statement in for loop",
+      astnode_invalid_ast(parser, node, init, "expected initial statement in for loop",
                           tok);
       return node;
     }
@@ -873,17 +1041,14 @@ AstNode *parse_for(Parser *parser) {
   if (tok.kind != TOK_SEMICOLON) {
     condition = parse_expr(parser);
     if (condition->kind == AST_ERROR) {
-      astnode_free(init);
-      astnode_invalid_ast(node, condition, "expected condition in for loop",
+      astnode_invalid_ast(parser, node, condition, "expected condition in for loop",
                           tok);
     }
 
     tok = lex_peek(&parser->lexer);
 
     if (tok.kind != TOK_SEMICOLON) {
-      astnode_free(init);
-      astnode_free(condition);
-      astnode_unexpected_token(node, tok,
+      astnode_unexpected_token(parser, node, tok,
                                "second semicolon ; for loop condition");
       return node;
     }
@@ -900,9 +1065,7 @@ AstNode *parse_for(Parser *parser) {
   if (tok.kind != TOK_PAREN_CLOSE) {
     step = parse_stmt(parser, 0);
     if (step->kind == AST_ERROR) {
-      astnode_free(init);
-      astnode_free(condition);
-      astnode_invalid_ast(node, step, "expected step in for loop", tok);
+      astnode_invalid_ast(parser, node, step, "expected step in for loop", tok);
       return node;
     }
   }
@@ -910,10 +1073,7 @@ AstNode *parse_for(Parser *parser) {
   tok = lex_peek(&parser->lexer);
 
   if (tok.kind != TOK_PAREN_CLOSE) {
-    astnode_free(init);
-    astnode_free(condition);
-    astnode_free(step);
-    astnode_unexpected_token(node, tok, " closing paren ) in for loop");
+    astnode_unexpected_token(parser, node, tok, " closing paren ) in for loop");
     return node;
   }
   lex_next(&parser->lexer);
@@ -930,25 +1090,25 @@ AstNode *parse_for(Parser *parser) {
 }
 
 AstNode *parse_func_proto(Parser *parser) {
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_list_new(parser);
   Token rettype = lex_peek(&parser->lexer);
   if (rettype.kind != TOK_IDENTIFIER && rettype.kind != TOK_KEYWORD_INT &&
       rettype.kind != TOK_KEYWORD_CHAR) {
-    astnode_unexpected_token(node, rettype, "return type for function ");
+    astnode_unexpected_token(parser, node, rettype, "return type for function ");
     lex_next(&parser->lexer);
     return node;
   }
 
   Token funcname = lex_next(&parser->lexer);
   if (funcname.kind != TOK_IDENTIFIER) {
-    astnode_unexpected_token(node, rettype, "identifier as function name");
+    astnode_unexpected_token(parser, node, rettype, "identifier as function name");
     lex_next(&parser->lexer);
     return node;
   }
 
   Token openParen = lex_next(&parser->lexer);
   if (openParen.kind != TOK_PAREN_OPEN) {
-    astnode_unexpected_token(node, openParen,
+    astnode_unexpected_token(parser, node, openParen,
                              "( open paren for function parameter list");
     lex_next(&parser->lexer);
     return node;
@@ -957,29 +1117,28 @@ AstNode *parse_func_proto(Parser *parser) {
   node->funcproto.name = funcname;
   node->funcproto.retType = rettype;
 
-  astnodelist_init(&node->funcproto.params);
+  astnodelist_init(node, &node->funcproto.params);
 
   Token tok = lex_next(&parser->lexer);
   while (tok.kind != TOK_EOF && tok.kind != TOK_PAREN_CLOSE) {
     AstNode *decl = parse_decl(parser, 0);
     tok = lex_peek(&parser->lexer);
     if (tok.kind == TOK_COMMA) {
-      astnodelist_push(&node->funcproto.params, decl);
+      astnodelist_push(parser, &node->funcproto.params, decl);
       tok = lex_next(&parser->lexer);
       continue;
     } else if (tok.kind == TOK_PAREN_CLOSE) {
-      astnodelist_push(&node->funcproto.params, decl);
+      astnodelist_push(parser, &node->funcproto.params, decl);
       break;
     } else {
-      astnodelist_free_nodes(&node->funcproto.params);
-      astnode_unexpected_token(node, tok,
+      astnode_unexpected_token(parser, node, tok,
                                ", or ) after function parameter list");
       return node;
     }
   }
   if (tok.kind != TOK_PAREN_CLOSE) {
-    AstNode *err = astnode_new();
-    astnode_invalid_ast(err, node,
+    AstNode *err = astnode_new(parser);
+    astnode_invalid_ast(parser, err, node,
                         "expected closing paren ) "
                         "for function parameter list",
                         tok);
@@ -990,27 +1149,25 @@ AstNode *parse_func_proto(Parser *parser) {
 }
 
 AstNode *parse_stmt_block(Parser *parser) {
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_list_new(parser);
   node->kind = AST_BLOCK;
 
   Token brace_open_tok = lex_peek(&parser->lexer);
   if (brace_open_tok.kind != TOK_BRACE_OPEN) {
-    astnode_unexpected_token(node, brace_open_tok,
+    astnode_unexpected_token(parser, node, brace_open_tok,
                              "open brace { for statement block");
     return node;
   }
 
   Token tok = lex_next(&parser->lexer);
 
-  Scope newscope;
-  scope_init(&newscope);
-  newscope.parent = &parser->scope;
+  int scope_mark = scope_enter(&parser->scope);
 
-  astnodelist_init(&node->block);
+  astnodelist_init(node, &node->block);
 
   while (tok.kind != TOK_BRACE_CLOSE && tok.kind != TOK_EOF) {
     AstNode *stmt = parse_stmt(parser, 1);
-    astnodelist_push(&node->block, stmt);
+    astnodelist_push(parser, &node->block, stmt);
 
     if (stmt->kind == AST_ERROR) {
       while (tok.kind != TOK_SEMICOLON && tok.kind != TOK_EOF) {
@@ -1022,11 +1179,11 @@ AstNode *parse_stmt_block(Parser *parser) {
     tok = lex_peek(&parser->lexer);
   }
 
-  scope_quit(&newscope);
+  scope_leave(&parser->scope, scope_mark);
 
   if (tok.kind != TOK_BRACE_CLOSE) {
-    AstNode *errnode = astnode_new();
-    astnode_invalid_ast(errnode, node,
+    AstNode *errnode = astnode_new(parser);
+    astnode_invalid_ast(parser, errnode, node,
                         "expected corresponding closing brace } of "
                         "statement block",
                         brace_open_tok);
@@ -1036,19 +1193,152 @@ AstNode *parse_stmt_block(Parser *parser) {
   return node;
 }
 
+int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// places struct members in declaration order or with reorder
+// by descending alignment, which needs the least padding.
+// offsets[i] is where sizes[i] goes or -1 from the first member
+// without a known size on. returns the size of the struct, a
+// multiple of align, or -1
+int place_struct_members(Parser *parser, const int *sizes, const int *aligns,
+                         int len, bool reorder, int align, int *offsets) {
+  ArenaMark mark = arena_mark(&parser->arena);
+
+  // member index in the low half, more
+  // aligned members sort first by the high half
+  uint64_t *order = arena_alloc(&parser->arena, sizeof(uint64_t) * (len + 1));
+  for (int i = 0; i < len; i++) {
+    uint64_t key = 0;
+    if (reorder) {
+      key = aligns[i] > 0 ? (uint64_t)(INT32_MAX - aligns[i]) : UINT32_MAX;
+    }
+    order[i] = key << 32 | (uint32_t)i;
+  }
+  if (reorder) {
+    qsort(order, len, sizeof(*order), compare_u64);
+  }
+
+  int size = 0;
+  for (int i = 0; i < len; i++) {
+    int member = (uint32_t)order[i];
+    if (size < 0 || sizes[member] <= 0 || aligns[member] <= 0) {
+      size = -1;
+    } else {
+      size = offset_align(size, aligns[member]);
+    }
+    if (offsets) {
+      offsets[member] = size;
+    }
+    if (size >= 0) {
+      size += sizes[member];
+    }
+  }
+  arena_reset(&parser->arena, mark);
+
+  if (size < 0) {
+    return -1;
+  }
+  return offset_align(size, align);
+}
+
+// alignment asked for by the struct type of a declaration
+static int decl_struct_align(Parser *parser, AstNode *decl) {
+  if (decl->decl.num_pointers > 0 || decl->decl.kind.kind != TOK_IDENTIFIER) {
+    return 0;
+  }
+  AstNode *def =
+      symbolmap_get(&parser->struct_definitions, decl->decl.kind.symbol);
+  return def ? def->structure.align : 0;
+}
+
+// members are aligned to their size unless an
+// alignment was asked for. that one is raised to
+// what the type of the member needs at least
+int member_align(Parser *parser, AstNode *decl) {
+  if (decl->decl.align == 0) {
+    return decl->decl.size;
+  }
+  int least = 8;
+  if (decl->decl.num_pointers == 0) {
+    switch (decl->decl.kind.kind) {
+    case TOK_KEYWORD_CHAR: least = 1; break;
+    case TOK_KEYWORD_INT: least = 4; break;
+    default:
+      least = decl_struct_align(parser, decl);
+      least = least > 4 ? least : 4;
+      break;
+    }
+  }
+  return decl->decl.align > least ? decl->decl.align : least;
+}
+
+// the size a struct has in declaration order, members
+// that are structs count with their declared size too
+static int member_declared_size(Parser *parser, AstNode *decl) {
+  if (decl->decl.num_pointers == 0 && decl->decl.kind.kind == TOK_IDENTIFIER) {
+    AstNode *def = symbolmap_get(&parser->struct_definitions,
+                                 decl->decl.kind.symbol);
+    return def ? def->structure.declared_size : -1;
+  }
+  return decl->decl.size;
+}
+
+// sets the size of a struct whose members all have a size.
+// the struct is as aligned as the most aligned member
+// that asked for it, sizes are a multiple of 4 otherwise
+static void struct_set_size(Parser *parser, AstNode *def) {
+  AstNodeList *members = &def->structure.members;
+  ArenaMark mark = arena_mark(&parser->arena);
+  int *sizes = arena_alloc(&parser->arena, sizeof(int) * (members->len + 1));
+  int *aligns = arena_alloc(&parser->arena, sizeof(int) * (members->len + 1));
+
+  int align = def->structure.align;
+  for (int i = 0; i < members->len; i++) {
+    AstNode *decl = members->nodes[i];
+    sizes[i] = decl->decl.size;
+    aligns[i] = member_align(parser, decl);
+    int asked = decl->decl.align ? aligns[i] : decl_struct_align(parser, decl);
+    if (asked > align) {
+      align = asked;
+    }
+  }
+  def->structure.align = align;
+  if (align < 4) {
+    align = 4;
+  }
+
+  def->structure.size = place_struct_members(
+      parser, sizes, aligns, members->len, parser->reorder_structs, align, NULL);
+
+  def->structure.declared_size = def->structure.size;
+  if (parser->reorder_structs) {
+    for (int i = 0; i < members->len; i++) {
+      sizes[i] = member_declared_size(parser, members->nodes[i]);
+      if (members->nodes[i]->decl.align == 0) {
+        aligns[i] = sizes[i];
+      }
+    }
+    def->structure.declared_size = place_struct_members(
+        parser, sizes, aligns, members->len, false, align, NULL);
+  }
+  arena_reset(&parser->arena, mark);
+}
+
 void parse_struct_decl_stmts(Parser *parser, AstNode *structure) {
   AstNode *stmt = NULL;
   static const char *token_names[] = {FOREACH_TOKENKIND(GENERATE_STRING)};
 
   Token tok = lex_peek(&parser->lexer);
 
-  int size = 0;
   bool hasErrors = false;
 
   bool all_members_defined = true;
 
-  uint64_t struct_name_key =
-      str_slice_to_uint64(structure->structure.name.string);
+  SymbolId struct_name_key = structure->structure.name.symbol;
 
   while (tok.kind != TOK_EOF && tok.kind != TOK_BRACE_CLOSE) {
 
@@ -1077,42 +1367,43 @@ void parse_struct_decl_stmts(Parser *parser, AstNode *structure) {
     }
 
     if (size_of_member < 0) {
-      uint64_t key = str_slice_to_uint64(stmt->decl.kind.string);
-      IntTuple dependency = {.first = struct_name_key, .second = key};
+      IntTuple dependency = {.first = struct_name_key,
+                             .second = stmt->decl.kind.symbol};
       depgraph_add(&parser->struct_dependencies, dependency);
       all_members_defined = false;
-    } else {
-      size = offset_align(size, size_of_member);
-      size += size_of_member;
     }
 
-    astnodelist_push(&structure->structure.members, stmt);
+    astnodelist_push(parser, &structure->structure.members, stmt);
   }
 
-  size = offset_align(size, 4);
-
+  // the size is set once the alignment
+  // after the closing brace is known
   if (all_members_defined) {
     structure->structure.members_all_defined = true;
-    structure->structure.size = size;
     IntTuple dependency = {.first = struct_name_key, .second = 0};
     depgraph_add(&parser->struct_dependencies, dependency);
   }
 }
 
 AstNode *parse_struct(Parser *parser) {
-  AstNode *node = astnode_structure_new();
+  AstNode *node = astnode_structure_new(parser);
   Token tok = lex_peek(&parser->lexer);
   node->kind = AST_STRUCT;
 
   if (tok.kind != TOK_KEYWORD_STRUCT) {
-    astnode_unexpected_token(node, tok, "struct");
+    astnode_unexpected_token(parser, node, tok, "struct");
     return node;
   }
 
-  tok = lex_next(&parser->lexer);
+  lex_next(&parser->lexer);
+  int align = parse_alignment(parser, node);
+  if (align < 0) {
+    return node;
+  }
+  tok = lex_peek(&parser->lexer);
 
   if (tok.kind != TOK_IDENTIFIER) {
-    astnode_unexpected_token(node, tok, "name of struct");
+    astnode_unexpected_token(parser, node, tok, "name of struct");
     return node;
   }
 
@@ -1121,40 +1412,55 @@ AstNode *parse_struct(Parser *parser) {
   tok = lex_next(&parser->lexer);
 
   if (tok.kind != TOK_BRACE_OPEN) {
-    astnode_unexpected_token(node, tok, "brace open { of struct ");
+    astnode_unexpected_token(parser, node, tok, "brace open { of struct ");
     return node;
   }
 
   tok = lex_next(&parser->lexer);
 
+  // members are declarations too, but they
+  // must not be visible as variables afterwards
+  int scope_mark = scope_enter(&parser->scope);
   parse_struct_decl_stmts(parser, node);
+  scope_leave(&parser->scope, scope_mark);
 
   if (node->kind == AST_ERROR) {
-    astnode_invalid_ast(node, node, "expected struct member variables", tok);
+    astnode_invalid_ast(parser, node, node, "expected struct member variables", tok);
     return node;
   }
 
   tok = lex_peek(&parser->lexer);
   if (tok.kind != TOK_BRACE_CLOSE) {
-    astnode_unexpected_token(node, tok, " close brace } of struct ");
+    astnode_unexpected_token(parser, node, tok, " close brace } of struct ");
   }
 
-  tok = lex_next(&parser->lexer);
+  lex_next(&parser->lexer);
+  int after = parse_alignment(parser, node);
+  if (after < 0) {
+    return node;
+  }
+  if (node->kind == AST_STRUCT) {
+    node->structure.align = after > align ? after : align;
+    if (node->structure.members_all_defined) {
+      struct_set_size(parser, node);
+    }
+  }
 
+  tok = lex_peek(&parser->lexer);
   if (tok.kind == TOK_SEMICOLON) {
     lex_next(&parser->lexer);
   }
 
-  uint64_t structkey = str_slice_to_uint64(node->structure.name.string);
+  SymbolId structkey = node->structure.name.symbol;
 
-  AstNode *previousdef = ptr_bucket_get(&parser->struct_definitions, structkey);
+  AstNode *previousdef = symbolmap_get(&parser->struct_definitions, structkey);
 
   if (previousdef != NULL) {
     fprintf(stderr, "previous struct def\n");
     astnode_print(parser, stderr, previousdef, 0);
   }
 
-  ptr_bucket_put(&parser->struct_definitions, structkey, node);
+  symbolmap_put(&parser->struct_definitions, structkey, node);
 
   return node;
 }
@@ -1177,6 +1483,10 @@ AstNode *parse_any(Parser *parser) {
     return parse_struct(parser);
   }
 
+  if (tok_is_alignment(first)) {
+    return parse_decl(parser, 1);
+  }
+
   if (tok_is_maybe_type(first)) {
 
     // parse function
@@ -1184,9 +1494,8 @@ AstNode *parse_any(Parser *parser) {
         (third.kind == TOK_PAREN_OPEN || fourth.kind == TOK_PAREN_OPEN)) {
 
 
-      Scope newscope;
-      scope_init(&newscope);
-      newscope.parent = &parser->scope;
+      // parameters are only visible inside the function
+      int scope_mark = scope_enter(&parser->scope);
 
       AstNode *proto = parse_func_proto(parser);
       if (proto->kind == AST_ERROR) {
@@ -1201,15 +1510,16 @@ AstNode *parse_any(Parser *parser) {
 
       Token tok = lex_peek(&parser->lexer);
       if (tok.kind != TOK_BRACE_OPEN) {
+        scope_leave(&parser->scope, scope_mark);
         return proto;
       }
 
-      AstNode *function = astnode_new();
+      AstNode *function = astnode_new(parser);
       function->kind = AST_FUNC_DEF;
       function->func.prototype = proto;
       function->func.block = parse_stmt_block(parser);
-      scope_quit(&newscope);
-      ptr_bucket_put(&parser->function_definitions, str_slice_to_uint64(proto->funcproto.name.string), function);
+      scope_leave(&parser->scope, scope_mark);
+      symbolmap_put(&parser->function_definitions, proto->funcproto.name.symbol, function);
 
       return function;
     }
@@ -1217,8 +1527,8 @@ AstNode *parse_any(Parser *parser) {
     return parse_decl(parser, 1);
   }
 
-  AstNode *node = astnode_new();
-  astnode_unexpected_token(node, first, "didn't know what to parse here");
+  AstNode *node = astnode_new(parser);
+  astnode_unexpected_token(parser, node, first, "didn't know what to parse here");
 
   first = lex_next(&parser->lexer);
   while (first.kind != TOK_SEMICOLON && first.kind != TOK_PAREN_CLOSE &&
@@ -1230,21 +1540,52 @@ AstNode *parse_any(Parser *parser) {
 
 AstNode *parse_program(Parser *parser) {
   Token tok = lex_peek(&parser->lexer);
-  AstNode *node = astnode_new();
+  AstNode *node = astnode_list_new(parser);
   node->kind = AST_PROGRAM;
-  astnodelist_init(&node->program.items);
+  astnodelist_init(node, &node->program.items);
   while (tok.kind != TOK_EOF) {
     AstNode *item = parse_any(parser);
-    astnodelist_push(&node->program.items, item);
+    astnodelist_push(parser, &node->program.items, item);
     tok = lex_peek(&parser->lexer);
   }
   return node;
 }
 
-void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
+typedef struct PrintWalk {
+  Parser *parser;
+  FILE *file;
+} PrintWalk;
+
+bool astnode_print_pre(AstWalk *walk, AstWalkFrame *frame) {
+  PrintWalk *print = walk->data;
+  Parser *parser = print->parser;
+  FILE *file = print->file;
+  AstNode *node = frame->node;
+
+  // children of lists are indented further
+  AstWalkFrame *parent = astwalk_parent(walk);
+  if (parent) {
+    switch (parent->node->kind) {
+    case AST_FUNC_CALL:
+    case AST_PROGRAM:
+    case AST_FUNC_PROTO:
+    case AST_STRUCT:
+    case AST_BLOCK:
+    case AST_DECL:
+      frame->value = parent->value + 4;
+      break;
+    default:
+      frame->value = parent->value + 2;
+      break;
+    }
+  }
+  int indent = frame->value;
+
   if (node == NULL) {
-    fprintf(file, "%*snull\n", indent, "");
-    return;
+    if (!parent || parent->node->kind != AST_DECL) {
+      fprintf(file, "%*snull\n", indent, "");
+    }
+    return false;
   }
 
   static const char *token_names[] = {FOREACH_TOKENKIND(GENERATE_STRING)};
@@ -1255,41 +1596,24 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
     break;
   case AST_IF_ELSE:
     fprintf(file, "%*sif\n", indent, "");
-    astnode_print(parser, file, node->ifelse.condition, indent + 2);
-    astnode_print(parser, file, node->ifelse.ifblock, indent + 2);
-    astnode_print(parser, file, node->ifelse.elseblock, indent + 2);
     break;
   case AST_FORLOOP:
     fprintf(file, "%*sfor\n", indent, "");
-    astnode_print(parser, file, node->forloop.init, indent + 2);
-    astnode_print(parser, file, node->forloop.condition, indent + 2);
-    astnode_print(parser, file, node->forloop.step, indent + 2);
-    astnode_print(parser, file, node->forloop.stmt, indent + 2);
     break;
   case AST_RETURN: {
     fprintf(file, "%*sreturn \n", indent, "");
-    astnode_print(parser, file, node->ret.expr, indent + 2);
     break;
   }
   case AST_FUNC_CALL: {
     String func_name = parser_token_content(parser, node->funccall.name);
     fprintf(file, "%*scall %.*s \n", indent, "", func_name.len, func_name.data);
-
-    for (int i = 0; i < node->funccall.params.len; i++) {
-      astnode_print(parser, file, node->funccall.params.nodes[i], indent + 4);
-    }
     break;
   }
   case AST_PROGRAM:
     fprintf(file, "%*sprogram \n", indent, "");
-    for (int i = 0; i < node->program.items.len; i++) {
-      astnode_print(parser, file, node->program.items.nodes[i], indent + 4);
-    }
     break;
   case AST_FUNC_DEF:
     fprintf(file, "%*sfunc \n", indent, "");
-    astnode_print(parser, file, node->func.prototype, indent + 2);
-    astnode_print(parser, file, node->func.block, indent + 2);
     break;
   case AST_FUNC_PROTO: {
     String func_proto = parser_token_content(parser, node->funcproto.name);
@@ -1297,9 +1621,6 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
     fprintf(file, "%*sfuncproto %.*s\n", indent, "", func_proto.len,
             func_proto.data);
     fprintf(file, "%*srettype %.*s\n", indent + 2, "", ret.len, ret.data);
-    for (int i = 0; i < node->funcproto.params.len; i++) {
-      astnode_print(parser, file, node->funcproto.params.nodes[i], indent + 4);
-    }
     break;
   }
   case AST_STRUCT: {
@@ -1308,18 +1629,12 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
             structure.data, node->structure.size);
 
     fprintf(file, "%*sdecl members \n", indent + 2, "");
-    for (int i = 0; i < node->structure.members.len; i++) {
-      astnode_print(parser, file, node->structure.members.nodes[i], indent + 4);
-    }
     break;
   }
 
   case AST_BLOCK: {
     fprintf(file, "%*sblock \n", indent, "");
     fprintf(file, "%*sstatements \n", indent + 2, "");
-    for (int i = 0; i < node->block.len; i++) {
-      astnode_print(parser, file, node->block.nodes[i], indent + 4);
-    }
     break;
   }
   case AST_LITERAL: {
@@ -1342,16 +1657,12 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
     fprintf(file, "%*sdecl \n", indent, "");
     fprintf(file, "%*sname: %.*s numpointers: %d size:%d \n", indent + 2, "",
             decl.len, decl.data, node->decl.num_pointers, node->decl.size);
-    if (node->decl.expr != NULL) {
-      astnode_print(parser, file, node->decl.expr, indent + 4);
-    }
     break;
   }
 
   case AST_MEMBER_ACCESS: {
     String var = parser_token_content(parser, node->member.name);
     fprintf(file, "%*smember %.*s \n", indent, "", var.len, var.data);
-    astnode_print(parser, file, node->member.next, indent+2);
     break;
   }
 
@@ -1359,8 +1670,6 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
     String var = parser_token_content(parser, node->var.name);
     fprintf(file, "%*svar %.*s \n", indent, "", var.len, var.data);
 
-    astnode_print(parser, file, node->var.member_access, indent+2);
-
     /* AstNode *member = node->var.member_access; */
     /* while(member && member->kind == AST_MEMBER_ACCESS){ */
     /*   String str = parser_token_content(parser, member->member.name); */
@@ -1376,15 +1685,12 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
   case AST_BINOP: {
     String binop = parser_token_content(parser, node->binop.op);
     fprintf(file, "%*sBinOp %.*s \n", indent, "", binop.len, binop.data);
-    astnode_print(parser, file, node->binop.left, indent + 2);
-    astnode_print(parser, file, node->binop.right, indent + 2);
     break;
   }
 
   case AST_UNOP: {
     String unop = parser_token_content(parser, node->unop.op);
     fprintf(file, "%*sUnOp %.*s \n", indent, "", unop.len, unop.data);
-    astnode_print(parser, file, node->unop.expr, indent + 2);
     break;
   }
 
@@ -1421,7 +1727,6 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
               token_names[node->error.invalid.context_token.kind]);
       fprintf(file, "%*sdescription: %s \n", indent + 2, "",
               node->error.invalid.description);
-      astnode_print(parser, file, node->error.invalid.node, indent + 2);
       break;
     }
     default:
@@ -1432,6 +1737,15 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
   default:
     fprintf(file, "%*sastnode print not yet implemented\n", indent, "");
   }
+  return true;
+}
+
+// types are printed below the children
+void astnode_print_post(AstWalk *walk, AstWalkFrame *frame) {
+  PrintWalk *print = walk->data;
+  FILE *file = print->file;
+  AstNode *node = frame->node;
+  int indent = frame->value;
 
   const char *type_names[] = {FOREACH_TYPE_KIND(GENERATE_STRING)};
   if (node->type != NULL) {
@@ -1444,9 +1758,37 @@ void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
   }
 }
 
+void astnode_print(Parser *parser, FILE *file, AstNode *node, int indent) {
+  PrintWalk print = {.parser = parser, .file = file};
+  AstWalk walk;
+  astwalk_init(&walk, astnode_print_pre, NULL, astnode_print_post, &print);
+  walk.visit_null = true;
+  astwalk_run(&walk, node, indent);
+  astwalk_quit(&walk);
+}
+
 int parser_init(Parser *parser) {
   parser->root = NULL;
   int status = 0;
+  status = arena_init(&parser->arena);
+  if (status < 0) {
+    fprintf(stderr, "couldn't initialize ast arena \n");
+    return -1;
+  }
+  parser->diagnostics = NULL;
+  parser->num_diagnostics = 0;
+  parser->diagnostics_cap = 0;
+  parser->num_errors = 0;
+  status = exprstack_init(&parser->expr_stack);
+  if (status < 0) {
+    fprintf(stderr, "couldn't initialize expression stack \n");
+    return -1;
+  }
+  status = flatast_init(&parser->flat);
+  if (status < 0) {
+    fprintf(stderr, "couldn't initialize flat expressions \n");
+    return -1;
+  }
   status = lex_init(&parser->lexer);
   if (status < 0) {
     fprintf(stderr, "couldn't initialize lexer \n");
@@ -1457,16 +1799,24 @@ int parser_init(Parser *parser) {
     fprintf(stderr, "couldn't initialize string interner \n");
     return -1;
   }
-  status = ptr_bucket_init(&parser->struct_definitions, 2);
+  status = ptr_bucket_init(&parser->types, 64);
   if (status < 0) {
-    fprintf(stderr, "couldn't initialize struct definition bucket \n");
+    fprintf(stderr, "couldn't initialize type table \n");
     return -1;
   }
-  status = ptr_bucket_init(&parser->function_definitions, 2);
-  if (status < 0) {
-    fprintf(stderr, "couldn't initialize function definition bucket \n");
+  parser->num_types = 0;
+  if (pthread_mutex_init(&parser->types_lock, NULL) != 0) {
+    fprintf(stderr, "couldn't initialize type table lock \n");
     return -1;
   }
+  parser->num_threads = 1;
+  parser->reorder_structs = false;
+  parser->use_ir = true;
+  parser->peephole = true;
+  memset(parser->peephole_hits, 0, sizeof(parser->peephole_hits));
+  parser->max_align = 0;
+  symbolmap_init(&parser->struct_definitions);
+  symbolmap_init(&parser->function_definitions);
   status = depgraph_init(&parser->struct_dependencies);
   if (status < 0) {
     fprintf(stderr, "couldn't initialize struct dependency graph\n");
@@ -1487,34 +1837,147 @@ int parser_init(Parser *parser) {
 
 
 void parser_quit(Parser *parser) {
-  if (parser->root != NULL) {
-    astnode_free(parser->root);
-    free(parser->root);
-  }
   scope_quit(&parser->scope);
   depgraph_quit(&parser->struct_dependencies);
-  ptr_bucket_quit(&parser->struct_definitions);
-  ptr_bucket_quit(&parser->function_definitions);
+  symbolmap_quit(&parser->struct_definitions);
+  symbolmap_quit(&parser->function_definitions);
   str_interner_quit(&parser->pool);
   lex_quit(&parser->lexer);
   vartable_quit(&parser->assembly_variables);
+  flatast_quit(&parser->flat);
+  exprstack_quit(&parser->expr_stack);
+  free(parser->diagnostics);
+  parser->diagnostics = NULL;
+  parser->num_diagnostics = 0;
+  ptr_bucket_quit(&parser->types);
+  pthread_mutex_destroy(&parser->types_lock);
+  arena_quit(&parser->arena);
+  parser->root = NULL;
 }
 
-int parser_resolve_missing_structs(Parser *parser) {
+Type *decl_to_type(Parser *parser, AstNode *node);
+
+// members are placed like the struct size is computed
+StructLayout *struct_layout_of(Parser *parser, AstNode *def) {
+  assert(def->kind == AST_STRUCT);
+  if (def->structure.layout) {
+    return def->structure.layout;
+  }
+
+  AstNodeList *members = &def->structure.members;
+  uint32_t num_slots = 4;
+  while (num_slots < (uint32_t)members->len * 2) {
+    num_slots *= 2;
+  }
+
+  StructLayout *layout = arena_alloc(&parser->arena, sizeof(StructLayout));
+  layout->members =
+      arena_alloc(&parser->arena, sizeof(StructMember) * (members->len + 1));
+  layout->slots = arena_alloc(&parser->arena, sizeof(uint32_t) * num_slots);
+  memset(layout->slots, 0, sizeof(uint32_t) * num_slots);
+  layout->mask = num_slots - 1;
+  layout->num_members = 0;
+
+  int *offsets = arena_alloc(&parser->arena, sizeof(int) * (members->len + 1));
+  ArenaMark mark = arena_mark(&parser->arena);
+  int *sizes = arena_alloc(&parser->arena, sizeof(int) * (members->len + 1));
+  int *aligns = arena_alloc(&parser->arena, sizeof(int) * (members->len + 1));
+  for (int i = 0; i < members->len; i++) {
+    AstNode *decl = members->nodes[i];
+    sizes[i] = decl->kind == AST_DECL ? decl->decl.size : -1;
+    aligns[i] = decl->kind == AST_DECL ? member_align(parser, decl) : -1;
+  }
+  place_struct_members(parser, sizes, aligns, members->len,
+                       parser->reorder_structs, 4, offsets);
+  arena_reset(&parser->arena, mark);
+
+  for (int i = 0; i < members->len; i++) {
+    AstNode *decl = members->nodes[i];
+    if (decl->kind != AST_DECL) {
+      continue;
+    }
 
-  depgraph_prepare(&parser->struct_dependencies);
-  //depgraph_print(&parser->struct_dependencies);
+    // the first member with a name wins
+    SymbolId name = decl->decl.name.symbol;
+    uint32_t slot = (name * 2654435761u) & layout->mask;
+    while (layout->slots[slot] &&
+           layout->members[layout->slots[slot] - 1].name != name) {
+      slot = (slot + 1) & layout->mask;
+    }
+    if (!layout->slots[slot]) {
+      StructMember *member = &layout->members[layout->num_members++];
+      member->name = name;
+      member->offset = offsets[i];
+      member->size = decl->decl.size;
+      member->align = member_align(parser, decl);
+      member->decl = decl;
+      // resolved here so the type checking of
+      // function bodies only reads the layout
+      member->type = decl_to_type(parser, decl);
+      layout->slots[slot] = layout->num_members;
+    }
+  }
 
-  uint64_t to_resolve = depgraph_resolve(&parser->struct_dependencies);
+  def->structure.layout = layout;
+  return layout;
+}
 
-  AstNode *circular_decl;
+StructMember *struct_layout_find(StructLayout *layout, SymbolId name) {
+  uint32_t slot = (name * 2654435761u) & layout->mask;
+  while (layout->slots[slot]) {
+    StructMember *member = &layout->members[layout->slots[slot] - 1];
+    if (member->name == name) {
+      return member;
+    }
+    slot = (slot + 1) & layout->mask;
+  }
+  return NULL;
+}
 
-  while (to_resolve != DEPGRAPH_EMPTY) {
-    StrSlice slice = str_slice_from_uint64(to_resolve);
-    String str = str_interner_get(&parser->pool, slice);
+// every member of a struct in a cycle
+// that has a type of the same cycle
+void report_struct_cycle(Parser *parser, int cycle) {
+  DepGraph *graph = &parser->struct_dependencies;
+  fprintf(stderr, "circular dependency between structs:");
+  for (uint32_t i = graph->cycles_start[cycle];
+       i < graph->cycles_start[cycle + 1]; i++) {
+    String name = str_interner_symbol(&parser->pool, graph->cycles[i]);
+    fprintf(stderr, " %.*s", name.len, name.data);
+  }
+  fprintf(stderr, "\n");
+
+  for (uint32_t i = graph->cycles_start[cycle];
+       i < graph->cycles_start[cycle + 1]; i++) {
+    AstNode *def = symbolmap_get(&parser->struct_definitions, graph->cycles[i]);
+    assert(def->kind == AST_STRUCT);
+    String name = str_interner_symbol(&parser->pool, graph->cycles[i]);
+    for (int m = 0; m < def->structure.members.len; m++) {
+      AstNode *member = def->structure.members.nodes[m];
+      if (member->kind != AST_DECL || member->decl.num_pointers > 0 ||
+          depgraph_cycle_of(graph, member->decl.kind.symbol) != cycle) {
+        continue;
+      }
+      String member_name = parser_token_content(parser, member->decl.name);
+      String member_type = parser_token_content(parser, member->decl.kind);
+      fprintf(stderr, "  %.*s.%.*s (%d:%d) contains %.*s\n", name.len,
+              name.data, member_name.len, member_name.data,
+              member->decl.name.line, member->decl.name.col,
+              member_type.len, member_type.data);
+    }
+  }
+}
+
+int parser_resolve_missing_structs(Parser *parser) {
 
+  if (depgraph_prepare(&parser->struct_dependencies) < 0) {
+    return -1;
+  }
+
+  // every struct comes after the structs its members have
+  uint64_t to_resolve = depgraph_resolve(&parser->struct_dependencies);
+  while (to_resolve != DEPGRAPH_EMPTY) {
     // skip those that are already resolved
-    AstNode *def = ptr_bucket_get(&parser->struct_definitions, to_resolve);
+    AstNode *def = symbolmap_get(&parser->struct_definitions, to_resolve);
     assert(def->kind == AST_STRUCT);
     if (def->structure.members_all_defined) {
       to_resolve = depgraph_resolve(&parser->struct_dependencies);
@@ -1522,130 +1985,163 @@ int parser_resolve_missing_structs(Parser *parser) {
     }
 
     bool all_defined = true;
-    int size = 0;
     for (int i = 0; i < def->structure.members.len; i++) {
       AstNode *member_decl = def->structure.members.nodes[i];
       assert(member_decl->kind == AST_DECL);
-      int member_size = size_of_type(parser, member_decl->decl.kind);
-      member_decl->decl.size = member_size;
+      int member_size = member_decl->decl.size;
+      if (member_size < 0) {
+        member_size = size_of_type(parser, member_decl->decl.kind);
+        member_decl->decl.size = member_size;
+      }
       if (member_size < 0) {
         all_defined = false;
-        circular_decl = member_decl;
         break;
       }
-      size = offset_align(size, member_size);
-      size += member_size;
     }
+    def->structure.members_all_defined = all_defined;
     if (all_defined) {
-      size = offset_align(size, 4);
+      struct_set_size(parser, def);
     } else {
-      size = -1;
-      fprintf(stderr, "circular dependency:\n");
-      astnode_print(parser, stderr, circular_decl, 0);
+      def->structure.size = -1;
     }
-    def->structure.members_all_defined = all_defined;
-    def->structure.size = size;
     to_resolve = depgraph_resolve(&parser->struct_dependencies);
   }
 
-  return 0;
+  // member accesses only look up the layouts from now on
+  for (uint32_t i = 0; i < parser->struct_definitions.cap; i++) {
+    AstNode *def = parser->struct_definitions.data[i];
+    if (def) {
+      struct_layout_of(parser, def);
+    }
+  }
+
+  // the rest waits for a cycle or an undefined struct
+  int num_cycles = depgraph_find_cycles(&parser->struct_dependencies);
+  for (int cycle = 0; cycle < num_cycles; cycle++) {
+    report_struct_cycle(parser, cycle);
+  }
+
+  return num_cycles;
 }
 
-Type *new_type(){
-  Type *result = malloc(sizeof(Type));
-  result->kind = TYPE_UNRESOLVED;
-  result->definition = NULL;
-  result->num_pointers = 0;
-  result->error = NULL;
-  return result;
+// types are interned: every distinct (kind, definition,
+// pointers, error) exists once and is never modified,
+// so two types are the same exactly if the pointers are
+uint64_t type_hash(TypeKind kind, AstNode *definition, int num_pointers,
+                   const char *error) {
+  uint64_t h = (uintptr_t)definition;
+  h = h * 31 + (uintptr_t)error;
+  h = h * 31 + (uint64_t)kind;
+  h = h * 31 + (uint64_t)num_pointers;
+  return h;
+}
+
+static Type *type_find(Type *head, TypeKind kind, AstNode *definition,
+                       int num_pointers, const char *error) {
+  for (Type *t = head; t; t = t->next) {
+    if (t->kind == kind && t->definition == definition &&
+        t->num_pointers == num_pointers && t->error == error) {
+      return t;
+    }
+  }
+  return NULL;
 }
 
-Type *copy_type(Type *c){
-  Type *result = new_type();
-  result->kind = c->kind;
-  result->definition = c->definition;
-  result->num_pointers = c->num_pointers;
-  result->error = c->error;
+// set while a worker resolves function bodies: it keeps the
+// chains it has seen, so only types that are new to the
+// worker take the lock of the shared table
+static __thread PtrBucket *type_cache = NULL;
+
+Type *type_get(Parser *parser, TypeKind kind, AstNode *definition,
+               int num_pointers, const char *error) {
+  uint64_t key = type_hash(kind, definition, num_pointers, error);
+  if (type_cache) {
+    Type *t = type_find(ptr_bucket_get(type_cache, key), kind, definition,
+                        num_pointers, error);
+    if (t) {
+      return t;
+    }
+    pthread_mutex_lock(&parser->types_lock);
+  }
+
+  Type *head = ptr_bucket_get(&parser->types, key);
+  Type *result = type_find(head, kind, definition, num_pointers, error);
+  if (!result) {
+    result = arena_alloc(&parser->arena, sizeof(Type));
+    result->kind = kind;
+    result->definition = definition;
+    result->num_pointers = num_pointers;
+    result->error = error;
+    result->next = head;
+    ptr_bucket_put(&parser->types, key, result);
+    parser->num_types++;
+    head = result;
+  }
+
+  if (type_cache) {
+    pthread_mutex_unlock(&parser->types_lock);
+    // chains only grow at the head, the
+    // types behind it never change
+    ptr_bucket_put(type_cache, key, head);
+  }
   return result;
 }
 
-Type *literal_to_type(AstNode *node) {
+Type *type_error(Parser *parser, const char *error) {
+  return type_get(parser, TYPE_ERROR, NULL, 0, error);
+}
+
+Type *literal_to_type(Parser *parser, AstNode *node) {
   assert(node->kind == AST_LITERAL);
-  Type *t = new_type();
   switch (node->literal.kind) {
   case TOK_LITERAL_INT:
-    t->kind = TYPE_INT;
-    break;
+    return type_get(parser, TYPE_INT, NULL, 0, NULL);
   default:
-    t->kind = TYPE_ERROR;
-    t->error = "unsupported type";
-    break;
+    return type_error(parser, "unsupported type");
   }
-  return t;
 }
 
 Type *funcproto_to_type(Parser *parser, AstNode *node){
   assert(node->kind == AST_FUNC_PROTO);
-  Type *t = new_type();
 
   switch(node->funcproto.retType.kind){
   case TOK_KEYWORD_INT:
-    t->kind = TYPE_INT;
-    return t;
+    return type_get(parser, TYPE_INT, NULL, 0, NULL);
 
   case TOK_IDENTIFIER: {
-    uint64_t decltypekey = str_slice_to_uint64(node->funcproto.retType.string);
-    AstNode *structdef =
-        ptr_bucket_get(&parser->struct_definitions, decltypekey);
+    AstNode *structdef = symbolmap_get(&parser->struct_definitions,
+                                       node->funcproto.retType.symbol);
     if (structdef == NULL) {
-      t->kind = TYPE_ERROR;
-      t->error = "structure undefined";
-      return t;
+      return type_error(parser, "structure undefined");
     }
-    t->kind = TYPE_FUNC;
-    t->definition = structdef;
-    return t;
-    break;
+    return type_get(parser, TYPE_FUNC, structdef, 0, NULL);
   }
 
   default:
-    t->kind = TYPE_ERROR;
-    t->error = "return type not supported";
-    return t;
+    return type_error(parser, "return type not supported");
   }
 }
 
 Type *decl_to_type(Parser *parser, AstNode *node){
   assert(node->kind == AST_DECL);
-  Type *t = new_type();
-  t->num_pointers = node->decl.num_pointers;
+  int num_pointers = node->decl.num_pointers;
   if (node->decl.kind.kind == TOK_KEYWORD_INT) {
-    t->kind = TYPE_INT;
-    return t;
+    return type_get(parser, TYPE_INT, NULL, num_pointers, NULL);
   }
   if(node->decl.kind.kind == TOK_KEYWORD_CHAR){
-    t->kind = TYPE_CHAR;
-    return t;
+    return type_get(parser, TYPE_CHAR, NULL, num_pointers, NULL);
   }
 
   if (node->decl.kind.kind == TOK_IDENTIFIER) {
-    uint64_t decltypekey = str_slice_to_uint64(node->decl.kind.string);
     AstNode *structdef =
-        ptr_bucket_get(&parser->struct_definitions, decltypekey);
+        symbolmap_get(&parser->struct_definitions, node->decl.kind.symbol);
     if (structdef == NULL) {
-      t->kind = TYPE_ERROR;
-      t->error = "structure undefined";
-      return t;
+      return type_error(parser, "structure undefined");
     }
     node->decl.size = structdef->structure.size;
-
-    t->kind = TYPE_STRUCT;
-    t->definition = structdef;
-    return t;
+    return type_get(parser, TYPE_STRUCT, structdef, num_pointers, NULL);
   }
-  t->kind = TYPE_ERROR;
-  t->error = "unsupported type declaration";
-  return t;
+  return type_error(parser, "unsupported type declaration");
 }
 
 void resolve_var_to_type(Parser *parser, AstNode *node) {
@@ -1655,9 +2151,7 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
   // to retrieve the type
   AstNode *decl = node->var.declaration;
   if (decl == NULL) {
-    node->type = new_type();
-    node->type->kind = TYPE_ERROR;
-    node->type->error = "undeclared type";
+    node->type = type_error(parser, "undeclared type");
     return;
   }
 
@@ -1665,7 +2159,7 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
   // access after it then it's just
   // the declared type
   if (node->var.member_access == NULL) {
-    node->type = copy_type(decl->type);
+    node->type = decl->type;
     return;
   }
 
@@ -1673,9 +2167,8 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
   // it but according to the declaration
   // is not a struct it is an error
   if (decl->type->kind != TYPE_STRUCT) {
-    node->type = new_type();
-    node->type->kind = TYPE_ERROR;
-    node->type->error = "member access for something that is not a struct\n";
+    node->type = type_error(parser,
+                            "member access for something that is not a struct\n");
     return;
   }
 
@@ -1685,7 +2178,7 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
   // it must be a struct so there must
   // be a definition for the struct
   /* if (current_struct_definition == NULL) { */
-  /*   node->type = new_type(); */
+  /*   node->type = new_type(parser); */
   /*   node->type->kind = TYPE_ERROR; */
   /*   node->type->error = "declared variable is missing a struct definition"; */
   /*   return; */
@@ -1693,15 +2186,16 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
 
   Type *t = NULL;
   Type *last = NULL;
+  int offset = 0;
+  int width = 0;
   do {
 
     // for every member access the previous struct
     // needs to have the defnition that contains the member
     if(current_struct_definition == NULL){
-      member_access->type = new_type();
-      member_access->type->kind = TYPE_ERROR;
-      member_access->type->error = "struct definition of member is missing";
-      t = copy_type(member_access->type);
+      member_access->type =
+          type_error(parser, "struct definition of member is missing");
+      t = member_access->type;
       break;
     }
 
@@ -1711,97 +2205,83 @@ void resolve_var_to_type(Parser *parser, AstNode *node) {
     // find the member declaration
     // within the struct definition
     // if there isn't any its an error
-    AstNode *struct_member_decl = NULL;
-    for (int i = 0; i < current_struct_definition->structure.members.len; i++) {
-      AstNode *member_of_struct =
-          current_struct_definition->structure.members.nodes[i];
-      uint64_t memofstructkey =
-          str_slice_to_uint64(member_of_struct->decl.name.string);
-      uint64_t memaccesskey =
-          str_slice_to_uint64(member_access->member.name.string);
-      if (memaccesskey == memofstructkey) {
-        struct_member_decl = member_of_struct;
-        break;
-      }
+    StructMember *member =
+        struct_layout_find(struct_layout_of(parser, current_struct_definition),
+                           member_access->member.name.symbol);
+
+    if (member == NULL) {
+      member_access->type = type_error(
+          parser, "struct has no corresponding member with that name");
+      t = member_access->type;
+      break;
     }
 
-    if (struct_member_decl == NULL) {
-      member_access->type = new_type();
-      member_access->type->kind = TYPE_ERROR;
-      member_access->type->error =
-          "struct has no corresponding member with that name";
-      t = copy_type(member_access->type);
-      break;
+    if (offset >= 0 && member->offset >= 0) {
+      offset += member->offset;
+    } else {
+      offset = -1;
     }
+    width = member->size;
 
     // now we can determine the
     // type of this member
-    member_access->type = last = decl_to_type(parser, struct_member_decl);
+    member_access->type = last = member->type;
     member_access = member_access->member.next;
-    current_struct_definition = ptr_bucket_get(&parser->struct_definitions, str_slice_to_uint64(struct_member_decl->decl.kind.string));
+    current_struct_definition = symbolmap_get(&parser->struct_definitions, member->decl->decl.kind.symbol);
   } while(member_access);
 
   if(t == NULL){
-    t = copy_type(last);
+    t = last;
+    // codegen reads the location from here
+    if (offset >= 0 && width > 0) {
+      node->var.offset = offset;
+      node->var.width = width;
+    }
   }
 
   node->type = t;
   return;
 }
 
-Type *type_expect_same(Type *t1, Type *t2){
+Type *type_expect_same(Parser *parser, Type *t1, Type *t2){
   if(t1->kind == TYPE_ERROR){
-    Type *t = new_type();
-    t->kind = TYPE_ERROR;
-    t->error = "expected same types but left one has an error";
-    return t;
+    return type_error(parser, "expected same types but left one has an error");
   }
 
   if(t2->kind == TYPE_ERROR){
-    Type *t = new_type();
-    t->kind = TYPE_ERROR;
-    t->error = "expected same types but right one has an error";
-    return t;
+    return type_error(parser, "expected same types but right one has an error");
   }
 
+  if(t1 == t2){
+    return t1;
+  }
+
+  // only the reason for the mismatch is left to find
+
   if(t1->num_pointers != t2->num_pointers){
-    Type *t = new_type();
-    t->kind = TYPE_ERROR;
-    t->error = "types don't have different amount of pointer indirections";
-    return t;
+    return type_error(parser, "types don't have different amount of pointer indirections");
   }
 
   if(t1->kind != t2->kind){
-    Type *t = new_type();
-    t->kind = TYPE_ERROR;
-    t->error = "types don't match";
-    return t;
+    return type_error(parser, "types don't match");
   }
 
   if(t1->kind == TYPE_STRUCT){
-    Type *t = new_type();
     if(t1->definition == NULL){
-      t->kind = TYPE_ERROR;
-      t->error = "first struct definition missing";
-      return t;
+      return type_error(parser, "first struct definition missing");
     }
     if(t2->definition == NULL){
-      t->kind = TYPE_ERROR;
-      t->error = "seond struct definition missing";
-      return t;
+      return type_error(parser, "seond struct definition missing");
     }
-    uint64_t namekey1 = str_slice_to_uint64(t1->definition->structure.name.string);
-    uint64_t namekey2 = str_slice_to_uint64(t2->definition->structure.name.string);
+    SymbolId namekey1 = t1->definition->structure.name.symbol;
+    SymbolId namekey2 = t2->definition->structure.name.symbol;
 
     if(namekey1 != namekey2){
-      t->kind = TYPE_ERROR;
-      t->error = "different structures";
-      return t;
+      return type_error(parser, "different structures");
     }
   }
 
-  Type *t = copy_type(t1);
-  return t;
+  return t1;
 }
 
 /* int var_member_size(Parser *parser, AstNode *node){ */
@@ -1841,208 +2321,166 @@ int var_member_offset(Parser *parser, AstNode *node, int *last_member_size) {
     return 0;
   }
 
-  if (!node->var.declaration->type) {
-    printf("no type\n");
-    *last_member_size = size_of_type(parser, node->var.declaration->decl.kind);
-    return 0;
+  // already resolved by the type resolution
+  // or an earlier call
+  if (node->var.width > 0) {
+    *last_member_size = node->var.width;
+    return node->var.offset;
   }
 
-  if (node->var.declaration->type->kind != TYPE_STRUCT) {
+  // looked up by name, so this works
+  // without resolved types as well
+  AstNode *member_access = node->var.member_access;
+  AstNode *declaration = symbolmap_get(&parser->struct_definitions,
+                                       node->var.declaration->decl.kind.symbol);
+  if (!declaration) {
     printf("var member offset: type not struct\n");
     *last_member_size = size_of_type(parser, node->var.declaration->decl.kind);
     return 0;
   }
 
-
-  AstNode *member_access = node->var.member_access;
-  AstNode *declaration = ptr_bucket_get(&parser->struct_definitions,
-                                        str_slice_to_uint64(node->var.declaration->decl.kind.string));
-
   int offset = 0;
-  uint64_t current_member_name;
-  int last_decl_size = 0;
-
-  current_member_name = str_slice_to_uint64(member_access->member.name.string);
-
+  bool complete = true;
   while (declaration && member_access) {
-    bool found_member = false;
-    AstNode *member_decl = NULL;
-
-    // find member variable
-    // with the name
-    int i=0;
-    for (; i < declaration->structure.members.len; i++) {
-      member_decl = declaration->structure.members.nodes[i];
-      uint64_t member_name = str_slice_to_uint64(member_decl->decl.name.string);
-
-      if (member_decl->decl.size <= 0) {
-        printf("ooooohhh member size was negative or zero");
-      }
-
-      if (member_name == current_member_name) {
-        found_member = true;
-        *last_member_size = member_decl->decl.size;
-        break;
-      }
-
-      offset = offset_align(offset, member_decl->decl.size);
-      offset += member_decl->decl.size;
-    }
-
-    if (!found_member) {
+    StructMember *member =
+        struct_layout_find(struct_layout_of(parser, declaration),
+                           member_access->member.name.symbol);
+    if (!member) {
       fprintf(stderr, "member not found\n");
+      complete = false;
       break;
     }
-
-    declaration =
-        ptr_bucket_get(&parser->struct_definitions,
-                       str_slice_to_uint64(member_decl->decl.kind.string));
-    member_access = member_access->member.next;
-    if(!member_access){
+    if (member->offset < 0) {
+      fprintf(stderr, "member offset is not known\n");
+      complete = false;
       break;
     }
 
-    current_member_name = str_slice_to_uint64(member_access->member.name.string);
+    offset += member->offset;
+    *last_member_size = member->size;
+
+    declaration = symbolmap_get(&parser->struct_definitions,
+                                member->decl->decl.kind.symbol);
+    member_access = member_access->member.next;
   }
 
+  if (complete && !member_access) {
+    node->var.offset = offset;
+    node->var.width = *last_member_size;
+  }
   return offset;
 }
 
-void parser_resolve_types(Parser *parser, AstNode *node, AstNode *current_func_node) {
-  if (!node) {
-    return;
-  }
+void parser_resolve_types(Parser *parser, AstNode *node,
+                          AstNode *current_func_node);
+
+typedef struct ResolveWalk {
+  Parser *parser;
+  AstNode *current_func_node;
+} ResolveWalk;
+
+bool resolve_types_pre(AstWalk *walk, AstWalkFrame *frame) {
+  ResolveWalk *resolve = walk->data;
+  Parser *parser = resolve->parser;
+  AstNode *node = frame->node;
+
   if(node->type){
-    return;
+    return false;
   }
 
-  const char *type_names[] = {FOREACH_TYPE_KIND(GENERATE_STRING)};
   switch (node->kind) {
-  case AST_LITERAL: {
-    node->type = literal_to_type(node);
-    break;
-  }
-  case AST_STRUCT: {
-    break;
-  }
-  case AST_DECL: {
+  case AST_LITERAL:
+    node->type = literal_to_type(parser, node);
+    return false;
+  case AST_DECL:
     node->type = decl_to_type(parser, node);
-    parser_resolve_types(parser, node->decl.expr, current_func_node);
-    break;
-  }
-  case AST_MEMBER_ACCESS: {
-    break;
-  }
+    return true;
   case AST_VAR:
+    // the member accesses are resolved
+    // together with the variable
     resolve_var_to_type(parser, node);
-    /* node->type = var_to_type(parser, node); */
-    break;
-  case AST_PROGRAM: {
-    for(int i=0; i<node->program.items.len; i++){
-      parser_resolve_types(parser, node->program.items.nodes[i], current_func_node);
-    }
-    break;
-  }
-  case AST_FUNC_PROTO: {
+    return false;
+  case AST_FUNC_PROTO:
     node->type = funcproto_to_type(parser, node);
-    for(int i=0; i<node->funcproto.params.len; i++){
-      parser_resolve_types(parser, node->funcproto.params.nodes[i], node);
-    }
-    break;
-  }
-  case AST_FUNC_DEF: {
-    parser_resolve_types(parser, node->func.prototype, NULL);
-    node->type = copy_type(node->func.prototype->type);
-    parser_resolve_types(parser, node->func.block, node);
-    break;
-  }
-  case AST_BLOCK: {
-    for (int i = 0; i < node->block.len; i++) {
-      parser_resolve_types(parser, node->block.nodes[i], current_func_node);
+    return true;
+  case AST_RETURN:
+    if(resolve->current_func_node == NULL){
+      node->type = type_error(parser, "return is not inside a function");
+      return false;
     }
-    break;
-  }
-  case AST_IF_ELSE: {
-    parser_resolve_types(parser, node->ifelse.condition, current_func_node);
-    parser_resolve_types(parser, node->ifelse.ifblock, current_func_node);
-    parser_resolve_types(parser, node->ifelse.elseblock, current_func_node);
-    break;
-  }
-  case AST_RETURN: {
-    parser_resolve_types(parser, node->ret.expr, current_func_node);
+    return true;
+  case AST_FUNC_CALL: {
+    AstNode *funcdef = symbolmap_get(&parser->function_definitions,
+                                     node->funccall.name.symbol);
 
-    if(current_func_node == NULL){
-      node->type = new_type();
-      node->type->kind = TYPE_ERROR;
-      node->type->error = "return is not inside a function";
-      break;
+    if(!funcdef){
+      node->type = type_error(parser, "no function found");
+      return false;
     }
 
-    node->type = type_expect_same(current_func_node->type, node->ret.expr->type);
-    if(node->type->kind == TYPE_ERROR){
-      node->type->error = "return value doesn't match the signiture of the function";
+    assert(funcdef->kind == AST_FUNC_DEF);
+
+    AstNode *prototype = funcdef->func.prototype;
+
+    if(prototype->funcproto.params.len != node->funccall.params.len){
+      node->type = type_error(
+          parser, "number of arguments not matching number of parameters");
+      return false;
     }
-    break;
+    return true;
   }
-  case AST_BREAK: {
-    break;
+  case AST_STRUCT:
+  case AST_MEMBER_ACCESS:
+  case AST_BREAK:
+  case AST_ERROR:
+    return false;
+  default:
+    return true;
   }
-  case AST_FORLOOP: {
-    parser_resolve_types(parser, node->forloop.init, current_func_node);
-    parser_resolve_types(parser, node->forloop.condition, current_func_node);
-    parser_resolve_types(parser, node->forloop.stmt, current_func_node);
-    parser_resolve_types(parser, node->forloop.step, current_func_node);
-    break;
+}
+
+void resolve_types_in(AstWalk *walk, AstWalkFrame *frame, int child) {
+  ResolveWalk *resolve = walk->data;
+  AstNode *node = frame->node;
+
+  // the prototype is resolved, the body
+  // of the function comes next
+  if (node->kind == AST_FUNC_DEF && child == 1) {
+    node->type = node->func.prototype->type;
+    resolve->current_func_node = node;
   }
+}
 
-    /* case AST_ASSIGN: */
-  /*   parser_resolve_types(parser, node->assign.var, current_func_node); */
-  /*   parser_resolve_types(parser, node->assign.expr, current_func_node); */
-  /*   node->type = type_expect_same(node->assign.var->type, node->assign.expr->type); */
-  /*   break; */
+void resolve_types_post(AstWalk *walk, AstWalkFrame *frame) {
+  ResolveWalk *resolve = walk->data;
+  Parser *parser = resolve->parser;
+  AstNode *node = frame->node;
 
+  switch (node->kind) {
+  case AST_FUNC_DEF:
+    resolve->current_func_node = NULL;
+    break;
+  case AST_RETURN:
+    node->type = type_expect_same(parser, resolve->current_func_node->type,
+                                  node->ret.expr->type);
+    if(node->type->kind == TYPE_ERROR){
+      node->type = type_error(
+          parser, "return value doesn't match the signiture of the function");
+    }
+    break;
   case AST_BINOP:
-    parser_resolve_types(parser, node->binop.left, current_func_node);
-    parser_resolve_types(parser, node->binop.right, current_func_node);
     node->type =
-        type_expect_same(node->binop.left->type, node->binop.right->type);
+        type_expect_same(parser, node->binop.left->type, node->binop.right->type);
     break;
   case AST_UNOP:
-    parser_resolve_types(parser, node->unop.expr, current_func_node);
-    node->type = copy_type(node->unop.expr->type);
-    break;
-  case AST_ERROR:
+    node->type = node->unop.expr->type;
     break;
   case AST_FUNC_CALL: {
-    AstNode *funcdef =
-        ptr_bucket_get(&parser->function_definitions,
-                       str_slice_to_uint64(node->funccall.name.string));
-
-    if(!funcdef){
-      node->type = new_type();
-      node->type->kind = TYPE_ERROR;
-      node->type->error = "no function found";
-      return;
-    }
-
-    assert(funcdef->kind == AST_FUNC_DEF);
-
+    AstNode *funcdef = symbolmap_get(&parser->function_definitions,
+                                     node->funccall.name.symbol);
     AstNode *prototype = funcdef->func.prototype;
 
-    if(prototype->funcproto.params.len != node->funccall.params.len){
-      node->type = new_type();
-      node->type->kind = TYPE_ERROR;
-      node->type->error = "number of arguments not matching number of parameters";
-      return;
-    }
-
     for(int i=0; i<node->funccall.params.len; i++){
-
-      // first resolve the parameter
-      parser_resolve_types(parser,
-                           node->funccall.params.nodes[i],
-                           current_func_node);
-
       // check if the type matches
       Type *type_of_arg = node->funccall.params.nodes[i]->type;
       Type *type_of_param = prototype->funcproto.params.nodes[i]->type;
@@ -2052,178 +2490,175 @@ void parser_resolve_types(Parser *parser, AstNode *node, AstNode *current_func_n
         type_of_param = prototype->funcproto.params.nodes[i]->type;
       }
 
-      Type *t = type_expect_same(type_of_arg, type_of_param);
+      Type *t = type_expect_same(parser, type_of_arg, type_of_param);
       if(t->error){
-        free(node->funccall.params.nodes[i]->type);
         node->funccall.params.nodes[i]->type = t;
         break;
-      } else {
-        free(t);
       }
     }
 
-    node->type = copy_type(prototype->type);
+    node->type = prototype->type;
+    break;
   }
+  default:
     break;
   }
 }
 
-bool collect_errors(Parser *parser, AstNode *node, String content, int fileid,
-                    FileManager *manager) {
-  assert(manager != NULL);
-  assert(parser != NULL);
-  if (!node) {
-    return 0;
-  }
-  switch (node->kind) {
-  case AST_ERROR: {
-    String filename = filemanager_get_filename(manager, fileid);
-    // get the last parsing error
-    AstNode *last_error = node;
-    AstNode *previous_error = node;
-    while (1) {
-      if (last_error->error.kind == ERR_INVALID_AST) {
-        if (last_error->error.invalid.node == NULL) {
-          Token context = last_error->error.invalid.context_token;
-          String membername = parser_token_content(parser, context);
-          fprintf(stderr, RED "%.*s:%d:%d" COLOR_RESET " parsing error " "%s \n", filename.len,
-                  filename.data, context.line, context.col,
-                  last_error->error.invalid.description);
-          break;
-        }
-        previous_error = last_error;
-        last_error = last_error->error.invalid.node;
-      } else if (last_error->error.kind == ERR_UNEXPECTED_TOKEN) {
-
-        Token actual = last_error->error.unexpectedToken.actual;
-        String actual_str = parser_token_content(parser, actual);
-        fprintf(stderr, RED "%.*s:%d:%d  " COLOR_RESET "unexpected token "  "%.*s but I expected %s \n",
-                filename.len, filename.data,
-                actual.line,
-                actual.col,
-                actual_str.len,
-                actual_str.data,
-                last_error->error.unexpectedToken.triedToParse);
-
-        if (previous_error != last_error) {
-          Token context = previous_error->error.invalid.context_token;
-          String context_str = parser_token_content(parser, context);
-          fprintf(stderr, "\t\t\t because %s at symbol %.*s (%d:%d) \n",
-                  previous_error->error.invalid.description, context_str.len,
-                  context_str.data,
-                  previous_error->error.invalid.context_token.line,
-                  previous_error->error.invalid.context_token.col);
-        }
+void parser_resolve_types(Parser *parser, AstNode *node, AstNode *current_func_node) {
+  ResolveWalk resolve = {.parser = parser,
+                         .current_func_node = current_func_node};
+  AstWalk walk;
+  astwalk_init(&walk, resolve_types_pre, resolve_types_in, resolve_types_post,
+               &resolve);
+  astwalk_run(&walk, node, 0);
+  astwalk_quit(&walk);
+}
 
-        break;
-      } else {
-        // neither invalid ast
-        // nor unexpected token
-        // so there is nothing to print
-        // regarding parsing
-        break;
-      }
+typedef struct ResolvePool {
+  Parser *parser;
+  AstNode **funcs;
+  uint32_t num_funcs;
+  // next function to take
+  uint32_t next;
+} ResolvePool;
+
+static void *resolve_types_worker(void *data) {
+  ResolvePool *pool = data;
+  PtrBucket cache;
+  if (ptr_bucket_init(&cache, 64) < 0) {
+    fprintf(stderr, "couldn't initialize type cache of worker\n");
+    return NULL;
+  }
+
+  ResolveWalk resolve = {.parser = pool->parser, .current_func_node = NULL};
+  AstWalk walk;
+  astwalk_init(&walk, resolve_types_pre, resolve_types_in, resolve_types_post,
+               &resolve);
+  type_cache = &cache;
+  while (1) {
+    uint32_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    if (i >= pool->num_funcs) {
+      break;
     }
+    resolve.current_func_node = NULL;
+    astwalk_run(&walk, pool->funcs[i], 0);
+  }
+  type_cache = NULL;
+  astwalk_quit(&walk);
+  ptr_bucket_quit(&cache);
+  return NULL;
+}
 
-    // has by definition errors
-    return true;
-    break;
+// same result as parser_resolve_types on the program. the prototypes
+// and the other top level items are resolved in order first, after
+// that a function body only writes to its own nodes and only reads
+// prototypes, struct layouts and the (locked) type table, so the
+// bodies are resolved on num_threads threads. type errors stay on the
+// nodes they belong to, so the result doesn't depend on the order
+// the workers take the functions in
+int parser_resolve_types_parallel(Parser *parser, AstNode *root,
+                                  int num_threads) {
+  assert(root->kind == AST_PROGRAM);
+  AstNodeList *items = &root->program.items;
+
+  AstNode **funcs = malloc(sizeof(AstNode *) * (items->len + 1));
+  if (!funcs) {
+    fprintf(stderr, "couldn't allocate functions to resolve\n");
+    return -1;
   }
-  case AST_PROGRAM: {
-    bool hasErrors = false;
-    for (int i = 0; i < node->program.items.len; i++) {
-      hasErrors |= collect_errors(parser, node->program.items.nodes[i], content,
-                                  fileid, manager);
+  ResolveWalk resolve = {.parser = parser, .current_func_node = NULL};
+  AstWalk walk;
+  astwalk_init(&walk, resolve_types_pre, resolve_types_in, resolve_types_post,
+               &resolve);
+  uint32_t num_funcs = 0;
+  for (int i = 0; i < items->len; i++) {
+    AstNode *item = items->nodes[i];
+    if (item->kind == AST_FUNC_DEF) {
+      astwalk_run(&walk, item->func.prototype, 0);
+      funcs[num_funcs++] = item;
     }
-    return hasErrors;
-    break;
   }
-  case AST_BLOCK: {
-    bool hasErrors = false;
-    for (int i = 0; i < node->program.items.len; i++) {
-      hasErrors |= collect_errors(parser, node->block.nodes[i], content, fileid,
-                                  manager);
+  for (int i = 0; i < items->len; i++) {
+    if (items->nodes[i]->kind != AST_FUNC_DEF) {
+      astwalk_run(&walk, items->nodes[i], 0);
     }
-    return hasErrors;
-    break;
   }
-  case AST_LITERAL:
-    // as this is the last
-    // node in the hierarchy
-    // it cannot be an error
-    return false;
-    break;
-  case AST_STRUCT: {
-    String filename = filemanager_get_filename(manager, fileid);
-    String structname = parser_token_content(parser, node->structure.name);
-    bool hasErrors = false;
-    for (int i = 0; i < node->structure.members.len; i++) {
-      AstNode *member_declaration = node->structure.members.nodes[i];
-      if (member_declaration->kind == AST_ERROR) {
-        hasErrors = true;
-        collect_errors(parser, member_declaration, content, fileid, manager);
+
+  ResolvePool pool = {
+      .parser = parser, .funcs = funcs, .num_funcs = num_funcs, .next = 0};
+  if ((uint32_t)num_threads > num_funcs) {
+    num_threads = num_funcs;
+  }
+  pthread_t *threads = malloc(sizeof(pthread_t) * (num_threads + 1));
+  int num_started = 0;
+  if (threads) {
+    for (; num_started < num_threads; num_started++) {
+      if (pthread_create(&threads[num_started], NULL, resolve_types_worker,
+                         &pool) != 0) {
+        fprintf(stderr, "couldn't start type resolution thread\n");
+        break;
       }
     }
-    return hasErrors;
-    break;
   }
-  case AST_DECL: {
-    return collect_errors(parser, node->decl.expr, content, fileid, manager);
-    break;
+  for (int i = 0; i < num_started; i++) {
+    pthread_join(threads[i], NULL);
   }
-  case AST_MEMBER_ACCESS:
-  case AST_VAR:
-  case AST_FUNC_PROTO:
-    break;
-  case AST_FUNC_DEF: {
-    bool hasErrors = false;
-    hasErrors |= collect_errors(parser, node->func.prototype, content, fileid, manager);
-    hasErrors |= collect_errors(parser, node->func.block, content, fileid, manager);
-    return hasErrors;
-  }
-  case AST_FUNC_CALL:
-    break;
-  case AST_IF_ELSE: {
-    bool hasErrors = false;
-    hasErrors |= collect_errors(parser, node->ifelse.condition, content, fileid,
-                                manager);
-
-    hasErrors |= collect_errors(parser, node->ifelse.ifblock, content, fileid,
-                                manager);
+  free(threads);
 
-    hasErrors |= collect_errors(parser, node->ifelse.elseblock, content, fileid,
-                                manager);
-    return hasErrors;
-    break;
-  }
-  case AST_RETURN:
-  case AST_BREAK:
-    break;
-  case AST_BINOP: {
-    return collect_errors(parser, node->binop.left, content, fileid, manager);
-    return collect_errors(parser, node->binop.right, content, fileid, manager);
-    break;
+  // whatever no worker took
+  for (uint32_t i = pool.next; i < num_funcs; i++) {
+    resolve.current_func_node = NULL;
+    astwalk_run(&walk, funcs[i], 0);
   }
-  case AST_UNOP: {
-    return collect_errors(parser, node->unop.expr, content, fileid, manager);
-    break;
-  }
-  case AST_FORLOOP: {
-    bool hasErrors = false;
-    hasErrors |=
-        collect_errors(parser, node->forloop.init, content, fileid, manager);
-    hasErrors |= collect_errors(parser, node->forloop.condition, content,
-                                fileid, manager);
-    hasErrors |=
-        collect_errors(parser, node->forloop.stmt, content, fileid, manager);
-    hasErrors |=
-        collect_errors(parser, node->forloop.step, content, fileid, manager);
-    return hasErrors;
-    break;
+  astwalk_quit(&walk);
+  free(funcs);
+  return 0;
+}
+
+void report_parse_error(Parser *parser, ParseDiagnostic *diagnostic,
+                        String filename) {
+  AstNode *error = diagnostic->error;
+  if (error->error.kind == ERR_INVALID_AST) {
+    Token context = error->error.invalid.context_token;
+    fprintf(stderr, RED "%.*s:%d:%d" COLOR_RESET " parsing error " "%s \n", filename.len,
+            filename.data, context.line, context.col,
+            error->error.invalid.description);
+    return;
   }
+
+  Token actual = error->error.unexpectedToken.actual;
+  String actual_str = parser_token_content(parser, actual);
+  fprintf(stderr, RED "%.*s:%d:%d  " COLOR_RESET "unexpected token "  "%.*s but I expected %s \n",
+          filename.len, filename.data,
+          actual.line,
+          actual.col,
+          actual_str.len,
+          actual_str.data,
+          error->error.unexpectedToken.triedToParse);
+
+  AstNode *because = diagnostic->because;
+  if (because != NULL) {
+    Token context = because->error.invalid.context_token;
+    String context_str = parser_token_content(parser, context);
+    fprintf(stderr, "\t\t\t because %s at symbol %.*s (%d:%d) \n",
+            because->error.invalid.description, context_str.len,
+            context_str.data, context.line, context.col);
   }
+}
 
-  return false;
+// prints the errors recorded while parsing
+int report_parse_errors(Parser *parser, String filename) {
+  int num_errors = 0;
+  for (uint32_t i = 0; i < parser->num_diagnostics; i++) {
+    ParseDiagnostic *diagnostic = &parser->diagnostics[i];
+    if (diagnostic->error == NULL || diagnostic->error->kind != AST_ERROR) {
+      continue;
+    }
+    report_parse_error(parser, diagnostic, filename);
+    num_errors++;
+  }
+  return num_errors;
 }
 
 void parser_node_print(Parser *parser);
@@ -2234,26 +2669,139 @@ void parser_parse(Parser *parser, String content, int fileid, FileManager *manag
   parser->root = parse_program(parser);
 
   /* parser_node_print(parser); */
-  parser->hasErrors = collect_errors(parser, parser->root, content, fileid, manager);
-  if(!parser->hasErrors){
+  assert(manager != NULL);
+  parser->num_errors =
+      report_parse_errors(parser, filemanager_get_filename(manager, fileid));
+  if(parser->num_errors == 0){
+
+    parser_resolve_missing_structs(parser);
+    if (parser->num_threads > 1) {
+      parser_resolve_types_parallel(parser, parser->root, parser->num_threads);
+    } else {
+      parser_resolve_types(parser, parser->root, NULL);
+    }
+    parser_flatten(parser, parser->root);
+  }
+}
+
+// the struct definitions at the top level are parsed before
+// everything else, so their layout is known when the functions
+// using them are compiled. returns the token range of each
+// struct as (start, end) pairs for skipping them later
+static uint32_t *prescan_structs(Parser *parser, uint32_t *num_spans) {
+  Lexer *lexer = &parser->lexer;
+  uint32_t *spans = NULL;
+  uint32_t cap = 0;
+  *num_spans = 0;
+
+  int depth = 0;
+  unsigned i = 0;
+  while (i < lexer->tokens.len) {
+    TokenKind kind = lexer->tokens.data[i].kind;
+    if (kind == TOK_BRACE_OPEN) {
+      depth++;
+    } else if (kind == TOK_BRACE_CLOSE && depth > 0) {
+      depth--;
+    } else if (kind == TOK_KEYWORD_STRUCT && depth == 0) {
+      lex_restore(lexer, i);
+      parse_struct(parser);
+      if (*num_spans + 2 > cap) {
+        cap = cap ? cap * 2 : 32;
+        uint32_t *newspans = realloc(spans, sizeof(*spans) * cap);
+        if (!newspans) {
+          fprintf(stderr, "couldn't grow struct prescan\n");
+          break;
+        }
+        spans = newspans;
+      }
+      spans[(*num_spans)++] = i;
+      spans[(*num_spans)++] = lex_checkpoint(lexer);
+      if ((unsigned)lex_checkpoint(lexer) > i) {
+        i = lex_checkpoint(lexer);
+        continue;
+      }
+    }
+    i++;
+  }
+  lex_restore(lexer, 0);
+  *num_spans /= 2;
+  return spans;
+}
 
+// single pass alternative to parser_parse + parser_dump_assembly
+// for fast debug builds: every top level item is emitted right
+// after it was parsed and its nodes are released before the next
+// one. there is no program tree and types are not checked.
+// returns the number of errors, after an error nothing is emitted
+// anymore and file holds an incomplete program
+int parser_compile_fast(Parser *parser, String content, int fileid,
+                        FileManager *manager, FILE *file) {
+  assert(manager != NULL);
+  lex(&parser->lexer, content, fileid);
+  tokens_internalize(&parser->lexer.tokens, content, &parser->pool);
+  parser->root = NULL;
+
+  uint32_t num_spans = 0;
+  uint32_t *spans = prescan_structs(parser, &num_spans);
+  uint32_t span = 0;
+  if (parser->num_errors == 0) {
     parser_resolve_missing_structs(parser);
-    parser_resolve_types(parser, parser->root, NULL);
   }
+
+  dump_assembly_header(file, 0);
+
+  // structs and global declarations stay,
+  // later items still refer to them
+  ArenaMark mark = arena_mark(&parser->arena);
+  Token tok = lex_peek(&parser->lexer);
+  while (tok.kind != TOK_EOF) {
+    if (tok.kind == TOK_SEMICOLON) {
+      tok = lex_next(&parser->lexer);
+      continue;
+    }
+
+    if (tok.kind == TOK_KEYWORD_STRUCT) {
+      int at = lex_checkpoint(&parser->lexer);
+      while (span < num_spans && spans[span * 2] < (uint32_t)at) {
+        span++;
+      }
+      if (span < num_spans && spans[span * 2] == (uint32_t)at) {
+        lex_restore(&parser->lexer, spans[span * 2 + 1]);
+        tok = lex_peek(&parser->lexer);
+        continue;
+      }
+    }
+
+    AstNode *item = parse_any(parser);
+    if (parser->num_errors == 0) {
+      parser_dump_assembly_program(parser, item, file, 0, NULL);
+      if (item->kind != AST_DECL) {
+        // the function definitions table keeps dangling
+        // pointers, nothing looks them up in this mode
+        arena_reset(&parser->arena, mark);
+      }
+    }
+    mark = arena_mark(&parser->arena);
+    tok = lex_peek(&parser->lexer);
+  }
+  free(spans);
+
+  parser->num_errors =
+      report_parse_errors(parser, filemanager_get_filename(manager, fileid));
+  return parser->num_errors;
 }
 
 void parser_depgraph_print(Parser *parser) {
+  DepGraph *graph = &parser->struct_dependencies;
   printf("----------- depgraph --------\n");
   printf("--- unresolved: ---\n");
-  for (int i = 0; i < parser->struct_dependencies.dependencies.len; i++) {
-    if (i == parser->struct_dependencies.resolved_i) {
-      printf("---to be resolved: ----\n");
-    }
-    IntTuple tuple = parser->struct_dependencies.dependencies.data[i];
-    String first =
-        str_interner_get(&parser->pool, str_slice_from_uint64(tuple.first));
-    String second =
-        str_interner_get(&parser->pool, str_slice_from_uint64(tuple.second));
+  for (int i = 0; i < graph->dependencies.len; i++) {
+    IntTuple tuple = graph->dependencies.data[i];
+    if (depgraph_is_resolved(graph, tuple.first)) {
+      continue;
+    }
+    String first = str_interner_symbol(&parser->pool, tuple.first);
+    String second = str_interner_symbol(&parser->pool, tuple.second);
     str_file_print(first, stdout);
     printf("\t");
     str_file_print(second, stdout);
@@ -2263,15 +2811,91 @@ void parser_depgraph_print(Parser *parser) {
 
 void parser_structdef_print(Parser *parser) {
   printf("-----------structdefs --------\n");
-  for (int i = 0; i < parser->struct_definitions.cap; i++) {
-    PtrBucketEntry entry = parser->struct_definitions.data[i];
-    if (entry.key) {
-      astnode_print(parser, stdout, entry.data, 0);
+  for (uint32_t i = 0; i < parser->struct_definitions.cap; i++) {
+    AstNode *structdef = parser->struct_definitions.data[i];
+    if (structdef) {
+      astnode_print(parser, stdout, structdef, 0);
       printf("\n");
     }
   }
 }
 
+typedef struct FrameSavings {
+  Parser *parser;
+  int64_t bytes;
+  int num_vars;
+} FrameSavings;
+
+static bool frame_savings_pre(AstWalk *walk, AstWalkFrame *frame) {
+  FrameSavings *savings = walk->data;
+  AstNode *node = frame->node;
+  if (node->kind == AST_STRUCT || node->kind == AST_ERROR) {
+    return false;
+  }
+  if (node->kind == AST_DECL && node->decl.num_pointers == 0 &&
+      node->decl.kind.kind == TOK_IDENTIFIER) {
+    AstNode *def = symbolmap_get(&savings->parser->struct_definitions,
+                                 node->decl.kind.symbol);
+    if (def && def->structure.size >= 0 &&
+        def->structure.declared_size > def->structure.size) {
+      savings->bytes += def->structure.declared_size - def->structure.size;
+      savings->num_vars++;
+    }
+  }
+  return true;
+}
+
+// what placing the members by alignment saved compared
+// to declaration order, per struct and for the stack
+// frames of the functions that have struct variables
+void parser_struct_report(Parser *parser, FILE *file) {
+  if (parser->root == NULL) {
+    return;
+  }
+  AstNodeList *items = &parser->root->program.items;
+
+  fprintf(file, "struct layout (%s):\n",
+          parser->reorder_structs ? "reordered" : "declaration order");
+  int num_structs = 0;
+  int64_t struct_bytes = 0;
+  for (int i = 0; i < items->len; i++) {
+    AstNode *def = items->nodes[i];
+    if (def->kind != AST_STRUCT) {
+      continue;
+    }
+    String name = parser_token_content(parser, def->structure.name);
+    if (def->structure.size < 0) {
+      fprintf(file, "  %.*s: size unknown\n", name.len, name.data);
+      continue;
+    }
+    int saved = def->structure.declared_size - def->structure.size;
+    fprintf(file, "  %.*s: %d -> %d bytes, %d saved\n", name.len, name.data,
+            def->structure.declared_size, def->structure.size, saved);
+    num_structs++;
+    struct_bytes += saved;
+  }
+
+  FrameSavings savings = {.parser = parser, .bytes = 0, .num_vars = 0};
+  AstWalk walk;
+  astwalk_init(&walk, frame_savings_pre, NULL, NULL, &savings);
+  int num_funcs = 0;
+  for (int i = 0; i < items->len; i++) {
+    if (items->nodes[i]->kind == AST_FUNC_DEF) {
+      int64_t before = savings.bytes;
+      astwalk_run(&walk, items->nodes[i], 0);
+      num_funcs += savings.bytes > before;
+    }
+  }
+  astwalk_quit(&walk);
+
+  fprintf(file, "%d structs, %lld bytes saved\n", num_structs,
+          (long long)struct_bytes);
+  fprintf(file,
+          "stack frames: %lld bytes smaller, %d struct variables "
+          "in %d functions\n",
+          (long long)savings.bytes, savings.num_vars, num_funcs);
+}
+
 void parser_node_print(Parser *parser) {
   printf("astnode: \n");
   if (parser->root != NULL) {
@@ -2281,20 +2905,51 @@ void parser_node_print(Parser *parser) {
   }
 }
 
+void parser_arena_print(Parser *parser) {
+  printf("----------- arena --------\n");
+  printf("allocations: %zu blocks: %zu bytes: %zu\n",
+         parser->arena.num_allocs, parser->arena.num_blocks,
+         parser->arena.bytes);
+  printf("distinct types: %zu\n", parser->num_types);
+}
+
 void parser_print(Parser *parser) {
   parser_node_print(parser);
   parser_structdef_print(parser);
   parser_depgraph_print(parser);
+  parser_arena_print(parser);
 }
 
-void parser_dump_assembly_program(Parser *parser, AstNode *node, FILE *file,
-                                  int indent, AstNode *currentfunc,
-                                  int *stack_offset);
+static void parser_dump_assembly_unoptimized(Parser *parser, FILE *file) {
+  if (parser->use_ir) {
+    parser_dump_assembly_ir(parser, file);
+    return;
+  }
+  parser_dump_assembly_program(parser, parser->root, file, 0, NULL);
+}
 
+// the code is emitted into memory first
+// when the peephole optimizer runs on it
 void parser_dump_assembly(Parser *parser, FILE *file) {
-  int stack_offset = 0;
-  parser_dump_assembly_program(parser, parser->root, file, 0, NULL,
-                               &stack_offset);
+  memset(parser->peephole_hits, 0, sizeof(parser->peephole_hits));
+  if (!parser->peephole) {
+    parser_dump_assembly_unoptimized(parser, file);
+    return;
+  }
+  char *text = NULL;
+  size_t len = 0;
+  FILE *buffer = open_memstream(&text, &len);
+  if (!buffer) {
+    fprintf(stderr, "couldn't buffer the assembly for the peephole pass\n");
+    parser_dump_assembly_unoptimized(parser, file);
+    return;
+  }
+  parser_dump_assembly_unoptimized(parser, buffer);
+  fclose(buffer);
+  if (peephole_run(text, len, file, parser->peephole_hits) < 0) {
+    fwrite(text, 1, len, file);
+  }
+  free(text);
 }
 
 String parser_token_content(Parser *parser, Token tok) {
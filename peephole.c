@@ -0,0 +1,667 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// what an instruction does to the flags. the emitters never
+// expect flags to survive a label, a jump or a return, so
+// the flags from before are dead after those
+#define ASM_FLAGS_KEEP 0
+#define ASM_FLAGS_READ 1
+#define ASM_FLAGS_WRITE 2
+#define ASM_FLAGS_END 3
+
+// every mnemonic the emitters use, lines with anything
+// else are kept as they are and no rule looks at them
+#define FOREACH_ASM_OP(MACRO)                                                  \
+  MACRO(ASM_RAW, ASM_FLAGS_READ)                                               \
+  MACRO(ASM_LABEL, ASM_FLAGS_END)                                              \
+  MACRO(ASM_MOVB, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_MOVL, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_MOVQ, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_MOVSBL, ASM_FLAGS_KEEP)                                            \
+  MACRO(ASM_MOVZBL, ASM_FLAGS_KEEP)                                            \
+  MACRO(ASM_LEAQ, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_PUSHQ, ASM_FLAGS_KEEP)                                             \
+  MACRO(ASM_POPQ, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_CLTD, ASM_FLAGS_KEEP)                                              \
+  MACRO(ASM_ADDL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_SUBL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_SUBQ, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_ANDL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_ANDQ, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_SALL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_SARL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_SHRL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_IMUL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_IMULL, ASM_FLAGS_WRITE)                                            \
+  MACRO(ASM_IDIVL, ASM_FLAGS_WRITE)                                            \
+  MACRO(ASM_NEGL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_XORL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_CMPL, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_CMPQ, ASM_FLAGS_WRITE)                                             \
+  MACRO(ASM_TESTL, ASM_FLAGS_WRITE)                                            \
+  MACRO(ASM_TESTQ, ASM_FLAGS_WRITE)                                            \
+  MACRO(ASM_SETE, ASM_FLAGS_READ)                                              \
+  MACRO(ASM_SETL, ASM_FLAGS_READ)                                              \
+  MACRO(ASM_SETLE, ASM_FLAGS_READ)                                             \
+  MACRO(ASM_SETG, ASM_FLAGS_READ)                                              \
+  MACRO(ASM_SETGE, ASM_FLAGS_READ)                                             \
+  MACRO(ASM_JE, ASM_FLAGS_READ)                                                \
+  MACRO(ASM_JNE, ASM_FLAGS_READ)                                               \
+  MACRO(ASM_JMP, ASM_FLAGS_END)                                                \
+  MACRO(ASM_RET, ASM_FLAGS_END)
+
+#define GENERATE_ASM_OP(OP, FLAGS) OP,
+#define GENERATE_ASM_NAME(OP, FLAGS) #OP,
+#define GENERATE_ASM_FLAGS(OP, FLAGS) FLAGS,
+
+typedef enum AsmOp { FOREACH_ASM_OP(GENERATE_ASM_OP) NUM_ASM_OPS } AsmOp;
+
+// ASM_MOVL is movl
+static const char *asm_op_names[] = {FOREACH_ASM_OP(GENERATE_ASM_NAME)};
+static const uint8_t asm_op_flags[] = {FOREACH_ASM_OP(GENERATE_ASM_FLAGS)};
+
+// hardware numbers, names of the 8, 4 and 1 byte registers
+#define ASM_RSP 4
+static const char *asm_reg_names[16][3] = {
+    {"%rax", "%eax", "%al"},    {"%rcx", "%ecx", "%cl"},
+    {"%rdx", "%edx", "%dl"},    {"%rbx", "%ebx", "%bl"},
+    {"%rsp", "%esp", "%spl"},   {"%rbp", "%ebp", "%bpl"},
+    {"%rsi", "%esi", "%sil"},   {"%rdi", "%edi", "%dil"},
+    {"%r8", "%r8d", "%r8b"},    {"%r9", "%r9d", "%r9b"},
+    {"%r10", "%r10d", "%r10b"}, {"%r11", "%r11d", "%r11b"},
+    {"%r12", "%r12d", "%r12b"}, {"%r13", "%r13d", "%r13b"},
+    {"%r14", "%r14d", "%r14b"}, {"%r15", "%r15d", "%r15b"},
+};
+static const uint8_t asm_reg_sizes[3] = {8, 4, 1};
+
+typedef enum AsmOperandKind {
+  ASM_NONE,
+  ASM_REG,
+  ASM_IMM,
+  ASM_MEM,
+  ASM_NAME,
+} AsmOperandKind;
+
+typedef struct AsmOperand {
+  uint8_t kind;
+  // register or the base register of memory
+  uint8_t reg;
+  // bytes of a register
+  uint8_t size;
+  // immediate or displacement
+  int64_t value;
+  // label
+  String name;
+} AsmOperand;
+
+typedef struct AsmInst {
+  uint8_t op;
+  // spaces in front of the line
+  uint8_t indent;
+  // a later instruction reads the flags this one leaves
+  bool flags_live;
+  // in at&t order, the label of ASM_LABEL is the first
+  AsmOperand operands[2];
+  // the line it was decoded from, empty if a rule made it
+  String line;
+} AsmInst;
+
+//////// rules ///////
+// a rule matches instructions at the end of what was emitted
+// so far and replaces them. the first time a pattern operand
+// with a variable is seen it binds what it matched, after that
+// it has to match the same. different register variables are
+// different registers and the size belongs to the pattern.
+// values are immediates or memory that doesn't depend on a
+// bound register or on %rsp
+typedef enum PeepOperandKind {
+  PEEP_NONE,
+  PEEP_REG,
+  PEEP_VALUE,
+  PEEP_IMM,
+  PEEP_LABEL,
+} PeepOperandKind;
+
+enum { VAR_A, VAR_B, VAR_X, VAR_L, NUM_PEEP_VARS };
+
+typedef struct PeepOperand {
+  uint8_t kind;
+  uint8_t var;
+  uint8_t size;
+  int64_t imm;
+} PeepOperand;
+
+typedef struct PeepInst {
+  uint8_t op;
+  PeepOperand operands[2];
+} PeepInst;
+
+typedef struct PeepRule {
+  int len;
+  PeepInst match[4];
+  int num_out;
+  PeepInst out[2];
+  // the flags the replacement sets must never be read
+  bool flags_dead;
+} PeepRule;
+
+#define REG(VAR, SIZE) {.kind = PEEP_REG, .var = VAR, .size = SIZE}
+#define VALUE(VAR) {.kind = PEEP_VALUE, .var = VAR}
+#define IMM(N) {.kind = PEEP_IMM, .imm = N}
+#define LABEL(VAR) {.kind = PEEP_LABEL, .var = VAR}
+
+static const PeepRule peep_rules[NUM_PEEP_RULES] = {
+    // pushq %rax; popq %rax
+    [PEEP_PUSH_POP] = {.len = 2,
+                       .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                 {ASM_POPQ, {REG(VAR_A, 8)}}}},
+    // pushq %rax; popq %rdx -> movq %rax, %rdx
+    [PEEP_PUSH_POP_MOVE] = {.len = 2,
+                            .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                      {ASM_POPQ, {REG(VAR_B, 8)}}},
+                            .num_out = 1,
+                            .out = {{ASM_MOVQ,
+                                     {REG(VAR_A, 8), REG(VAR_B, 8)}}}},
+    // a constant right operand that the operator took as an
+    // immediate: pushq %rax; movl $8, %eax; popq %rax
+    [PEEP_SAVED_DEAD] = {.len = 3,
+                         .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                   {ASM_MOVL, {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                   {ASM_POPQ, {REG(VAR_A, 8)}}}},
+    // the right operand of a binary operator goes through %rax
+    // while the left one waits on the stack:
+    // pushq %rax; movl $1, %eax; movl %eax, %edx; popq %rax
+    // -> movl $1, %edx
+    [PEEP_SAVED_LOAD] = {.len = 4,
+                         .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                   {ASM_MOVL, {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                   {ASM_MOVL, {REG(VAR_A, 4), REG(VAR_B, 4)}},
+                                   {ASM_POPQ, {REG(VAR_A, 8)}}},
+                         .num_out = 1,
+                         .out = {{ASM_MOVL, {VALUE(VAR_X), REG(VAR_B, 4)}}}},
+    [PEEP_SAVED_LOAD_WIDE] = {.len = 4,
+                              .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                        {ASM_MOVL,
+                                         {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                        {ASM_MOVQ,
+                                         {REG(VAR_A, 8), REG(VAR_B, 8)}},
+                                        {ASM_POPQ, {REG(VAR_A, 8)}}},
+                              .num_out = 1,
+                              .out = {{ASM_MOVL,
+                                       {VALUE(VAR_X), REG(VAR_B, 4)}}}},
+    [PEEP_SAVED_QUAD] = {.len = 4,
+                         .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                   {ASM_MOVQ, {VALUE(VAR_X), REG(VAR_A, 8)}},
+                                   {ASM_MOVQ, {REG(VAR_A, 8), REG(VAR_B, 8)}},
+                                   {ASM_POPQ, {REG(VAR_A, 8)}}},
+                         .num_out = 1,
+                         .out = {{ASM_MOVQ, {VALUE(VAR_X), REG(VAR_B, 8)}}}},
+    [PEEP_SAVED_QUAD_LOW] = {.len = 4,
+                             .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                       {ASM_MOVQ,
+                                        {VALUE(VAR_X), REG(VAR_A, 8)}},
+                                       {ASM_MOVL,
+                                        {REG(VAR_A, 4), REG(VAR_B, 4)}},
+                                       {ASM_POPQ, {REG(VAR_A, 8)}}},
+                             .num_out = 1,
+                             .out = {{ASM_MOVL,
+                                      {VALUE(VAR_X), REG(VAR_B, 4)}}}},
+    // pushq %rax; movsbl -1(%rbp), %edx; movl %edx, %eax; popq %rax
+    // -> movsbl -1(%rbp), %edx
+    [PEEP_SAVED_CHAR] = {.len = 4,
+                         .match = {{ASM_PUSHQ, {REG(VAR_A, 8)}},
+                                   {ASM_MOVSBL,
+                                    {VALUE(VAR_X), REG(VAR_B, 4)}},
+                                   {ASM_MOVL, {REG(VAR_B, 4), REG(VAR_A, 4)}},
+                                   {ASM_POPQ, {REG(VAR_A, 8)}}},
+                         .num_out = 1,
+                         .out = {{ASM_MOVSBL,
+                                  {VALUE(VAR_X), REG(VAR_B, 4)}}}},
+    // movl %eax, %edx; movl %edx, %eax only drops the upper half
+    // of %rax, which the load in front of them cleared already
+    [PEEP_MOVE_BACK] = {.len = 3,
+                        .match = {{ASM_MOVL, {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                  {ASM_MOVL, {REG(VAR_A, 4), REG(VAR_B, 4)}},
+                                  {ASM_MOVL, {REG(VAR_B, 4), REG(VAR_A, 4)}}},
+                        .num_out = 2,
+                        .out = {{ASM_MOVL, {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                {ASM_MOVL, {REG(VAR_A, 4), REG(VAR_B, 4)}}}},
+    // the char load of a variable
+    [PEEP_CHAR_MOVE_BACK] = {.len = 3,
+                             .match = {{ASM_MOVSBL,
+                                        {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                       {ASM_MOVL,
+                                        {REG(VAR_A, 4), REG(VAR_B, 4)}},
+                                       {ASM_MOVL,
+                                        {REG(VAR_B, 4), REG(VAR_A, 4)}}},
+                             .num_out = 2,
+                             .out = {{ASM_MOVSBL,
+                                      {VALUE(VAR_X), REG(VAR_A, 4)}},
+                                     {ASM_MOVL,
+                                      {REG(VAR_A, 4), REG(VAR_B, 4)}}}},
+    // same flags, no immediate
+    [PEEP_CMP_ZERO] = {.len = 1,
+                       .match = {{ASM_CMPL, {IMM(0), REG(VAR_A, 4)}}},
+                       .num_out = 1,
+                       .out = {{ASM_TESTL, {REG(VAR_A, 4), REG(VAR_A, 4)}}}},
+    [PEEP_CMP_ZERO_WIDE] = {.len = 1,
+                            .match = {{ASM_CMPQ, {IMM(0), REG(VAR_A, 8)}}},
+                            .num_out = 1,
+                            .out = {{ASM_TESTQ,
+                                     {REG(VAR_A, 8), REG(VAR_A, 8)}}}},
+    // shorter, but xorl sets the flags
+    [PEEP_MOV_ZERO] = {.len = 1,
+                       .match = {{ASM_MOVL, {IMM(0), REG(VAR_A, 4)}}},
+                       .num_out = 1,
+                       .out = {{ASM_XORL, {REG(VAR_A, 4), REG(VAR_A, 4)}}},
+                       .flags_dead = true},
+    // jmp fi3; fi3:
+    [PEEP_JUMP_NEXT] = {.len = 2,
+                        .match = {{ASM_JMP, {LABEL(VAR_L)}},
+                                  {ASM_LABEL, {LABEL(VAR_L)}}},
+                        .num_out = 1,
+                        .out = {{ASM_LABEL, {LABEL(VAR_L)}}}},
+};
+
+static bool asm_operand_equal(AsmOperand *a, AsmOperand *b) {
+  if (a->kind != b->kind) {
+    return false;
+  }
+  switch ((AsmOperandKind)a->kind) {
+  case ASM_REG:
+    return a->reg == b->reg && a->size == b->size;
+  case ASM_IMM:
+    return a->value == b->value;
+  case ASM_MEM:
+    return a->reg == b->reg && a->value == b->value;
+  case ASM_NAME:
+    return a->name.len == b->name.len &&
+           memcmp(a->name.data, b->name.data, a->name.len) == 0;
+  default:
+    return true;
+  }
+}
+
+typedef struct PeepMatch {
+  AsmOperand vars[NUM_PEEP_VARS];
+  bool bound[NUM_PEEP_VARS];
+} PeepMatch;
+
+static bool peep_match_operand(PeepMatch *match, const PeepOperand *pattern,
+                               AsmOperand *operand) {
+  switch ((PeepOperandKind)pattern->kind) {
+  case PEEP_NONE:
+    return operand->kind == ASM_NONE;
+  case PEEP_IMM:
+    return operand->kind == ASM_IMM && operand->value == pattern->imm;
+  case PEEP_REG:
+    if (operand->kind != ASM_REG || operand->size != pattern->size) {
+      return false;
+    }
+    if (match->bound[pattern->var]) {
+      return match->vars[pattern->var].reg == operand->reg;
+    }
+    for (int v = 0; v < NUM_PEEP_VARS; v++) {
+      if (match->bound[v] && match->vars[v].kind == ASM_REG &&
+          match->vars[v].reg == operand->reg) {
+        return false;
+      }
+    }
+    break;
+  case PEEP_VALUE:
+    if (operand->kind == ASM_MEM) {
+      if (operand->reg == ASM_RSP) {
+        return false;
+      }
+      for (int v = 0; v < NUM_PEEP_VARS; v++) {
+        if (match->bound[v] && match->vars[v].kind == ASM_REG &&
+            match->vars[v].reg == operand->reg) {
+          return false;
+        }
+      }
+    } else if (operand->kind != ASM_IMM) {
+      return false;
+    }
+    if (match->bound[pattern->var]) {
+      return asm_operand_equal(&match->vars[pattern->var], operand);
+    }
+    break;
+  case PEEP_LABEL:
+    if (operand->kind != ASM_NAME) {
+      return false;
+    }
+    if (match->bound[pattern->var]) {
+      return asm_operand_equal(&match->vars[pattern->var], operand);
+    }
+    break;
+  }
+  match->vars[pattern->var] = *operand;
+  match->bound[pattern->var] = true;
+  return true;
+}
+
+static AsmOperand peep_make_operand(PeepMatch *match,
+                                    const PeepOperand *pattern) {
+  AsmOperand operand = {.kind = ASM_NONE};
+  switch ((PeepOperandKind)pattern->kind) {
+  case PEEP_NONE:
+    break;
+  case PEEP_IMM:
+    operand.kind = ASM_IMM;
+    operand.value = pattern->imm;
+    break;
+  case PEEP_REG:
+    operand = match->vars[pattern->var];
+    operand.size = pattern->size;
+    break;
+  case PEEP_VALUE:
+  case PEEP_LABEL:
+    operand = match->vars[pattern->var];
+    break;
+  }
+  return operand;
+}
+
+// appends inst to out and applies the first rule that matches
+// the end of out, its replacement is appended the same way
+static void peep_append(AsmInst *out, int *len, AsmInst inst,
+                        uint64_t *hits) {
+  out[(*len)++] = inst;
+  for (int r = 0; r < NUM_PEEP_RULES; r++) {
+    const PeepRule *rule = &peep_rules[r];
+    if (rule->len > *len) {
+      continue;
+    }
+    AsmInst *tail = out + *len - rule->len;
+    PeepMatch match = {0};
+    bool matched = !rule->flags_dead || !tail[rule->len - 1].flags_live;
+    for (int i = 0; i < rule->len && matched; i++) {
+      matched = tail[i].op == rule->match[i].op;
+      for (int o = 0; o < 2 && matched; o++) {
+        matched = peep_match_operand(&match, &rule->match[i].operands[o],
+                                     &tail[i].operands[o]);
+      }
+    }
+    if (!matched) {
+      continue;
+    }
+
+    AsmInst made[2];
+    for (int i = 0; i < rule->num_out; i++) {
+      made[i] = (AsmInst){.op = rule->out[i].op, .indent = tail[0].indent,
+                          .flags_live = tail[rule->len - 1].flags_live};
+      for (int o = 0; o < 2; o++) {
+        made[i].operands[o] =
+            peep_make_operand(&match, &rule->out[i].operands[o]);
+      }
+    }
+    hits[r]++;
+    *len -= rule->len;
+    for (int i = 0; i < rule->num_out; i++) {
+      peep_append(out, len, made[i], hits);
+    }
+    return;
+  }
+}
+
+//////// decoding ///////
+
+static bool asm_parse_int(const char *s, int len, int64_t *value) {
+  int64_t result = 0;
+  bool negative = len > 0 && s[0] == '-';
+  int i = negative ? 1 : 0;
+  if (i == len) {
+    return false;
+  }
+  for (; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    result = result * 10 + (s[i] - '0');
+  }
+  *value = negative ? -result : result;
+  return true;
+}
+
+static bool asm_parse_reg(const char *s, int len, AsmOperand *operand) {
+  for (int r = 0; r < 16; r++) {
+    for (int size = 0; size < 3; size++) {
+      const char *name = asm_reg_names[r][size];
+      if ((int)strlen(name) == len && memcmp(name, s, len) == 0) {
+        operand->kind = ASM_REG;
+        operand->reg = r;
+        operand->size = asm_reg_sizes[size];
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool asm_decode_operand(const char *s, int len, AsmOperand *operand) {
+  while (len > 0 && s[0] == ' ') {
+    s++;
+    len--;
+  }
+  while (len > 0 && s[len - 1] == ' ') {
+    len--;
+  }
+  if (len == 0) {
+    return false;
+  }
+  if (s[0] == '$') {
+    operand->kind = ASM_IMM;
+    return asm_parse_int(s + 1, len - 1, &operand->value);
+  }
+  if (s[0] == '%') {
+    return asm_parse_reg(s, len, operand);
+  }
+  const char *paren = memchr(s, '(', len);
+  if (paren) {
+    int disp = paren - s;
+    if (s[len - 1] != ')' ||
+        !asm_parse_reg(paren + 1, len - disp - 2, operand) ||
+        operand->size != 8) {
+      return false;
+    }
+    operand->kind = ASM_MEM;
+    operand->value = 0;
+    return disp == 0 || asm_parse_int(s, disp, &operand->value);
+  }
+  for (int i = 0; i < len; i++) {
+    char c = s[i];
+    if (!(c == '_' || c == '.' || (c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) {
+      return false;
+    }
+  }
+  operand->kind = ASM_NAME;
+  operand->name = (String){.data = (char *)s, .len = len, .cap = 0};
+  return true;
+}
+
+// lines that aren't understood stay ASM_RAW
+static void asm_decode(const char *line, int len, AsmInst *inst) {
+  *inst = (AsmInst){.op = ASM_RAW};
+  inst->line = (String){.data = (char *)line, .len = len, .cap = 0};
+  int indent = 0;
+  while (indent < len && line[indent] == ' ') {
+    indent++;
+  }
+  int end = len;
+  while (end > indent && line[end - 1] == ' ') {
+    end--;
+  }
+  if (end == indent || indent > UINT8_MAX) {
+    return;
+  }
+  const char *s = line + indent;
+  int n = end - indent;
+
+  AsmInst decoded = {.op = ASM_RAW, .indent = indent, .line = inst->line};
+  if (s[n - 1] == ':') {
+    decoded.op = ASM_LABEL;
+    if (asm_decode_operand(s, n - 1, &decoded.operands[0])) {
+      *inst = decoded;
+    }
+    return;
+  }
+
+  int mnemonic = 0;
+  while (mnemonic < n && s[mnemonic] != ' ') {
+    mnemonic++;
+  }
+  for (int op = ASM_LABEL + 1; op < NUM_ASM_OPS; op++) {
+    const char *name = asm_op_names[op] + 4;
+    if ((int)strlen(name) == mnemonic &&
+        strncasecmp(name, s, mnemonic) == 0) {
+      decoded.op = op;
+      break;
+    }
+  }
+  if (decoded.op == ASM_RAW) {
+    return;
+  }
+
+  // operands are split at the commas outside of parens
+  int num_operands = 0;
+  int start = mnemonic;
+  int depth = 0;
+  for (int i = mnemonic; i <= n; i++) {
+    if (i < n && s[i] == '(') {
+      depth++;
+    } else if (i < n && s[i] == ')') {
+      depth--;
+    } else if (i == n || (s[i] == ',' && depth == 0)) {
+      if (i == n && num_operands == 0 && start == n) {
+        break;
+      }
+      if (num_operands == 2 ||
+          !asm_decode_operand(s + start, i - start,
+                              &decoded.operands[num_operands])) {
+        return;
+      }
+      num_operands++;
+      start = i + 1;
+    }
+  }
+  *inst = decoded;
+}
+
+static void asm_print(FILE *file, AsmInst *inst) {
+  if (inst->line.len > 0 || inst->op == ASM_RAW) {
+    fprintf(file, "%.*s\n", inst->line.len, inst->line.data);
+    return;
+  }
+  fprintf(file, "%*s", inst->indent, "");
+  if (inst->op == ASM_LABEL) {
+    fprintf(file, "%.*s:\n", inst->operands[0].name.len,
+            inst->operands[0].name.data);
+    return;
+  }
+  for (const char *c = asm_op_names[inst->op] + 4; *c; c++) {
+    fputc(*c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c, file);
+  }
+  for (int o = 0; o < 2; o++) {
+    AsmOperand *operand = &inst->operands[o];
+    if (operand->kind == ASM_NONE) {
+      break;
+    }
+    fprintf(file, o == 0 ? " " : ", ");
+    switch ((AsmOperandKind)operand->kind) {
+    case ASM_REG:
+      fprintf(file, "%s",
+              asm_reg_names[operand->reg][operand->size == 8   ? 0
+                                          : operand->size == 4 ? 1
+                                                               : 2]);
+      break;
+    case ASM_IMM:
+      fprintf(file, "$%ld", (long)operand->value);
+      break;
+    case ASM_MEM:
+      if (operand->value != 0) {
+        fprintf(file, "%ld", (long)operand->value);
+      }
+      fprintf(file, "(%s)", asm_reg_names[operand->reg][0]);
+      break;
+    case ASM_NAME:
+      fprintf(file, "%.*s", operand->name.len, operand->name.data);
+      break;
+    case ASM_NONE:
+      break;
+    }
+  }
+  fprintf(file, "\n");
+}
+
+int peephole_run(const char *text, size_t len, FILE *file, uint64_t *hits) {
+  int num_lines = 0;
+  for (size_t i = 0; i < len; i++) {
+    num_lines += text[i] == '\n';
+  }
+  num_lines++;
+  AsmInst *insts = malloc(sizeof(*insts) * num_lines);
+  AsmInst *out = malloc(sizeof(*out) * num_lines);
+  if (!insts || !out) {
+    fprintf(stderr, "couldn't allocate %d assembly lines\n", num_lines);
+    free(insts);
+    free(out);
+    return -1;
+  }
+
+  int num_insts = 0;
+  size_t start = 0;
+  while (start < len) {
+    const char *newline = memchr(text + start, '\n', len - start);
+    size_t end = newline ? (size_t)(newline - text) : len;
+    asm_decode(text + start, end - start, &insts[num_insts++]);
+    start = end + 1;
+  }
+
+  // going backwards, the flags are live until
+  // something before the reader sets them
+  bool live = false;
+  for (int i = num_insts - 1; i >= 0; i--) {
+    insts[i].flags_live = live;
+    switch (asm_op_flags[insts[i].op]) {
+    case ASM_FLAGS_READ:
+      live = true;
+      break;
+    case ASM_FLAGS_WRITE:
+    case ASM_FLAGS_END:
+      live = false;
+      break;
+    default:
+      break;
+    }
+  }
+
+  int num_out = 0;
+  for (int i = 0; i < num_insts; i++) {
+    peep_append(out, &num_out, insts[i], hits);
+  }
+  for (int i = 0; i < num_out; i++) {
+    asm_print(file, &out[i]);
+  }
+  free(insts);
+  free(out);
+  return 0;
+}
+
+void peephole_print_stats(uint64_t *hits, FILE *file) {
+  static const char *names[] = {FOREACH_PEEP_RULE(GENERATE_STRING)};
+  uint64_t total = 0;
+  fprintf(file, "peephole rules:\n");
+  for (int r = 0; r < NUM_PEEP_RULES; r++) {
+    // PEEP_PUSH_POP prints as push_pop
+    fprintf(file, "  ");
+    for (const char *c = names[r] + 5; *c; c++) {
+      fputc(*c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c, file);
+    }
+    fprintf(file, ": %llu\n", (unsigned long long)hits[r]);
+    total += hits[r];
+  }
+  fprintf(file, "%llu instructions rewritten\n", (unsigned long long)total);
+}
@@ -0,0 +1,34 @@
+#ifndef MY_PEEPHOLE_H
+#define MY_PEEPHOLE_H
+
+//////// peephole optimizer ////////
+// the emitted assembly is decoded into instructions with typed
+// operands and every rule replaces a short sequence of them
+// by a cheaper one. rules are data, see peep_rules in peephole.c
+#define FOREACH_PEEP_RULE(MACRO)                                               \
+  MACRO(PEEP_PUSH_POP)                                                         \
+  MACRO(PEEP_PUSH_POP_MOVE)                                                    \
+  MACRO(PEEP_SAVED_DEAD)                                                       \
+  MACRO(PEEP_SAVED_LOAD)                                                       \
+  MACRO(PEEP_SAVED_LOAD_WIDE)                                                  \
+  MACRO(PEEP_SAVED_QUAD)                                                       \
+  MACRO(PEEP_SAVED_QUAD_LOW)                                                   \
+  MACRO(PEEP_SAVED_CHAR)                                                       \
+  MACRO(PEEP_MOVE_BACK)                                                        \
+  MACRO(PEEP_CHAR_MOVE_BACK)                                                   \
+  MACRO(PEEP_CMP_ZERO)                                                         \
+  MACRO(PEEP_CMP_ZERO_WIDE)                                                    \
+  MACRO(PEEP_MOV_ZERO)                                                         \
+  MACRO(PEEP_JUMP_NEXT)
+
+typedef enum PeepRuleKind {
+  FOREACH_PEEP_RULE(GENERATE_ENUM) NUM_PEEP_RULES
+} PeepRuleKind;
+
+// writes the optimized text to file and adds the number of
+// times every rule was applied to hits. returns -1 if the
+// text couldn't be decoded, nothing is written then
+int  peephole_run(const char *text, size_t len, FILE *file, uint64_t *hits);
+void peephole_print_stats(uint64_t *hits, FILE *file);
+
+#endif
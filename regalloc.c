@@ -0,0 +1,479 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//////// register allocation ///////
+// linear scan (poletto and sarkar): every value gets one live
+// interval over the instructions in layout order, the intervals
+// are visited by their start and when all registers are taken
+// the one that ends last goes to the stack. only callee saved
+// registers are handed out, the emitter keeps %rax, %rcx
+// and %rdx for itself
+static const AssemblyRegisterType alloc_regs[] = {RBX, R12, R13, R14};
+#define NUM_ALLOC_REGS ((int)(sizeof(alloc_regs) / sizeof(*alloc_regs)))
+
+// slots of scalar locals that are only accessed whole and share
+// no byte with another slot become values that are assigned with
+// copies. loads of them are dropped if the variable isn't
+// assigned again before the loaded value is used
+int ir_promote_locals(Parser *parser, IrFunc *fn) {
+  Arena *arena = &parser->arena;
+  int num_slots = fn->num_slots;
+  if (num_slots == 0) {
+    return 0;
+  }
+  int *var_of = arena_alloc(arena, sizeof(int) * num_slots);
+  uint64_t *order = arena_alloc(arena, sizeof(uint64_t) * num_slots);
+  if (!var_of || !order) {
+    fprintf(stderr, "couldn't allocate local promotion\n");
+    return -1;
+  }
+
+  // slot i covers the bytes from -offset up to -offset + size,
+  // sorted by their lowest address
+  for (int i = 0; i < num_slots; i++) {
+    IrSlot *slot = &fn->slots[i];
+    bool scalar = slot->size == 1 || slot->size == 4 || slot->size == 8;
+    var_of[i] = scalar ? 0 : IR_NONE;
+    order[i] = (uint64_t)(INT32_MAX - slot->offset) << 32 | (uint32_t)i;
+  }
+  qsort(order, num_slots, sizeof(*order), compare_u64);
+  int max_end = INT32_MIN;
+  for (int k = 0; k < num_slots; k++) {
+    IrSlot *slot = &fn->slots[(uint32_t)order[k]];
+    int start = -slot->offset;
+    int end = start + slot->size;
+    if (start < max_end) {
+      var_of[(uint32_t)order[k]] = IR_NONE;
+    }
+    if (k + 1 < num_slots &&
+        end > -fn->slots[(uint32_t)order[k + 1]].offset) {
+      var_of[(uint32_t)order[k]] = IR_NONE;
+    }
+    if (end > max_end) {
+      max_end = end;
+    }
+  }
+
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      if (inst->slot != IR_NONE &&
+          (inst->imm != 0 || inst->width != fn->slots[inst->slot].size)) {
+        var_of[inst->slot] = IR_NONE;
+      }
+    }
+  }
+
+  int first_var = fn->num_values;
+  for (int i = 0; i < num_slots; i++) {
+    if (var_of[i] == IR_NONE) {
+      continue;
+    }
+    var_of[i] = ir_add_value(parser, fn,
+                             fn->slots[i].size == 8 ? IR_I64 : IR_I32);
+    if (var_of[i] < 0) {
+      return -1;
+    }
+  }
+  if (fn->num_values == first_var) {
+    return 0;
+  }
+
+  int num_values = fn->num_values;
+  int *rename = arena_alloc(arena, sizeof(int) * num_values);
+  int *last_use = arena_alloc(arena, sizeof(int) * num_values);
+  int *next_def = arena_alloc(arena, sizeof(int) * num_values);
+  if (!rename || !last_use || !next_def) {
+    fprintf(stderr, "couldn't allocate local promotion\n");
+    return -1;
+  }
+  for (int v = 0; v < num_values; v++) {
+    rename[v] = v;
+    last_use[v] = -1;
+    next_def[v] = INT32_MAX;
+  }
+
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      if (inst->slot == IR_NONE || var_of[inst->slot] == IR_NONE) {
+        continue;
+      }
+      int var = var_of[inst->slot];
+      if (inst->op == IR_LOAD) {
+        inst->op = IR_COPY;
+        inst->a = var;
+        inst->width = 0;
+      } else {
+        inst->op = IR_COPY;
+        inst->type = fn->types[var];
+        inst->dst = var;
+      }
+      inst->slot = IR_NONE;
+      inst->imm = 0;
+    }
+
+    // temporaries never leave their block
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      if (inst->a != IR_NONE) {
+        last_use[inst->a] = i;
+      }
+      if (inst->b != IR_NONE) {
+        last_use[inst->b] = i;
+      }
+    }
+    // a loaded variable is read directly if its next
+    // assignment comes after the last use of the load
+    for (int i = block->len - 1; i >= 0; i--) {
+      IrInst *inst = &block->insts[i];
+      if (inst->op == IR_COPY && inst->width == 0 && inst->a >= first_var &&
+          inst->dst < first_var && next_def[inst->a] >= last_use[inst->dst]) {
+        rename[inst->dst] = inst->a;
+        inst->dst = IR_NONE;
+      }
+      if (inst->dst >= first_var) {
+        next_def[inst->dst] = i;
+      }
+    }
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      if (inst->dst >= first_var) {
+        next_def[inst->dst] = INT32_MAX;
+      }
+    }
+  }
+
+  // last_use counts the uses from here on
+  for (int v = 0; v < num_values; v++) {
+    last_use[v] = 0;
+  }
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    int len = 0;
+    for (int i = 0; i < block->len; i++) {
+      IrInst inst = block->insts[i];
+      if (inst.op == IR_COPY && inst.dst == IR_NONE) {
+        continue;
+      }
+      if (inst.a != IR_NONE) {
+        inst.a = rename[inst.a];
+        last_use[inst.a]++;
+      }
+      if (inst.b != IR_NONE) {
+        inst.b = rename[inst.b];
+        last_use[inst.b]++;
+      }
+      block->insts[len++] = inst;
+    }
+    block->len = len;
+  }
+
+  // a result that is only assigned to a variable
+  // right away is computed in the variable
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    int len = 0;
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      IrInst *next = i + 1 < block->len ? &block->insts[i + 1] : NULL;
+      if (next && next->op == IR_COPY && next->dst >= first_var &&
+          inst->dst != IR_NONE && inst->dst < first_var &&
+          next->a == inst->dst && last_use[inst->dst] == 1 &&
+          fn->types[inst->dst] == fn->types[next->dst] &&
+          next->width == (fn->types[next->dst] == IR_I64 ? 8 : 4)) {
+        inst->dst = next->dst;
+        block->insts[len++] = *inst;
+        i++;
+        continue;
+      }
+      block->insts[len++] = *inst;
+    }
+    block->len = len;
+  }
+  return 0;
+}
+
+// values that are used in another block than the one
+// that defines them get their liveness from the cfg
+typedef struct Liveness {
+  int num_globals;
+  int words;
+  // value -> global index or -1, global index -> value
+  int *global_of;
+  int *values;
+  // per block, words each
+  uint64_t *use;
+  uint64_t *def;
+  uint64_t *in;
+  uint64_t *out;
+} Liveness;
+
+#define BIT_SET(SET, I) ((SET)[(I) / 64] |= (uint64_t)1 << ((I) % 64))
+#define BIT_GET(SET, I) (((SET)[(I) / 64] >> ((I) % 64)) & 1)
+
+static int liveness_compute(Parser *parser, IrFunc *fn, Liveness *live) {
+  Arena *arena = &parser->arena;
+  int num_values = fn->num_values;
+  int num_blocks = fn->num_blocks;
+  int *def_block = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  live->global_of = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  live->values = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  if (!def_block || !live->global_of || !live->values) {
+    fprintf(stderr, "couldn't allocate liveness\n");
+    return -1;
+  }
+  for (int v = 0; v < num_values; v++) {
+    def_block[v] = IR_NONE;
+    live->global_of[v] = IR_NONE;
+  }
+
+  // values read before any definition in the block
+  // or defined in more than one block are global
+  live->num_globals = 0;
+  for (int b = 0; b < num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      int operands[3] = {inst->a, inst->b, inst->dst};
+      for (int o = 0; o < 3; o++) {
+        int v = operands[o];
+        if (v == IR_NONE || ir_is_const(fn, v) ||
+            live->global_of[v] != IR_NONE) {
+          continue;
+        }
+        if (o == 2 && def_block[v] == IR_NONE) {
+          def_block[v] = b;
+        } else if (def_block[v] != b) {
+          live->values[live->num_globals] = v;
+          live->global_of[v] = live->num_globals++;
+        }
+      }
+    }
+  }
+
+  live->words = (live->num_globals + 63) / 64;
+  size_t set_size = sizeof(uint64_t) * live->words * num_blocks;
+  live->use = arena_alloc(arena, set_size + 8);
+  live->def = arena_alloc(arena, set_size + 8);
+  live->in = arena_alloc(arena, set_size + 8);
+  live->out = arena_alloc(arena, set_size + 8);
+  if (!live->use || !live->def || !live->in || !live->out) {
+    fprintf(stderr, "couldn't allocate liveness sets\n");
+    return -1;
+  }
+  memset(live->use, 0, set_size);
+  memset(live->def, 0, set_size);
+  memset(live->in, 0, set_size);
+  memset(live->out, 0, set_size);
+  if (live->num_globals == 0) {
+    return 0;
+  }
+
+  for (int b = 0; b < num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    uint64_t *use = live->use + b * live->words;
+    uint64_t *def = live->def + b * live->words;
+    for (int i = 0; i < block->len; i++) {
+      IrInst *inst = &block->insts[i];
+      int operands[2] = {inst->a, inst->b};
+      for (int o = 0; o < 2; o++) {
+        int g = operands[o] == IR_NONE ? IR_NONE : live->global_of[operands[o]];
+        if (g != IR_NONE && !BIT_GET(def, g)) {
+          BIT_SET(use, g);
+        }
+      }
+      if (inst->dst != IR_NONE && live->global_of[inst->dst] != IR_NONE) {
+        BIT_SET(def, live->global_of[inst->dst]);
+      }
+    }
+  }
+
+  // blocks are mostly in forward order, so
+  // going backwards converges in a few rounds
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = num_blocks - 1; b >= 0; b--) {
+      IrBlock *block = &fn->blocks[b];
+      uint64_t *in = live->in + b * live->words;
+      uint64_t *out = live->out + b * live->words;
+      uint64_t *use = live->use + b * live->words;
+      uint64_t *def = live->def + b * live->words;
+      for (int w = 0; w < live->words; w++) {
+        uint64_t word = 0;
+        for (int s = 0; s < 2; s++) {
+          if (block->succ[s] != IR_NONE) {
+            word |= live->in[block->succ[s] * live->words + w];
+          }
+        }
+        out[w] = word;
+        word = use[w] | (word & ~def[w]);
+        if (word != in[w]) {
+          in[w] = word;
+          changed = true;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// assigns registers to the values, the others get a home
+// on the stack. fills regs, used_regs, homes and num_homes.
+// constants are immediates and get neither
+int ir_allocate_registers(Parser *parser, IrFunc *fn) {
+  Arena *arena = &parser->arena;
+  int num_values = fn->num_values;
+
+  Liveness live;
+  if (liveness_compute(parser, fn, &live) < 0) {
+    return -1;
+  }
+
+  int *start = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  int *end = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  uint64_t *order = arena_alloc(arena, sizeof(uint64_t) * (num_values + 1));
+  uint64_t *spilled = arena_alloc(arena, sizeof(uint64_t) * (num_values + 1));
+  int *free_homes = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  int *live_homes = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  fn->regs = arena_alloc(arena, sizeof(uint8_t) * (num_values + 1));
+  fn->homes = arena_alloc(arena, sizeof(int) * (num_values + 1));
+  if (!start || !end || !order || !spilled || !free_homes || !live_homes ||
+      !fn->regs || !fn->homes) {
+    fprintf(stderr, "couldn't allocate live intervals\n");
+    return -1;
+  }
+  for (int v = 0; v < num_values; v++) {
+    start[v] = INT32_MAX;
+    end[v] = -1;
+    fn->regs[v] = IR_NO_REG;
+    fn->homes[v] = IR_NONE;
+  }
+
+  // one interval from the first to the last position a value
+  // is live at, including the blocks it is live through
+  int pos = 0;
+  for (int b = 0; b < fn->num_blocks; b++) {
+    IrBlock *block = &fn->blocks[b];
+    int first = pos;
+    for (int i = 0; i < block->len; i++, pos++) {
+      IrInst *inst = &block->insts[i];
+      int operands[3] = {inst->a, inst->b, inst->dst};
+      for (int o = 0; o < 3; o++) {
+        int v = operands[o];
+        if (v == IR_NONE || ir_is_const(fn, v)) {
+          continue;
+        }
+        if (pos < start[v]) {
+          start[v] = pos;
+        }
+        if (pos > end[v]) {
+          end[v] = pos;
+        }
+      }
+    }
+    int last = pos - 1;
+    uint64_t *in = live.in + b * live.words;
+    uint64_t *out = live.out + b * live.words;
+    for (int g = 0; g < live.num_globals; g++) {
+      int v = live.values[g];
+      if (BIT_GET(in, g)) {
+        if (first < start[v]) {
+          start[v] = first;
+        }
+        if (first > end[v]) {
+          end[v] = first;
+        }
+      }
+      if (BIT_GET(out, g) && last > end[v]) {
+        end[v] = last;
+      }
+    }
+  }
+
+  int num_order = 0;
+  for (int v = 0; v < num_values; v++) {
+    if (end[v] >= 0) {
+      order[num_order++] = (uint64_t)start[v] << 32 | (uint32_t)v;
+    }
+  }
+  qsort(order, num_order, sizeof(*order), compare_u64);
+
+  // an operand that dies at an instruction can hand its
+  // register to the result, the emitter reads first
+  int active[NUM_ALLOC_REGS];
+  int num_active = 0;
+  int num_spilled = 0;
+  bool taken[NUM_ALLOC_REGS] = {false};
+  fn->used_regs = 0;
+  for (int k = 0; k < num_order; k++) {
+    int v = (uint32_t)order[k];
+    for (int j = 0; j < num_active;) {
+      int a = active[j];
+      if (end[a] <= start[v]) {
+        for (int r = 0; r < NUM_ALLOC_REGS; r++) {
+          if (alloc_regs[r] == fn->regs[a]) {
+            taken[r] = false;
+          }
+        }
+        active[j] = active[--num_active];
+      } else {
+        j++;
+      }
+    }
+
+    if (num_active < NUM_ALLOC_REGS) {
+      int r = 0;
+      while (taken[r]) {
+        r++;
+      }
+      taken[r] = true;
+      fn->regs[v] = alloc_regs[r];
+      fn->used_regs |= 1u << alloc_regs[r];
+      active[num_active++] = v;
+      continue;
+    }
+
+    int furthest = 0;
+    for (int j = 1; j < num_active; j++) {
+      if (end[active[j]] > end[active[furthest]]) {
+        furthest = j;
+      }
+    }
+    int victim = active[furthest];
+    if (end[victim] > end[v]) {
+      fn->regs[v] = fn->regs[victim];
+      fn->regs[victim] = IR_NO_REG;
+      active[furthest] = v;
+      spilled[num_spilled++] = (uint64_t)start[victim] << 32 | victim;
+    } else {
+      spilled[num_spilled++] = (uint64_t)start[v] << 32 | v;
+    }
+  }
+
+  // the spilled values share homes the same way
+  qsort(spilled, num_spilled, sizeof(*spilled), compare_u64);
+  int num_free = 0;
+  int num_live = 0;
+  fn->num_homes = 0;
+  for (int k = 0; k < num_spilled; k++) {
+    int v = (uint32_t)spilled[k];
+    for (int j = 0; j < num_live;) {
+      int a = live_homes[j];
+      if (end[a] <= start[v]) {
+        free_homes[num_free++] = fn->homes[a];
+        live_homes[j] = live_homes[--num_live];
+      } else {
+        j++;
+      }
+    }
+    fn->homes[v] = num_free > 0 ? free_homes[--num_free] : fn->num_homes++;
+    live_homes[num_live++] = v;
+  }
+  return 0;
+}
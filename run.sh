@@ -6,7 +6,7 @@
 # compilation speed is quite good
 
 # compile the compiler A
-gcc -ggdb  main.c lex.c var.c parser.c file.c str.c dep.c table.c gen.c
+gcc -ggdb  main.c lex.c var.c parser.c file.c str.c dep.c table.c gen.c arena.c flat.c walk.c ir.c regalloc.c fold.c peephole.c strength.c licm.c -pthread
 
 # run the generated compiler A
 # with a test file
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 
 ////////////// string /////////////////////////////////
@@ -111,143 +112,414 @@ StrSlice str_slice_from_uint64(uint64_t slice) {
 
 
 
+//////////// string chunks //////////////////////////////
+
+int str_chunks_init(StrChunks *chunks) {
+  chunks->len = 0;
+  chunks->cap = 16;
+  chunks->used = 0;
+  chunks->chunks = malloc(sizeof(*chunks->chunks) * chunks->cap);
+  chunks->mapped = malloc(sizeof(*chunks->mapped) * chunks->cap);
+  if (!chunks->chunks || !chunks->mapped) {
+    fprintf(stderr, "couldn't initialize string chunks with cap %d\n",
+            chunks->cap);
+    free(chunks->chunks);
+    free(chunks->mapped);
+    return -1;
+  }
+  return 0;
+}
+
+void str_chunks_quit(StrChunks *chunks) {
+  for (unsigned i = 0; i < chunks->len; i++) {
+    if (chunks->mapped[i]) {
+      munmap(chunks->chunks[i], chunks->mapped[i]);
+    }
+  }
+  free(chunks->chunks);
+  free(chunks->mapped);
+  chunks->chunks = NULL;
+  chunks->mapped = NULL;
+  chunks->len = 0;
+  chunks->cap = 0;
+  chunks->used = 0;
+}
+
+// maps size bytes aligned to the chunk size
+// so that the kernel can back them with huge pages
+char *str_chunks_map(size_t size) {
+  size_t mapsize = size + STR_CHUNK_SIZE;
+  char *data = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  uintptr_t addr = (uintptr_t)data;
+  uintptr_t aligned = (addr + STR_CHUNK_SIZE - 1) & ~(uintptr_t)(STR_CHUNK_SIZE - 1);
+  size_t head = aligned - addr;
+  if (head) {
+    munmap(data, head);
+  }
+  size_t tail = mapsize - head - size;
+  if (tail) {
+    munmap((char *)aligned + size, tail);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise((char *)aligned, size, MADV_HUGEPAGE);
+#endif
+  return (char *)aligned;
+}
+
+// appends a mapping that spans num_chunks chunk slots
+int str_chunks_add(StrChunks *chunks, unsigned num_chunks) {
+  if (chunks->len + num_chunks > chunks->cap) {
+    unsigned newcap = chunks->cap * 2 + num_chunks;
+    char **newchunks = realloc(chunks->chunks, sizeof(*newchunks) * newcap);
+    if (!newchunks) {
+      fprintf(stderr, "couldn't grow string chunk list to %d\n", newcap);
+      return -1;
+    }
+    chunks->chunks = newchunks;
+    size_t *newmapped = realloc(chunks->mapped, sizeof(*newmapped) * newcap);
+    if (!newmapped) {
+      fprintf(stderr, "couldn't grow string chunk list to %d\n", newcap);
+      return -1;
+    }
+    chunks->mapped = newmapped;
+    chunks->cap = newcap;
+  }
+  size_t size = (size_t)num_chunks * STR_CHUNK_SIZE;
+  char *data = str_chunks_map(size);
+  if (!data) {
+    fprintf(stderr, "couldn't map string chunk of %zu bytes\n", size);
+    return -1;
+  }
+  for (unsigned i = 0; i < num_chunks; i++) {
+    chunks->chunks[chunks->len + i] = data + (size_t)i * STR_CHUNK_SIZE;
+    chunks->mapped[chunks->len + i] = 0;
+  }
+  chunks->mapped[chunks->len] = size;
+  chunks->len += num_chunks;
+  chunks->used = 0;
+  return 0;
+}
+
+int str_chunks_push(StrChunks *chunks, const char *input, unsigned len,
+                    StrSlice *slice) {
+  bool new_chunk = chunks->len == 0 || chunks->used + len > STR_CHUNK_SIZE;
+  uint64_t start = new_chunk ? (uint64_t)chunks->len * STR_CHUNK_SIZE
+                             : (uint64_t)(chunks->len - 1) * STR_CHUNK_SIZE +
+                                   chunks->used;
+  // slices address the bytes with 32 bits
+  if (start + len > UINT32_MAX) {
+    fprintf(stderr, "interned strings exceed %u bytes\n", UINT32_MAX);
+    return -1;
+  }
+  if (new_chunk) {
+    // strings longer than a chunk get a mapping of their own
+    // that takes up multiple chunk slots
+    unsigned num_chunks = len / STR_CHUNK_SIZE + 1;
+    if (str_chunks_add(chunks, num_chunks) < 0) {
+      return -1;
+    }
+    // the following strings continue after it
+    // in the last slot of the mapping
+    chunks->used = len - (num_chunks - 1) * STR_CHUNK_SIZE;
+    memcpy(chunks->chunks[chunks->len - num_chunks], input, len);
+    slice->start = start;
+    slice->len = len;
+    return 0;
+  }
+  memcpy(chunks->chunks[chunks->len - 1] + chunks->used, input, len);
+  chunks->used += len;
+  slice->start = start;
+  slice->len = len;
+  return 0;
+}
+
+String str_chunks_get(StrChunks *chunks, StrSlice slice) {
+  String result = {.cap = 0, .len = slice.len};
+  unsigned chunk = slice.start / STR_CHUNK_SIZE;
+  if (chunk >= chunks->len) {
+    result.data = NULL;
+    result.len = 0;
+    return result;
+  }
+  result.data = chunks->chunks[chunk] + slice.start % STR_CHUNK_SIZE;
+  return result;
+}
+
 //////////// string interning //////////////////////////////
 
-int str_interner_init(StringInterner *interner, int cap) {
-  interner->cap = cap;
-  interner->count = 0;
-  interner->meta = malloc(sizeof(*interner->meta) * interner->cap);
-  if (!interner->meta) {
+int str_interner_alloc_table(StringInternerEntry **entries, uint8_t **meta,
+                             unsigned cap) {
+  *meta = malloc(sizeof(**meta) * cap);
+  if (!*meta) {
     fprintf(stderr, "couldn't initialize stringinterner meta data (cap:%d)\n",
-            interner->cap);
+            cap);
     return -1;
   }
-  for(int i=0; i<interner->cap; i++){
-    interner->meta[i] = STR_INTERNER_SLOT_EMPTY;
+  for(unsigned i=0; i<cap; i++){
+    (*meta)[i] = STR_INTERNER_SLOT_EMPTY;
   }
-  interner->entries = malloc(sizeof(*interner->entries) * interner->cap);
-  if (!interner->entries) {
+  *entries = malloc(sizeof(**entries) * cap);
+  if (!*entries) {
     fprintf(stderr, "couldn't initialize stringinterner entries\n");
-    free(interner->meta);
+    free(*meta);
+    return -1;
+  }
+  return 0;
+}
+
+int str_interner_init(StringInterner *interner, int cap) {
+  interner->cap = cap;
+  interner->count = 0;
+  interner->old_entries = NULL;
+  interner->old_meta = NULL;
+  interner->old_cap = 0;
+  interner->migrated = 0;
+  interner->symbols_cap = cap;
+  interner->symbols = malloc(sizeof(*interner->symbols) * interner->symbols_cap);
+  if (!interner->symbols) {
+    fprintf(stderr, "couldn't initialize stringinterner symbols\n");
     return -1;
   }
-  return str_init(&interner->string, 1024);
+  interner->symbols[SYMBOL_NONE].start = 0;
+  interner->symbols[SYMBOL_NONE].len = 0;
+  int status = str_interner_alloc_table(&interner->entries, &interner->meta,
+                                        interner->cap);
+  if (status < 0) {
+    return status;
+  }
+  return str_chunks_init(&interner->string);
 }
 
 unsigned hash_index(uint64_t hash){ return hash >> 7; }
 unsigned hash_meta(uint64_t hash) { return hash & ((1 << 7) - 1); }
 
-
-StrSlice str_interner_set(StringInterner *interner, String str) {
-  uint64_t hash  = str_hash(&str);
+// looks up str in a single table.
+// returns the slot index if it is found, otherwise -1
+// and *free_slot is the slot where it would be inserted
+// (or -1 if the table has no free slot at all). tables
+// stay at most half full, so probing runs into a free
+// slot long before it has seen all of them
+int str_interner_table_find(StringInterner *interner,
+                            StringInternerEntry *entries, uint8_t *metas,
+                            unsigned cap, String str, uint64_t hash,
+                            int *free_slot) {
   uint8_t  meta  = hash_meta(hash);
-  unsigned index = hash_index(hash) % interner->cap;
-  int      attempts = 0;
-  int      maxAttempts = 40;
-  while(attempts < maxAttempts){
-    uint8_t current_meta = interner->meta[index];
+  unsigned index = hash_index(hash) % cap;
+  unsigned attempts = 0;
+  *free_slot = -1;
+  while(attempts < cap){
+    uint8_t current_meta = metas[index];
     if (current_meta == meta){
-      StringInternerEntry *entry = &interner->entries[index];
-      String istr = str_from_slice(interner->string, entry->slice);
+      String istr = str_chunks_get(&interner->string, entries[index].slice);
       if (str_equals(istr, str)) {
-        return entry->slice;
+        return index;
       }
     } else if (current_meta == STR_INTERNER_SLOT_EMPTY) {
-
-      StringInternerEntry *entry = &interner->entries[index];
-      int start = interner->string.len;
-      int len = str.len;
-      str_push(&interner->string, str.data, str.len);
-      entry->slice.start = start;
-      entry->slice.len = len;
-      entry->hash = hash;
-      interner->meta[index] = meta;
-      interner->count++;
-      return entry->slice;
+      *free_slot = index;
+      return -1;
     }
     attempts += 1;
-    index = (index + 1) % interner->cap;
+    index = (index + 1) % cap;
   }
-  fprintf(stderr, "string interner put slot exceeded %d attemps\n", attempts);
-  StrSlice result = {};
-  return result;
+  return -1;
 }
 
+SymbolId str_interner_set(StringInterner *interner, String str) {
+  uint64_t hash  = str_hash(&str);
+  int free_slot;
+  int found = str_interner_table_find(interner, interner->entries,
+                                      interner->meta, interner->cap, str,
+                                      hash, &free_slot);
+  if (found >= 0) {
+    return interner->entries[found].id;
+  }
+
+  // not moved yet, so it can still
+  // be in the table that is being resized
+  if (interner->old_entries) {
+    int old_free_slot;
+    int old_found = str_interner_table_find(
+        interner, interner->old_entries, interner->old_meta,
+        interner->old_cap, str, hash, &old_free_slot);
+    if (old_found >= 0) {
+      return interner->old_entries[old_found].id;
+    }
+  }
+
+  if (free_slot < 0) {
+    fprintf(stderr, "string interner put slot exceeded max attemps\n");
+    return SYMBOL_NONE;
+  }
+
+  SymbolId id = interner->count + 1;
+  if (id >= interner->symbols_cap) {
+    unsigned newcap = interner->symbols_cap * 2;
+    StrSlice *newsymbols =
+        realloc(interner->symbols, sizeof(*interner->symbols) * newcap);
+    if (!newsymbols) {
+      fprintf(stderr, "couldn't grow string interner symbols to %d\n", newcap);
+      return SYMBOL_NONE;
+    }
+    interner->symbols = newsymbols;
+    interner->symbols_cap = newcap;
+  }
+
+  StringInternerEntry *entry = &interner->entries[free_slot];
+  if (str_chunks_push(&interner->string, str.data, str.len, &entry->slice) < 0) {
+    return SYMBOL_NONE;
+  }
+  entry->hash = hash;
+  entry->id = id;
+  interner->meta[free_slot] = hash_meta(hash);
+  interner->symbols[id] = entry->slice;
+  interner->count++;
+  return id;
+}
+
+// moves up to num_slots slots of the old table into the new one
+// and frees the old table once everything has been moved
+void str_interner_migrate(StringInterner *interner, unsigned num_slots) {
+  if (!interner->old_entries) {
+    return;
+  }
+  unsigned end = interner->migrated + num_slots;
+  if (end > interner->old_cap) {
+    end = interner->old_cap;
+  }
+  for (unsigned i = interner->migrated; i < end; i++) {
+    if (interner->old_meta[i] == STR_INTERNER_SLOT_EMPTY) {
+      continue;
+    }
+    StringInternerEntry entry = interner->old_entries[i];
+    // the new table is twice as big as the old
+    // one, so every entry finds a free slot
+    unsigned index = hash_index(entry.hash) % interner->cap;
+    while (interner->meta[index] != STR_INTERNER_SLOT_EMPTY) {
+      index = (index + 1) % interner->cap;
+    }
+    interner->meta[index] = hash_meta(entry.hash);
+    interner->entries[index] = entry;
+  }
+  interner->migrated = end;
+
+  if (interner->migrated >= interner->old_cap) {
+    free(interner->old_meta);
+    free(interner->old_entries);
+    interner->old_meta = NULL;
+    interner->old_entries = NULL;
+    interner->old_cap = 0;
+    interner->migrated = 0;
+  }
+}
 
+// starts an incremental resize: the current table becomes
+// the old one and all new strings go into a table of twice the size
 int str_interner_resize(StringInterner *interner) {
-  int status = 0;
-  StringInterner newinterner;
+  if (interner->old_entries) {
+    // the previous resize must be done
+    // before the next one can start
+    str_interner_migrate(interner, interner->old_cap);
+  }
+  StringInternerEntry *newentries;
+  uint8_t *newmeta;
   int newcap = interner->cap * 2;
-  printf("resizing interner newcap %d \n", newcap);
-  status = str_interner_init(&newinterner, newcap);
+  int status = str_interner_alloc_table(&newentries, &newmeta, newcap);
   if (status < 0) {
     fprintf(stderr, "couldnt resize string interner\n");
     return -2;
   }
-  str_quit(&newinterner.string);
-  int maxAttempts = 30;
-  for (int i = 0; i < interner->cap; i++) {
-    if (interner->meta[i] != STR_INTERNER_SLOT_EMPTY) {
-      StringInternerEntry entry = interner->entries[i];
-      uint64_t hash = entry.hash;
-      uint8_t  meta  = hash_meta(hash);
-      unsigned index = hash_index(hash) % newcap;
-
-      int numAttempts = 0;
-      while(newinterner.meta[index] != STR_INTERNER_SLOT_EMPTY && numAttempts < maxAttempts){
-        index = (index + 1) % newcap;
-        numAttempts++;
-      }
-      if(numAttempts >= maxAttempts){
-        fprintf(stderr, "resize numAttempts %d exceeded maxAttemtps %d\n", numAttempts, maxAttempts);
-      }
-      newinterner.meta[index] = meta;
-      newinterner.entries[index] = entry;
-    }
-  }
-  free(interner->meta);
-  free(interner->entries);
+  interner->old_entries = interner->entries;
+  interner->old_meta = interner->meta;
+  interner->old_cap = interner->cap;
+  interner->migrated = 0;
+  interner->entries = newentries;
+  interner->meta = newmeta;
   interner->cap = newcap;
-  interner->entries = newinterner.entries;
-  interner->meta = newinterner.meta;
   return 0;
 }
 
 
 String str_interner_get(StringInterner *interner, StrSlice slice){
-  return str_from_slice(interner->string, slice);
+  return str_chunks_get(&interner->string, slice);
 }
 
-StrSlice str_interner_put(StringInterner *interner, String str) {
-  if (interner->count + 10 >= interner->cap) {
+SymbolId str_interner_intern(StringInterner *interner, String str) {
+  if (interner->old_entries == NULL && interner->count * 2 >= interner->cap) {
     str_interner_resize(interner);
   }
+  str_interner_migrate(interner, STR_INTERNER_MIGRATE_STEP);
   return str_interner_set(interner, str);
 }
 
-void str_interner_print(StringInterner *interner) {
-  for (int i = 0; i < interner->cap; i++) {
-    uint8_t meta = interner->meta[i];
+StrSlice str_interner_put(StringInterner *interner, String str) {
+  return str_interner_slice(interner, str_interner_intern(interner, str));
+}
+
+StrSlice str_interner_slice(StringInterner *interner, SymbolId id) {
+  if (id > interner->count) {
+    return interner->symbols[SYMBOL_NONE];
+  }
+  return interner->symbols[id];
+}
+
+String str_interner_symbol(StringInterner *interner, SymbolId id) {
+  return str_interner_get(interner, str_interner_slice(interner, id));
+}
+
+void str_interner_print_table(StringInterner *interner,
+                              StringInternerEntry *entries, uint8_t *metas,
+                              unsigned cap) {
+  for (unsigned i = 0; i < cap; i++) {
+    uint8_t meta = metas[i];
     if (meta == STR_INTERNER_SLOT_EMPTY) {
-      printf("%d\t.. \n", i);
+      printf("%u\t.. \n", i);
     } else {
-      StringInternerEntry entry = interner->entries[i];
-      printf("%d\tmeta:%d hash:%lu start:%d len:%d %.*s \n", i, meta,
-             entry.hash, entry.slice.start, entry.slice.len,
-             entry.slice.len, interner->string.data + entry.slice.start
+      StringInternerEntry entry = entries[i];
+      String str = str_chunks_get(&interner->string, entry.slice);
+      printf("%u\tmeta:%d hash:%lu id:%u start:%d len:%d %.*s \n", i, meta,
+             entry.hash, entry.id, entry.slice.start, entry.slice.len,
+             str.len, str.data
              );
     }
   }
+}
+
+void str_interner_print(StringInterner *interner) {
+  str_interner_print_table(interner, interner->entries, interner->meta,
+                           interner->cap);
+  if (interner->old_entries) {
+    printf("--old table (moved %d of %d) ---\n", interner->migrated,
+           interner->old_cap);
+    str_interner_print_table(interner, interner->old_entries,
+                             interner->old_meta, interner->old_cap);
+  }
   printf("--interner buffer ---\n");
-  str_file_print(interner->string, stdout);
+  for (unsigned i = 0; i < interner->string.len; i++) {
+    bool last = i == interner->string.len - 1;
+    String chunk = {.data = interner->string.chunks[i],
+                    .len = last ? interner->string.used : STR_CHUNK_SIZE};
+    str_file_print(chunk, stdout);
+  }
   printf("\n");
 }
 
 int str_interner_quit(StringInterner *interner) {
   free(interner->meta);
   free(interner->entries);
-  str_quit(&interner->string);
+  free(interner->old_meta);
+  free(interner->old_entries);
+  free(interner->symbols);
+  interner->old_meta = NULL;
+  interner->old_entries = NULL;
+  interner->symbols = NULL;
+  interner->symbols_cap = 0;
+  str_chunks_quit(&interner->string);
   interner->cap = 0;
+  interner->old_cap = 0;
   interner->count = 0;
   return 0;
 }
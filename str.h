@@ -26,6 +26,32 @@ uint64_t str_hash(String *buf);
 uint64_t str_slice_to_uint64(StrSlice slice);
 StrSlice str_slice_from_uint64(uint64_t slice);
 
+// string chunks ///////
+// bytes are appended to large fixed size chunks
+// so they never move once they are stored.
+// a slice start is a global offset where
+// start / STR_CHUNK_SIZE selects the chunk
+
+// one huge page
+#define STR_CHUNK_SIZE (2u * 1024 * 1024)
+
+typedef struct StrChunks {
+  char **chunks;
+  // size of the mapping starting at this chunk,
+  // 0 for chunks that belong to a bigger mapping
+  size_t *mapped;
+  unsigned len;
+  unsigned cap;
+  // bytes used in the last chunk
+  unsigned used;
+} StrChunks;
+
+int      str_chunks_init(StrChunks *chunks);
+void     str_chunks_quit(StrChunks *chunks);
+int      str_chunks_push(StrChunks *chunks, const char *input, unsigned len,
+                         StrSlice *slice);
+String   str_chunks_get(StrChunks *chunks, StrSlice slice);
+
 // string interner ///////
 // this is there to refer to whole strings
 // with a slice that is garuanteed to be unique
@@ -34,8 +60,19 @@ typedef enum StringInternerMeta {
   STR_INTERNER_SLOT_EMPTY = 0b10000000,
 } StringInternerMeta;
 
+// number of old slots that are moved into
+// the new table with every put while resizing
+#define STR_INTERNER_MIGRATE_STEP 8
+
+// every interned string gets a dense id
+// starting at 1, so it can directly index arrays
+typedef uint32_t SymbolId;
+
+#define SYMBOL_NONE 0
+
 typedef struct StringInternerEntry {
   StrSlice slice;
+  SymbolId id;
   uint64_t hash;
 } StringInternerEntry;
 
@@ -44,13 +81,29 @@ typedef struct StringInterner {
   uint8_t *meta;
   unsigned cap;
   unsigned count;
-  String string;
+
+  // while resizing, the previous table stays
+  // readable and gets moved over a few slots
+  // per put instead of rehashing all at once
+  StringInternerEntry *old_entries;
+  uint8_t *old_meta;
+  unsigned old_cap;
+  unsigned migrated;
+
+  // maps symbol ids back to their slices
+  StrSlice *symbols;
+  unsigned symbols_cap;
+
+  StrChunks string;
 } StringInterner;
 
 int      str_interner_init(StringInterner *interner, int cap);
 int      str_interner_quit(StringInterner *interner);
 String   str_interner_get(StringInterner  *interner, StrSlice slice);
 StrSlice str_interner_put(StringInterner  *interner, String str);
+SymbolId str_interner_intern(StringInterner *interner, String str);
+StrSlice str_interner_slice(StringInterner *interner, SymbolId id);
+String   str_interner_symbol(StringInterner *interner, SymbolId id);
 void     str_interner_print(StringInterner *interner);
 
 #endif
@@ -0,0 +1,207 @@
+#include "compiler.h"
+
+//////// strength reduction ///////
+// multiplications and divisions by a constant are emitted as
+// shifts, leal and adds or as a multiplication by a magic
+// number where that is cheaper than imull or idivl. the
+// results wrap around like the instructions they replace
+
+// k if c is 2^k, else -1
+static int strength_log2(uint32_t c) {
+  if (c == 0 || (c & (c - 1)) != 0) {
+    return -1;
+  }
+  return __builtin_ctz(c);
+}
+
+// the scale of the leal that multiplies by c, 0 if there is none
+static int strength_lea_scale(uint32_t c) {
+  return c == 3 || c == 5 || c == 9 ? c - 1 : 0;
+}
+
+// number of instructions reg *= c takes without imull, 3 if
+// imull is cheaper. emits them if file isn't NULL
+static int strength_mul_seq(FILE *file, int indent, AssemblyRegisterType reg,
+                            uint32_t c) {
+  const char *r64 = ir_reg_names[reg][0];
+  const char *r32 = ir_reg_names[reg][1];
+  int shift = c ? __builtin_ctz(c) : 0;
+  uint32_t odd = c >> shift;
+
+  if (odd == 1) {
+    if (file && shift > 0) {
+      fprintf(file, "%*ssall $%d, %s\n", indent, "", shift, r32);
+    }
+    return shift > 0;
+  }
+  if (strength_lea_scale(odd)) {
+    if (file) {
+      fprintf(file, "%*sleal (%s,%s,%d), %s\n", indent, "", r64, r64,
+              strength_lea_scale(odd), r32);
+      if (shift > 0) {
+        fprintf(file, "%*ssall $%d, %s\n", indent, "", shift, r32);
+      }
+    }
+    return 1 + (shift > 0);
+  }
+  if (shift > 0) {
+    return 3;
+  }
+  // 15, 25, 27, 45 and 81
+  for (uint32_t first = 3; first <= 9; first += first - 1) {
+    uint32_t second = c / first;
+    if (c % first == 0 && strength_lea_scale(second)) {
+      if (file) {
+        fprintf(file, "%*sleal (%s,%s,%d), %s\n", indent, "", r64, r64,
+                strength_lea_scale(first), r32);
+        fprintf(file, "%*sleal (%s,%s,%d), %s\n", indent, "", r64, r64,
+                strength_lea_scale(second), r32);
+      }
+      return 2;
+    }
+  }
+  // 2^k + 1 and 2^k - 1, the copy in %ecx costs a register
+  // rename at most
+  int plus = strength_log2(c - 1);
+  int minus = c == UINT32_MAX ? -1 : strength_log2(c + 1);
+  if (plus > 0 || minus > 0) {
+    if (file) {
+      fprintf(file, "%*smovl %s, %%ecx\n", indent, "", r32);
+      fprintf(file, "%*ssall $%d, %s\n", indent, "", plus > 0 ? plus : minus,
+              r32);
+      fprintf(file, "%*s%s %%ecx, %s\n", indent, "",
+              plus > 0 ? "addl" : "subl", r32);
+    }
+    return 2;
+  }
+  return 3;
+}
+
+// reg *= c, clobbers %ecx
+void strength_mul(FILE *file, int indent, AssemblyRegisterType reg,
+                  int32_t c) {
+  const char *r32 = ir_reg_names[reg][1];
+  uint32_t u = (uint32_t)c;
+  if (u == 0) {
+    fprintf(file, "%*smovl $0, %s\n", indent, "", r32);
+    return;
+  }
+  // the negl only pays off if -c takes one instruction
+  bool negate = false;
+  if (strength_mul_seq(NULL, indent, reg, u) > 2 &&
+      strength_mul_seq(NULL, indent, reg, 0u - u) <= 1) {
+    u = 0u - u;
+    negate = true;
+  }
+  if (strength_mul_seq(NULL, indent, reg, u) > 2) {
+    fprintf(file, "%*simull $%d, %s\n", indent, "", c, r32);
+    return;
+  }
+  strength_mul_seq(file, indent, reg, u);
+  if (negate) {
+    fprintf(file, "%*snegl %s\n", indent, "", r32);
+  }
+}
+
+// the magic number and shift of a signed division by d
+// with 2 <= |d| < 2^31, from hacker's delight 10-1
+static void strength_magic(int32_t d, int32_t *magic, int *shift) {
+  const uint32_t two31 = 0x80000000u;
+  uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+  uint32_t t = two31 + ((uint32_t)d >> 31);
+  uint32_t anc = t - 1 - t % ad;
+  uint32_t q1 = two31 / anc;
+  uint32_t r1 = two31 - q1 * anc;
+  uint32_t q2 = two31 / ad;
+  uint32_t r2 = two31 - q2 * ad;
+  uint32_t delta;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  uint32_t m = q2 + 1;
+  *magic = (int32_t)(d < 0 ? 0u - m : m);
+  *shift = p - 32;
+}
+
+// %eax = %eax / d or %eax % d, clobbers %ecx and %edx
+void strength_div(FILE *file, int indent, int32_t d, bool mod) {
+  uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+  int k = strength_log2(ad);
+
+  if (d == 0 || d == -1 || d == INT32_MIN) {
+    // 0 and INT_MIN / -1 trap like they did before
+    fprintf(file, "%*smovl $%d, %%ecx\n", indent, "", d);
+    fprintf(file, "%*scltd\n", indent, "");
+    fprintf(file, "%*sidivl %%ecx\n", indent, "");
+    if (mod) {
+      fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+    }
+    return;
+  }
+  if (d == 1) {
+    if (mod) {
+      fprintf(file, "%*smovl $0, %%eax\n", indent, "");
+    }
+    return;
+  }
+
+  if (k > 0) {
+    // shifts round down, negative numbers get 2^k - 1
+    // added first to round toward zero
+    fprintf(file, "%*smovl %%eax, %%edx\n", indent, "");
+    if (k > 1) {
+      fprintf(file, "%*ssarl $31, %%edx\n", indent, "");
+    }
+    fprintf(file, "%*sshrl $%d, %%edx\n", indent, "", 32 - k);
+    fprintf(file, "%*saddl %%edx, %%eax\n", indent, "");
+    if (mod) {
+      fprintf(file, "%*sandl $%u, %%eax\n", indent, "", ad - 1);
+      fprintf(file, "%*ssubl %%edx, %%eax\n", indent, "");
+      return;
+    }
+    fprintf(file, "%*ssarl $%d, %%eax\n", indent, "", k);
+    if (d < 0) {
+      fprintf(file, "%*snegl %%eax\n", indent, "");
+    }
+    return;
+  }
+
+  // the high half of n * magic, corrected by n if the magic
+  // number overflowed into the sign, and rounded toward zero
+  int32_t magic;
+  int shift;
+  strength_magic(d, &magic, &shift);
+  fprintf(file, "%*smovl %%eax, %%ecx\n", indent, "");
+  fprintf(file, "%*smovl $%d, %%edx\n", indent, "", magic);
+  fprintf(file, "%*simull %%edx\n", indent, "");
+  if (d > 0 && magic < 0) {
+    fprintf(file, "%*saddl %%ecx, %%edx\n", indent, "");
+  } else if (d < 0 && magic > 0) {
+    fprintf(file, "%*ssubl %%ecx, %%edx\n", indent, "");
+  }
+  if (shift > 0) {
+    fprintf(file, "%*ssarl $%d, %%edx\n", indent, "", shift);
+  }
+  fprintf(file, "%*smovl %%edx, %%eax\n", indent, "");
+  fprintf(file, "%*sshrl $31, %%eax\n", indent, "");
+  fprintf(file, "%*saddl %%edx, %%eax\n", indent, "");
+  if (mod) {
+    fprintf(file, "%*simull $%d, %%eax\n", indent, "", d);
+    fprintf(file, "%*ssubl %%eax, %%ecx\n", indent, "");
+    fprintf(file, "%*smovl %%ecx, %%eax\n", indent, "");
+  }
+}
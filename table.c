@@ -3,12 +3,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 int ptr_bucket_init(PtrBucket *table, int cap){
   assert(cap != 0);
-  table->cap = cap;
+  int pow2 = 8;
+  while (pow2 < cap) {
+    pow2 *= 2;
+  }
+  table->cap = pow2;
   table->len = 0;
-  table->data = calloc(cap, sizeof(PtrBucketEntry));
+  table->old = NULL;
+  table->oldcap = 0;
+  table->migrated = 0;
+  table->data = calloc(table->cap, sizeof(PtrBucketEntry));
   if(!table->data){
     fprintf(stderr, "couldn't initialize ptr_bucket \n");
     return -1;
@@ -20,70 +28,178 @@ int ptr_bucket_quit(PtrBucket *table){
   table->cap = 0;
   table->len = 0;
   free(table->data);
+  free(table->old);
+  table->old = NULL;
+  table->oldcap = 0;
   return 0;
 }
 
+// keys like symbol ids or packed slices share most
+// of their bits, so they get mixed before indexing
+uint64_t ptr_bucket_mix(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+PtrBucketEntry *ptr_bucket_find(PtrBucketEntry *data, int cap, uint64_t key) {
+  uint64_t mask = cap - 1;
+  uint64_t index = ptr_bucket_mix(key) & mask;
+  uint32_t dist = 1;
+  while (1) {
+    PtrBucketEntry *entry = &data[index];
+    // an entry closer to its home than we are to ours
+    // means the key would have been placed before it
+    if (entry->dist < dist) {
+      return NULL;
+    }
+    if (entry->key == key) {
+      return entry;
+    }
+    index = (index + 1) & mask;
+    dist++;
+  }
+}
+
+// inserts or updates the key, returns true if the key is new
+bool ptr_bucket_insert(PtrBucketEntry *data, int cap, uint64_t key,
+                       void *value, bool overwrite) {
+  uint64_t mask = cap - 1;
+  uint64_t index = ptr_bucket_mix(key) & mask;
+  PtrBucketEntry toplace = {.data = value, .key = key, .dist = 1};
+  bool placed_key = false;
+  while (1) {
+    PtrBucketEntry *entry = &data[index];
+    if (entry->dist == 0) {
+      *entry = toplace;
+      return true;
+    }
+    if (!placed_key && entry->key == key) {
+      if (overwrite) {
+        entry->data = value;
+      }
+      return false;
+    }
+    if (entry->dist < toplace.dist) {
+      // take the slot from the richer entry
+      // and continue placing that one instead
+      PtrBucketEntry tmp = *entry;
+      *entry = toplace;
+      toplace = tmp;
+      placed_key = true;
+    }
+    index = (index + 1) & mask;
+    toplace.dist++;
+  }
+}
+
+// moves up to num_slots slots of the old array into the new one
+// and frees the old array once everything has been moved
+void ptr_bucket_migrate(PtrBucket *table, int num_slots) {
+  if (!table->old) {
+    return;
+  }
+  int end = table->migrated + num_slots;
+  if (end > table->oldcap) {
+    end = table->oldcap;
+  }
+  for (int i = table->migrated; i < end; i++) {
+    PtrBucketEntry old = table->old[i];
+    if (!old.dist) {
+      continue;
+    }
+    // a put while resizing may already have
+    // stored a newer value for the key
+    ptr_bucket_insert(table->data, table->cap, old.key, old.data, false);
+  }
+  table->migrated = end;
+
+  if (table->migrated >= table->oldcap) {
+    free(table->old);
+    table->old = NULL;
+    table->oldcap = 0;
+    table->migrated = 0;
+  }
+}
+
+void ptr_bucket_flush(PtrBucket *table) {
+  ptr_bucket_migrate(table, table->oldcap);
+}
 
 int ptr_bucket_put(PtrBucket *table, uint64_t key, void *data) {
-  if(table->len * 2 >= table->cap){
+  if (table->old == NULL && (table->len + 1) * PTR_BUCKET_LOAD_DEN >
+                                table->cap * PTR_BUCKET_LOAD_NUM) {
     int newcap = table->cap * 2;
-    int status;
-    PtrBucket newbucket;
-    status = ptr_bucket_init(&newbucket, newcap);
-    if(status < 0){
+    PtrBucketEntry *newdata = calloc(newcap, sizeof(PtrBucketEntry));
+    if(!newdata){
       fprintf(stderr, "couldn't put because resizing failed\n");
       return -1;
     }
-    for(int i=0; i<table->cap; i++){
-      PtrBucketEntry entry = table->data[i];
-      if(entry.key){
-        ptr_bucket_put(&newbucket, entry.key, entry.data);
-      }
-    }
-    free(table->data);
-    *table = newbucket;
+    table->old = table->data;
+    table->oldcap = table->cap;
+    table->migrated = 0;
+    table->data = newdata;
+    table->cap = newcap;
   }
+  ptr_bucket_migrate(table, PTR_BUCKET_MIGRATE_STEP);
 
-  uint64_t index = key % table->cap;
-  PtrBucketEntry *entry = &table->data[index];
-  const int maxTries = 50;
-  int numTries = 0;
-  while(entry->key != 0 && entry->key != key && numTries < maxTries){
-    index = (index + 1) % table->cap;
-    entry = &table->data[index];
-  }
-  if(numTries == maxTries){
-    fprintf(stderr, "ptr_bucket put exceeded max tries %d\n", maxTries);
-    return -1;
+  bool isnew = ptr_bucket_insert(table->data, table->cap, key, data, true);
+  // only a new key if it isn't waiting
+  // in the old array to be moved
+  if (isnew &&
+      (!table->old || !ptr_bucket_find(table->old, table->oldcap, key))) {
+    table->len++;
   }
-  entry->key = key;
-  entry->data = data;
-  table->len++;
   return 0;
 }
 
 void *ptr_bucket_get(PtrBucket *table, uint64_t key) {
-  uint64_t index = key % table->cap;
-  PtrBucketEntry entry = table->data[index];
-  const int maxTries = 50;
-  int numTries = 0;
-  while (entry.key != 0 && entry.key != key && numTries < maxTries) {
-    index = (index + 1) % table->cap;
-    entry = table->data[index];
-    numTries++;
+  PtrBucketEntry *entry = ptr_bucket_find(table->data, table->cap, key);
+  if (entry == NULL && table->old) {
+    entry = ptr_bucket_find(table->old, table->oldcap, key);
   }
-  if (numTries == maxTries) {
-    fprintf(stderr, "ptr_bucket put exceeded max tries %d\n", maxTries);
+  if (entry == NULL) {
     return NULL;
   }
-  if(entry.key == 0){return NULL;}
-  return entry.data;
+  return entry->data;
+}
+
+int ptr_bucket_remove(PtrBucket *table, uint64_t key) {
+  // shifting entries in the old array would move
+  // them behind the migration index, so finish it first
+  ptr_bucket_flush(table);
+
+  PtrBucketEntry *entry = ptr_bucket_find(table->data, table->cap, key);
+  if (entry == NULL) {
+    return -1;
+  }
+
+  // backward shift: pull the following entries one slot
+  // closer to home until one is empty or already at home
+  uint64_t mask = table->cap - 1;
+  uint64_t index = entry - table->data;
+  while (1) {
+    uint64_t next = (index + 1) & mask;
+    if (table->data[next].dist <= 1) {
+      table->data[index].dist = 0;
+      break;
+    }
+    table->data[index] = table->data[next];
+    table->data[index].dist--;
+    index = next;
+  }
+  table->len--;
+  return 0;
 }
 
 void ptr_bucket_print(PtrBucket *table, print_func print){
+  ptr_bucket_flush(table);
   for(int i=0; i<table->cap; i++){
     PtrBucketEntry entry = table->data[i];
-    if(entry.key != 0){
+    if(entry.dist != 0){
       void *d = entry.data;
       print(d);
     }
@@ -91,40 +207,255 @@ void ptr_bucket_print(PtrBucket *table, print_func print){
 }
 
 int ptr_bucket_init_from_bucket(PtrBucket *table, PtrBucket *already_existing){
+  ptr_bucket_flush(already_existing);
   table->cap = already_existing->cap;
+  table->old = NULL;
+  table->oldcap = 0;
+  table->migrated = 0;
   table->data = calloc(already_existing->cap, sizeof(PtrBucketEntry));
-  if(table->data < 0){
+  if(table->data == NULL){
     fprintf(stderr, "couldn't allocate bucket from existing bucket\n");
     return -1;
   }
-  memcpy(table->data, already_existing, sizeof(PtrBucketEntry) * already_existing->cap);
+  memcpy(table->data, already_existing->data, sizeof(PtrBucketEntry) * already_existing->cap);
   table->len = already_existing->len;
   return 0;
 }
 
-int scope_init(Scope *scope){
-  scope->parent = NULL;
-  return ptr_bucket_init(&scope->vars, 10);
+static double ptr_bucket_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
 }
 
-int scope_quit(Scope *scope){
-  ptr_bucket_quit(&scope->vars);
-  scope->parent = NULL;
+// the table before the robin hood rewrite, kept to compare
+// against: it indexes with key % cap, key 0 marks an empty
+// slot, puts probe until they find a free slot and gets give
+// up after 50 tries. only the bench uses it
+typedef struct LinearBucketEntry {
+  void *data;
+  uint64_t key;
+} LinearBucketEntry;
+
+typedef struct LinearBucket {
+  LinearBucketEntry *data;
+  int cap;
+  int len;
+} LinearBucket;
+
+static int linear_bucket_init(LinearBucket *table, int cap) {
+  table->cap = cap;
+  table->len = 0;
+  table->data = calloc(cap, sizeof(LinearBucketEntry));
+  if (!table->data) {
+    fprintf(stderr, "couldn't initialize linear bucket\n");
+    return -1;
+  }
   return 0;
 }
 
-void *scope_get(Scope *scope, uint64_t key) {
-  void *result = ptr_bucket_get(&scope->vars, key);
-  if(result == NULL){
-    if(scope->parent == NULL){
+static int linear_bucket_put(LinearBucket *table, uint64_t key, void *data) {
+  if (table->len * 2 >= table->cap) {
+    LinearBucket newbucket;
+    if (linear_bucket_init(&newbucket, table->cap * 2) < 0) {
+      return -1;
+    }
+    for (int i = 0; i < table->cap; i++) {
+      LinearBucketEntry entry = table->data[i];
+      if (entry.key) {
+        linear_bucket_put(&newbucket, entry.key, entry.data);
+      }
+    }
+    free(table->data);
+    *table = newbucket;
+  }
+  uint64_t index = key % table->cap;
+  while (table->data[index].key != 0 && table->data[index].key != key) {
+    index = (index + 1) % table->cap;
+  }
+  table->data[index].key = key;
+  table->data[index].data = data;
+  table->len++;
+  return 0;
+}
+
+static void *linear_bucket_get(LinearBucket *table, uint64_t key) {
+  uint64_t index = key % table->cap;
+  for (int tries = 0; tries < 50; tries++) {
+    LinearBucketEntry entry = table->data[index];
+    if (entry.key == key) {
+      return entry.data;
+    }
+    if (entry.key == 0) {
       return NULL;
     }
-    return scope_get(scope->parent, key);
+    index = (index + 1) % table->cap;
   }
-  return result;
+  return NULL;
 }
 
-int scope_put(Scope *scope, uint64_t key, void *data){
-  return ptr_bucket_put(&scope->vars, key, data);
+// puts every key once, then looks every key up 10 times,
+// in the current table and in the linear one
+static void ptr_bucket_bench_keys(const char *name, uint64_t *keys,
+                                  int num_keys) {
+  for (int linear = 0; linear < 2; linear++) {
+    PtrBucket table;
+    LinearBucket old;
+    int status = linear ? linear_bucket_init(&old, 8)
+                        : ptr_bucket_init(&table, 8);
+    if (status < 0) {
+      return;
+    }
+    double start = ptr_bucket_now();
+    for (int i = 0; i < num_keys; i++) {
+      if (linear) {
+        linear_bucket_put(&old, keys[i], &keys[i]);
+      } else {
+        ptr_bucket_put(&table, keys[i], &keys[i]);
+      }
+    }
+    double put = ptr_bucket_now();
+    int misses = 0;
+    for (int round = 0; round < 10; round++) {
+      for (int i = 0; i < num_keys; i++) {
+        void *found = linear ? linear_bucket_get(&old, keys[i])
+                             : ptr_bucket_get(&table, keys[i]);
+        misses += found != &keys[i];
+      }
+    }
+    double end = ptr_bucket_now();
+
+    printf("ptr_bucket bench: %d %s, %s put %.1f ms, get %.1f ms, "
+           "%d misses\n",
+           num_keys, name, linear ? "linear" : "robin hood", put - start,
+           end - put, misses);
+    if (linear) {
+      free(old.data);
+    } else {
+      ptr_bucket_quit(&table);
+    }
+  }
 }
 
+// slices of interned struct and function names packed
+// into 64 bits, which share most of their bits, and dense
+// symbol ids for comparison
+void ptr_bucket_bench(int num_keys) {
+  StringInterner interner;
+  uint64_t *keys = malloc(sizeof(uint64_t) * num_keys);
+  if (!keys || str_interner_init(&interner, 64) < 0) {
+    fprintf(stderr, "couldn't set up the ptr_bucket bench\n");
+    free(keys);
+    return;
+  }
+
+  char name[32];
+  for (int i = 0; i < num_keys; i++) {
+    int len = snprintf(name, sizeof(name), i % 2 ? "func_%d" : "Struct%d",
+                       i / 2);
+    String str = {.data = name, .len = len, .cap = 0};
+    keys[i] = str_slice_to_uint64(str_interner_put(&interner, str));
+  }
+  ptr_bucket_bench_keys("packed slice keys", keys, num_keys);
+
+  for (int i = 0; i < num_keys; i++) {
+    keys[i] = i + 1;
+  }
+  ptr_bucket_bench_keys("dense symbol ids", keys, num_keys);
+
+  str_interner_quit(&interner);
+  free(keys);
+}
+
+void symbolmap_init(SymbolMap *map) {
+  map->data = NULL;
+  map->cap = 0;
+}
+
+void symbolmap_quit(SymbolMap *map) {
+  free(map->data);
+  map->data = NULL;
+  map->cap = 0;
+}
+
+void *symbolmap_get(SymbolMap *map, SymbolId id) {
+  if (id >= map->cap) {
+    return NULL;
+  }
+  return map->data[id];
+}
+
+int symbolmap_put(SymbolMap *map, SymbolId id, void *data) {
+  if (id >= map->cap) {
+    uint32_t newcap = map->cap ? map->cap * 2 : 64;
+    while (newcap <= id) {
+      newcap *= 2;
+    }
+    void **newdata = realloc(map->data, sizeof(*map->data) * newcap);
+    if (!newdata) {
+      fprintf(stderr, "couldn't grow symbol map to cap %d\n", newcap);
+      return -1;
+    }
+    memset(newdata + map->cap, 0, sizeof(*newdata) * (newcap - map->cap));
+    map->data = newdata;
+    map->cap = newcap;
+  }
+  map->data[id] = data;
+  return 0;
+}
+
+int scope_init(Scope *scope){
+  symbolmap_init(&scope->current);
+  scope->len = 0;
+  scope->cap = 64;
+  scope->undo = malloc(sizeof(*scope->undo) * scope->cap);
+  if (!scope->undo) {
+    fprintf(stderr, "couldn't initialize scope undo stack with cap %d\n",
+            scope->cap);
+    return -1;
+  }
+  return 0;
+}
+
+int scope_quit(Scope *scope){
+  symbolmap_quit(&scope->current);
+  free(scope->undo);
+  scope->undo = NULL;
+  scope->len = 0;
+  scope->cap = 0;
+  return 0;
+}
+
+int scope_enter(Scope *scope) {
+  return scope->len;
+}
+
+void scope_leave(Scope *scope, int mark) {
+  assert(mark >= 0 && mark <= scope->len);
+  while (scope->len > mark) {
+    scope->len--;
+    ScopeBinding binding = scope->undo[scope->len];
+    symbolmap_put(&scope->current, binding.key, binding.shadowed);
+  }
+}
+
+void *scope_get(Scope *scope, SymbolId key) {
+  return symbolmap_get(&scope->current, key);
+}
+
+int scope_put(Scope *scope, SymbolId key, void *data){
+  if (scope->len >= scope->cap) {
+    int newcap = scope->cap * 2;
+    ScopeBinding *newundo = realloc(scope->undo, sizeof(*newundo) * newcap);
+    if (!newundo) {
+      fprintf(stderr, "couldn't grow scope undo stack to cap %d\n", newcap);
+      return -1;
+    }
+    scope->undo = newundo;
+    scope->cap = newcap;
+  }
+  ScopeBinding binding = {.key = key,
+                          .shadowed = symbolmap_get(&scope->current, key)};
+  scope->undo[scope->len++] = binding;
+  return symbolmap_put(&scope->current, key, data);
+}
@@ -3,15 +3,36 @@
 
 typedef void (*print_func)(void *d);
 
+// robin hood hash map: every entry remembers how far it is
+// from its home slot and inserts take the slot of entries
+// that are closer to home, so probe lengths stay short
 typedef struct PtrBucketEntry {
   void *data;
   uint64_t key;
+  // probe distance + 1, 0 marks an empty slot
+  uint32_t dist;
 } PtrBucketEntry;
 
+// number of old slots that are moved into
+// the new array with every put while resizing
+#define PTR_BUCKET_MIGRATE_STEP 8
+
+// grow when len / cap exceeds this
+#define PTR_BUCKET_LOAD_NUM 7
+#define PTR_BUCKET_LOAD_DEN 8
+
 typedef struct PtrBucket {
   PtrBucketEntry *data;
+  // always a power of two
   int cap;
   int len;
+
+  // while resizing, the previous entries stay
+  // readable and get moved over a few slots
+  // per put instead of rehashing all at once
+  PtrBucketEntry *old;
+  int oldcap;
+  int migrated;
 } PtrBucket;
 
 int ptr_bucket_init(PtrBucket *table, int cap);
@@ -19,6 +40,27 @@ int ptr_bucket_quit(PtrBucket *table);
 int ptr_bucket_init_from_bucket(PtrBucket *table, PtrBucket *already_existing);
 void *ptr_bucket_get(PtrBucket *table, uint64_t key);
 int  ptr_bucket_put(PtrBucket *table, uint64_t key, void *data);
+// returns 0 if the key was removed and -1 if it wasn't there
+int  ptr_bucket_remove(PtrBucket *table, uint64_t key);
 void ptr_bucket_print(PtrBucket *table, print_func pr);
 
+// moves all pending entries of an incremental
+// resize so that every entry is in table->data
+void ptr_bucket_flush(PtrBucket *table);
+
+// times puts and gets of num_keys keys and prints them
+void ptr_bucket_bench(int num_keys);
+
+// maps dense symbol ids of the string interner
+// to pointers with a plain array lookup
+typedef struct SymbolMap {
+  void **data;
+  uint32_t cap;
+} SymbolMap;
+
+void  symbolmap_init(SymbolMap *map);
+void  symbolmap_quit(SymbolMap *map);
+void *symbolmap_get(SymbolMap *map, SymbolId id);
+int   symbolmap_put(SymbolMap *map, SymbolId id, void *data);
+
 #endif
@@ -0,0 +1,11 @@
+int main(){
+  int x = 1;
+  x = (7 >= 6);
+  int y = 2;
+  y = 3 * 4 + (5 < 2);
+  int z = 0;
+  for(int i = 0; i < 3; i = i + 1;){
+    z = (9 == 9) + (8 / 3);
+  }
+  return x + y * 2 + z * 16;
+}
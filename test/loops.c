@@ -0,0 +1,21 @@
+struct Grid {
+  int w;
+  int h;
+  int depth;
+};
+
+int main(){
+  Grid g;
+  g.w = 64;
+  g.h = 32;
+  g.depth = 8;
+  int sum = 0;
+  for(int z = 0; z < g.depth; z = z + 1;){
+    for(int y = 0; y < g.h; y = y + 1;){
+      for(int x = 0; x < g.w; x = x + 1;){
+        sum = sum + x + y * g.w + z * g.w * g.h;
+      }
+    }
+  }
+  return sum % 251;
+}
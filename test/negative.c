@@ -0,0 +1,9 @@
+int main(){
+  int x = 0 - 5;
+  int k = -5;
+  int r = 0;
+  for(int i = -3; i < 2; i = i + 1;){
+    r = r + (i < x) + (x < i) * 2;
+  }
+  return (x < 2) + (k + 10) * 4 + (-k < x) + r * 8;
+}
@@ -8,20 +8,37 @@ int vartable_init(AssemblyVarTable *table){
   assert(table != NULL);
   table->cap = 10;
   table->len = 0;
+  table->written = 0;
+  table->frame_start = 0;
   table->data = malloc(sizeof(*table->data) * table->cap);
   if (!table->data) {
     fprintf(stderr, "Coulndt initialize assembly var table with capacity %d\n",
             table->cap);
     return -1;
   }
+  table->topcap = 64;
+  table->top = malloc(sizeof(*table->top) * table->topcap);
+  if (!table->top) {
+    fprintf(stderr, "Coulndt initialize assembly var table lookup with capacity %d\n",
+            table->topcap);
+    free(table->data);
+    return -1;
+  }
+  for (unsigned i = 0; i < table->topcap; i++) {
+    table->top[i] = -1;
+  }
   return 0;
 }
 
 int vartable_quit(AssemblyVarTable *table) {
   assert(table != NULL);
   free(table->data);
+  free(table->top);
+  table->top = NULL;
+  table->topcap = 0;
   table->cap = 0;
   table->len = 0;
+  table->written = 0;
   return 0;
 }
 
@@ -34,9 +51,33 @@ int vartable_checkpoint_set(AssemblyVarTable *table, int checkpoint) {
   assert(table != NULL);
   assert(checkpoint >= 0);
   table->len = checkpoint;
+  if (table->frame_start > table->len) {
+    table->frame_start = 0;
+  }
   return 0;
 }
 
+int vartable_frame_begin(AssemblyVarTable *table) {
+  assert(table != NULL);
+  int checkpoint = table->len;
+  table->frame_start = table->len;
+  return checkpoint;
+}
+
+// follows the shadowed bindings of name down to the first
+// one that is still below the length of the stack
+int vartable_valid_binding(AssemblyVarTable *table, SymbolId name) {
+  if (name >= table->topcap) {
+    return -1;
+  }
+  int i = table->top[name];
+  while (i >= table->len) {
+    i = table->data[i].shadowed;
+  }
+  table->top[name] = i;
+  return i;
+}
+
 int vartable_add(AssemblyVarTable *table, AssemblyVarInfo info) {
   assert(table != NULL);
   assert(table->data != NULL);
@@ -52,24 +93,52 @@ int vartable_add(AssemblyVarTable *table, AssemblyVarInfo info) {
     table->cap = newcap;
   }
 
+  if (info.name >= table->topcap) {
+    unsigned newcap = table->topcap * 2;
+    while (newcap <= info.name) {
+      newcap *= 2;
+    }
+    int *top = realloc(table->top, sizeof(*table->top) * newcap);
+    if (top == NULL) {
+      fprintf(stderr, "couln't grow assembly var table lookup to cap %d\n", newcap);
+      return -1;
+    }
+    for (unsigned i = table->topcap; i < newcap; i++) {
+      top[i] = -1;
+    }
+    table->top = top;
+    table->topcap = newcap;
+  }
+
+  // the stale binding that gets overwritten may still be the
+  // newest one of its name, so point its name past it first
+  if (table->len < table->written) {
+    vartable_valid_binding(table, table->data[table->len].name);
+  }
+
+  info.isValid = true;
+  info.shadowed = vartable_valid_binding(table, info.name);
   table->data[table->len] = info;
+  table->top[info.name] = table->len;
   table->len++;
+  if (table->len > table->written) {
+    table->written = table->len;
+  }
   return 0;
 }
 
-AssemblyVarInfo vartable_get(AssemblyVarTable *table, uint64_t name){
+AssemblyVarInfo vartable_get(AssemblyVarTable *table, SymbolId name){
   AssemblyVarInfo result = {};
-  for (int i = table->len - 1; i >= 0; i++) {
-    if (table->data[i].name == name) {
-      return table->data[i];
-    }
+  int i = vartable_valid_binding(table, name);
+  if (i < 0) {
+    return result;
   }
-  return result;
+  return table->data[i];
 }
 
 AssemblyVarInfo vartable_last_on_stack(AssemblyVarTable *table){
   AssemblyVarInfo result = {};
-  for (int i = table->len - 1; i >= 0; i++) {
+  for (int i = table->len - 1; i >= table->frame_start; i--) {
     if (table->data[i].isOnStack) {
       return table->data[i];
     }
@@ -77,6 +146,32 @@ AssemblyVarInfo vartable_last_on_stack(AssemblyVarTable *table){
   return result;
 }
 
+int vartable_stack_size(AssemblyVarTable *table) {
+  AssemblyVarInfo last = vartable_last_on_stack(table);
+  if (!last.isValid) {
+    return 0;
+  }
+  return last.stackOffset;
+}
+
+// places a variable below the current top of the
+// stack frame, aligned to align, and returns its offset
+int vartable_add_stack_var(AssemblyVarTable *table, SymbolId name,
+                           unsigned size, unsigned align) {
+  int offset = vartable_stack_size(table) + size;
+  if (align > 1) {
+    offset = offset_align(offset, align);
+  }
+  AssemblyVarInfo info = {.name = name,
+                          .size = size,
+                          .isOnStack = true,
+                          .stackOffset = offset};
+  if (vartable_add(table, info) < 0) {
+    return -1;
+  }
+  return offset;
+}
+
 /* #include "compiler.h" */
 /* #include <stdio.h> */
 /* #include <stdlib.h> */
@@ -0,0 +1,222 @@
+#include "compiler.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool children_list(AstNodeList *list, int index, AstNode **child) {
+  if (index >= list->len) {
+    return false;
+  }
+  *child = list->nodes[index];
+  return true;
+}
+
+#define CHILD(INDEX, FIELD)                                                    \
+  if (index == INDEX) {                                                        \
+    *child = node->FIELD;                                                      \
+    return true;                                                               \
+  }
+
+static bool AST_LITERAL_children(AstNode *node, int index, AstNode **child) {
+  (void)node;
+  (void)index;
+  (void)child;
+  return false;
+}
+
+static bool AST_STRUCT_children(AstNode *node, int index, AstNode **child) {
+  return children_list(&node->structure.members, index, child);
+}
+
+static bool AST_DECL_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, decl.expr);
+  return false;
+}
+
+static bool AST_MEMBER_ACCESS_children(AstNode *node, int index,
+                                       AstNode **child) {
+  CHILD(0, member.next);
+  return false;
+}
+
+static bool AST_VAR_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, var.member_access);
+  return false;
+}
+
+static bool AST_PROGRAM_children(AstNode *node, int index, AstNode **child) {
+  return children_list(&node->program.items, index, child);
+}
+
+static bool AST_FUNC_PROTO_children(AstNode *node, int index,
+                                    AstNode **child) {
+  return children_list(&node->funcproto.params, index, child);
+}
+
+static bool AST_FUNC_DEF_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, func.prototype);
+  CHILD(1, func.block);
+  return false;
+}
+
+static bool AST_FUNC_CALL_children(AstNode *node, int index,
+                                   AstNode **child) {
+  return children_list(&node->funccall.params, index, child);
+}
+
+static bool AST_BLOCK_children(AstNode *node, int index, AstNode **child) {
+  return children_list(&node->block, index, child);
+}
+
+static bool AST_IF_ELSE_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, ifelse.condition);
+  CHILD(1, ifelse.ifblock);
+  CHILD(2, ifelse.elseblock);
+  return false;
+}
+
+static bool AST_RETURN_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, ret.expr);
+  return false;
+}
+
+static bool AST_BREAK_children(AstNode *node, int index, AstNode **child) {
+  (void)node;
+  (void)index;
+  (void)child;
+  return false;
+}
+
+static bool AST_BINOP_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, binop.left);
+  CHILD(1, binop.right);
+  return false;
+}
+
+static bool AST_UNOP_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, unop.expr);
+  return false;
+}
+
+// in the order they are executed
+static bool AST_FORLOOP_children(AstNode *node, int index, AstNode **child) {
+  CHILD(0, forloop.init);
+  CHILD(1, forloop.condition);
+  CHILD(2, forloop.stmt);
+  CHILD(3, forloop.step);
+  return false;
+}
+
+static bool AST_ERROR_children(AstNode *node, int index, AstNode **child) {
+  if (node->error.kind != ERR_INVALID_AST) {
+    return false;
+  }
+  CHILD(0, error.invalid.node);
+  return false;
+}
+
+#undef CHILD
+
+#define GENERATE_CHILDREN(KIND) [KIND] = KIND##_children,
+
+static bool (*const ast_children[])(AstNode *, int, AstNode **) = {
+    FOREACH_AST_KIND(GENERATE_CHILDREN)};
+
+bool astnode_child(AstNode *node, int index, AstNode **child) {
+  return ast_children[node->kind](node, index, child);
+}
+
+void astwalk_init(AstWalk *walk, ast_pre_hook pre, ast_in_hook in,
+                  ast_post_hook post, void *data) {
+  walk->pre = pre;
+  walk->in = in;
+  walk->post = post;
+  walk->visit_null = false;
+  walk->data = data;
+  walk->stack = walk->inline_frames;
+  walk->len = 0;
+  walk->cap = ASTWALK_INLINE_FRAMES;
+}
+
+void astwalk_quit(AstWalk *walk) {
+  if (walk->stack != walk->inline_frames) {
+    free(walk->stack);
+  }
+  walk->stack = walk->inline_frames;
+  walk->len = 0;
+  walk->cap = ASTWALK_INLINE_FRAMES;
+}
+
+static int astwalk_push(AstWalk *walk, AstNode *node, int value) {
+  if (walk->len >= walk->cap) {
+    int newcap = walk->cap * 2;
+    AstWalkFrame *newstack;
+    if (walk->stack == walk->inline_frames) {
+      newstack = malloc(sizeof(AstWalkFrame) * newcap);
+      if (newstack) {
+        memcpy(newstack, walk->inline_frames, sizeof(AstWalkFrame) * walk->len);
+      }
+    } else {
+      newstack = realloc(walk->stack, sizeof(AstWalkFrame) * newcap);
+    }
+    if (!newstack) {
+      fprintf(stderr, "couldn't grow ast walk stack to %d frames\n", newcap);
+      return -1;
+    }
+    walk->stack = newstack;
+    walk->cap = newcap;
+  }
+  AstWalkFrame *frame = &walk->stack[walk->len++];
+  frame->node = node;
+  frame->child = 0;
+  frame->value = value;
+  frame->scratch[0] = 0;
+  frame->scratch[1] = 0;
+
+  if (walk->pre && !walk->pre(walk, frame)) {
+    walk->len--;
+  }
+  return 0;
+}
+
+AstWalkFrame *astwalk_parent(AstWalk *walk) {
+  if (walk->len < 2) {
+    return NULL;
+  }
+  return &walk->stack[walk->len - 2];
+}
+
+int astwalk_run(AstWalk *walk, AstNode *root, int value) {
+  if (root == NULL && !walk->visit_null) {
+    return 0;
+  }
+  int base = walk->len;
+  if (astwalk_push(walk, root, value) < 0) {
+    return -1;
+  }
+
+  while (walk->len > base) {
+    AstWalkFrame *frame = &walk->stack[walk->len - 1];
+    AstNode *child = NULL;
+    if (frame->node && astnode_child(frame->node, frame->child, &child)) {
+      int index = frame->child++;
+      if (index > 0 && walk->in) {
+        walk->in(walk, frame, index);
+      }
+      if (child == NULL && !walk->visit_null) {
+        continue;
+      }
+      if (astwalk_push(walk, child, frame->value) < 0) {
+        walk->len = base;
+        return -1;
+      }
+      continue;
+    }
+
+    if (walk->post) {
+      walk->post(walk, frame);
+    }
+    walk->len--;
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MY_WALK_H
+#define MY_WALK_H
+
+//////// ast traversal ///////////
+// visits a tree with an explicit stack instead of recursion,
+// so deep trees (long a+b+c+... chains are left deep) can't
+// overflow the c stack. the children of every kind come from
+// a table generated from FOREACH_AST_KIND
+typedef struct AstWalkFrame {
+  struct AstNode *node;
+  // index of the next child to visit
+  int child;
+  // free for the pass, starts as the value of the parent
+  int value;
+  // free for the pass, starts as zero
+  int scratch[2];
+} AstWalkFrame;
+
+struct AstWalk;
+
+// called when a node is entered, children (and post)
+// are skipped if it returns false
+typedef bool (*ast_pre_hook)(struct AstWalk *walk, AstWalkFrame *frame);
+// called between two children, before visiting child
+typedef void (*ast_in_hook)(struct AstWalk *walk, AstWalkFrame *frame,
+                            int child);
+// called after all children were visited
+typedef void (*ast_post_hook)(struct AstWalk *walk, AstWalkFrame *frame);
+
+#define ASTWALK_INLINE_FRAMES 64
+
+typedef struct AstWalk {
+  ast_pre_hook pre;
+  ast_in_hook in;
+  ast_post_hook post;
+  // also enter children that are NULL
+  bool visit_null;
+  void *data;
+
+  AstWalkFrame *stack;
+  int len;
+  int cap;
+  AstWalkFrame inline_frames[ASTWALK_INLINE_FRAMES];
+} AstWalk;
+
+void          astwalk_init(AstWalk *walk, ast_pre_hook pre, ast_in_hook in,
+                           ast_post_hook post, void *data);
+void          astwalk_quit(AstWalk *walk);
+int           astwalk_run(AstWalk *walk, struct AstNode *root, int value);
+AstWalkFrame *astwalk_parent(AstWalk *walk);
+
+// writes the child with the index into child and returns
+// true, false if the node has no child with that index
+bool astnode_child(struct AstNode *node, int index, struct AstNode **child);
+
+#endif